@@ -0,0 +1,256 @@
+/**
+ * @file bench.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief End-to-end benchmarks for the vmrcli parse and execute path.
+ * Canned workloads are fed to a session, exactly as the CLI feeds its input,
+ * against a stub iVMR interface with configurable latency.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <windows.h>
+#include "session.h"
+#include "log.h"
+#include "stub.h"
+
+#define BENCH_USAGE "Usage: .\\bench.exe [-n <ops>] [-d <latency us>] [-s <script>] [-o <output>]"
+#define BENCH_OPTSTR ":n:d:s:o:"
+#define DEFAULT_OPS 10000
+#define DEFAULT_SCRIPT "example_commands.txt"
+#define DEFAULT_OUTPUT "bench_output.txt"
+#define MAX_SCRIPT_LINES 1024
+#define MAX_LINE 4096
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+
+/**
+ * @struct A canned workload, gen writes the i'th input line into buf
+ */
+struct workload
+{
+    const char *name;
+    void (*gen)(char *buf, size_t n, int i);
+    long long coalesce_us; /* The session's coalescing frame while the workload runs */
+};
+
+static char script_lines[MAX_SCRIPT_LINES][MAX_LINE];
+static int num_script_lines;
+static LARGE_INTEGER frequency;
+
+static void gen_get(char *buf, size_t n, int i)
+{
+    snprintf(buf, n, "strip[%d].gain", i % 8);
+}
+
+static void gen_set(char *buf, size_t n, int i)
+{
+    snprintf(buf, n, "strip[%d].gain=%.1f", i % 8, -(float)(i % 60));
+}
+
+static void gen_fader(char *buf, size_t n, int i)
+{
+    snprintf(buf, n, "strip[0].gain=%.2f", -60.0f + (float)(i % 6000) / 100);
+}
+
+static void gen_toggle(char *buf, size_t n, int i)
+{
+    if (i % 2 == 0)
+        snprintf(buf, n, "!strip[%d].mute", i % 8);
+    else
+        snprintf(buf, n, "strip[%d].mute", i % 8);
+}
+
+static void gen_label(char *buf, size_t n, int i)
+{
+    snprintf(buf, n, "strip[%d].label=\"my podmic %d\"", i % 8, i);
+}
+
+static void gen_script(char *buf, size_t n, int i)
+{
+    snprintf(buf, n, "%s", script_lines[i % num_script_lines]);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* get results are printed through the session, discard them */
+static void discard(void *udata, const char *text)
+{
+    (void)udata;
+    (void)text;
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+    int i = (int)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+/**
+ * @brief Load the script used by the 'script' workload, skipping blank lines.
+ *
+ * @param path Path to the script
+ * @return int Number of lines loaded
+ */
+static int load_script(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+
+    while (num_script_lines < MAX_SCRIPT_LINES &&
+           fgets(script_lines[num_script_lines], MAX_LINE, fp) != NULL)
+    {
+        char *line = script_lines[num_script_lines];
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0')
+            num_script_lines++;
+    }
+    fclose(fp);
+    return num_script_lines;
+}
+
+/**
+ * @brief Run a single workload and append its results to the output file.
+ *
+ * @param session The session, holding the stub interface
+ * @param w The workload to run
+ * @param ops Number of input lines to run
+ * @param samples Scratch buffer of ops doubles for per-line latencies
+ * @param out The machine readable output file
+ */
+static void run_workload(struct vmrcli_session *session, const struct workload *w,
+                         int ops, double *samples, FILE *out)
+{
+    char input[MAX_LINE];
+    LARGE_INTEGER start, end, t0, t1;
+
+    stub_reset_stats();
+    session->cache.stats = (struct cache_stats){0};
+    session->coalescer.frame_us = w->coalesce_us;
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < ops; i++)
+    {
+        w->gen(input, sizeof(input), i);
+        QueryPerformanceCounter(&t0);
+        session_feed(session, input);
+        QueryPerformanceCounter(&t1);
+        samples[i] = (double)(t1.QuadPart - t0.QuadPart) * 1e6 / (double)frequency.QuadPart;
+    }
+    sched_lock(&session->sched);
+    coalesce_flush(&session->coalescer);
+    sched_unlock(&session->sched);
+    QueryPerformanceCounter(&end);
+
+    double total_ms = (double)(end.QuadPart - start.QuadPart) * 1e3 / (double)frequency.QuadPart;
+    qsort(samples, ops, sizeof(double), compare_doubles);
+    struct stub_stats stats = stub_get_stats();
+
+    fprintf(out, "%s,%d,%.3f,%.1f,%.2f,%.2f,%.2f,%.2f,%lld,%lld,%lld,%lld,%lld\n",
+            w->name, ops, total_ms, ops / (total_ms / 1e3),
+            percentile(samples, ops, 0.50), percentile(samples, ops, 0.90),
+            percentile(samples, ops, 0.99), samples[ops - 1],
+            stats.gets, stats.sets, stats.scripts, stats.dirty_polls,
+            session->cache.stats.suppressed);
+    fprintf(stderr, "%-8s %8d ops %10.1f ops/s  p50 %8.2fus  p99 %8.2fus\n",
+            w->name, ops, ops / (total_ms / 1e3),
+            percentile(samples, ops, 0.50), percentile(samples, ops, 0.99));
+}
+
+/**
+ * @brief Entry point of the benchmark suite.
+ *
+ * @param argc Number of command-line arguments
+ * @param argv Array of command-line arguments
+ * @return int Exit status
+ */
+int main(int argc, char *argv[])
+{
+    int ops = DEFAULT_OPS;
+    long latency_us = 0;
+    char *script = DEFAULT_SCRIPT;
+    char *output = DEFAULT_OUTPUT;
+
+    opterr = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, BENCH_OPTSTR)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        case 'd':
+            latency_us = atol(optarg);
+            break;
+        case 's':
+            script = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            puts(BENCH_USAGE);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (ops <= 0)
+    {
+        puts(BENCH_USAGE);
+        exit(EXIT_FAILURE);
+    }
+
+    log_set_level(LOG_ERROR);
+    QueryPerformanceFrequency(&frequency);
+
+    PT_VMR vmr = create_stub_interface(latency_us);
+    double *samples = malloc(ops * sizeof(double));
+    FILE *out = fopen(output, "w");
+    if (vmr == NULL || samples == NULL || out == NULL)
+    {
+        log_fatal("Failed to set up the benchmark");
+        exit(EXIT_FAILURE);
+    }
+    struct vmrcli_session session;
+    session_init(&session, vmr, &(struct vmrcli_options){.kind = BANANAX64, .output = discard});
+
+    const struct workload workloads[] = {
+        {.name = "get", .gen = gen_get},
+        {.name = "set", .gen = gen_set},
+        {.name = "fader", .gen = gen_fader, .coalesce_us = 5000},
+        {.name = "toggle", .gen = gen_toggle},
+        {.name = "label", .gen = gen_label},
+        {.name = "script", .gen = gen_script},
+    };
+    int num_workloads = (int)COUNT_OF(workloads);
+    if (load_script(script) == 0)
+    {
+        log_warn("Unable to load script '%s', skipping the script workload", script);
+        num_workloads--;
+    }
+
+    fprintf(out, "workload,ops,total_ms,ops_per_sec,p50_us,p90_us,p99_us,max_us,"
+                 "gets,sets,scripts,dirty_polls,suppressed\n");
+    fprintf(stderr, "Running %d ops per workload, %ld us simulated latency\n", ops, latency_us);
+
+    for (int i = 0; i < num_workloads; i++)
+    {
+        run_workload(&session, &workloads[i], ops, samples, out);
+    }
+
+    fclose(out);
+    free(samples);
+    session_free(&session);
+    free(vmr);
+    fprintf(stderr, "Results written to %s\n", output);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,491 @@
+/**
+ * @file stub.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief An in-memory stand-in for the iVMR interface.
+ * Used by the benchmark suite so the parse and execute path can be
+ * measured without a running Voicemeeter.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include "stub.h"
+#include "utf.h"
+
+#define STUB_TABLE_SZ 4096 /* Must be a power of two */
+#define STUB_NAME_SZ 128
+#define STUB_STRING_SZ 512
+#define STUB_SCRIPT_SZ 48001 /* SetParameters accepts scripts of up to 48kB */
+
+/**
+ * @struct A single parameter held by the stub backend
+ */
+struct stub_param
+{
+    bool used;
+    bool is_string;
+    char name[STUB_NAME_SZ];
+    float f;
+    unsigned short s[STUB_STRING_SZ];
+};
+
+static struct stub_param table[STUB_TABLE_SZ];
+static struct stub_stats stats;
+static long latency;
+static bool dirty;
+static LARGE_INTEGER frequency;
+
+/**
+ * @brief Busy waits for the configured latency, simulating the cost
+ * of a round trip into the Voicemeeter engine.
+ */
+static void simulate_latency(void)
+{
+    if (latency <= 0)
+        return;
+
+    LARGE_INTEGER start, now;
+    QueryPerformanceCounter(&start);
+    do
+    {
+        QueryPerformanceCounter(&now);
+    } while ((now.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart < latency);
+}
+
+static unsigned long hash(const char *s, size_t n)
+{
+    unsigned long h = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)tolower((unsigned char)s[i])) * 16777619u;
+    return h;
+}
+
+static bool is_string_param(const char *name)
+{
+    return strstr(name, "label") != NULL ||
+           strstr(name, "device") != NULL ||
+           strstr(name, "name") != NULL;
+}
+
+/**
+ * @brief Find the slot for a parameter, creating it if required.
+ *
+ * @param name The parameter name, need not be NUL terminated
+ * @param n Length of the parameter name
+ * @return struct stub_param* May return NULL if the table is full
+ */
+static struct stub_param *lookup(const char *name, size_t n)
+{
+    if (n >= STUB_NAME_SZ)
+        return NULL;
+
+    unsigned long i = hash(name, n) & (STUB_TABLE_SZ - 1);
+    for (int probes = 0; probes < STUB_TABLE_SZ; probes++)
+    {
+        struct stub_param *p = &table[i];
+        if (!p->used)
+        {
+            p->used = true;
+            /* parameter names are case insensitive, as they are in the engine */
+            for (size_t j = 0; j < n; j++)
+                p->name[j] = (char)tolower((unsigned char)name[j]);
+            p->name[n] = '\0';
+            p->is_string = is_string_param(p->name);
+            return p;
+        }
+        if (strncasecmp(p->name, name, n) == 0 && p->name[n] == '\0')
+            return p;
+        i = (i + 1) & (STUB_TABLE_SZ - 1);
+    }
+    return NULL;
+}
+
+static void store_string(struct stub_param *p, const unsigned short *s, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n && s[i] != 0 && i < STUB_STRING_SZ - 1; i++)
+        p->s[i] = s[i];
+    p->s[i] = 0;
+}
+
+/**
+ * @brief Widen a narrow string into UTF-16 units, byte for byte as the A entry points do.
+ */
+static void widen(const char *s, unsigned short *out, size_t max)
+{
+    size_t i;
+    for (i = 0; s[i] != '\0' && i < max - 1; i++)
+        out[i] = (unsigned char)s[i];
+    out[i] = 0;
+}
+
+/**
+ * @brief Apply a single 'name=value', 'name+=value' or 'name-=value' statement.
+ */
+static void apply_statement(const unsigned short *stmt, size_t n)
+{
+    char narrow[STUB_NAME_SZ];
+    size_t eq;
+    for (eq = 0; eq < n && stmt[eq] != '='; eq++)
+        ;
+    if (eq == n || eq == 0 || eq >= sizeof(narrow))
+        return;
+
+    char op = '=';
+    size_t name_len = eq;
+    if (stmt[eq - 1] == '+' || stmt[eq - 1] == '-')
+    {
+        op = (char)stmt[eq - 1];
+        name_len--;
+    }
+    for (size_t i = 0; i < name_len; i++)
+        narrow[i] = (char)stmt[i];
+
+    struct stub_param *p = lookup(narrow, name_len);
+    if (p == NULL)
+        return;
+
+    const unsigned short *value = stmt + eq + 1;
+    size_t value_len = n - eq - 1;
+    if (value_len >= 2 && value[0] == '"' && value[value_len - 1] == '"')
+    {
+        value++;
+        value_len -= 2;
+    }
+
+    if (p->is_string)
+    {
+        store_string(p, value, value_len);
+        return;
+    }
+
+    char num[64];
+    if (value_len >= sizeof(num))
+        return;
+    for (size_t i = 0; i < value_len; i++)
+        num[i] = (char)value[i];
+    num[value_len] = '\0';
+    float f = strtof(num, NULL);
+
+    if (op == '+')
+        p->f += f;
+    else if (op == '-')
+        p->f -= f;
+    else
+        p->f = f;
+}
+
+/**
+ * @brief Apply every statement of a script, split on ';', ',' and newlines outside quotes.
+ */
+static void apply_script(const unsigned short *script)
+{
+    const unsigned short *start = script;
+    bool inside_quotes = false;
+    for (const unsigned short *p = script;; p++)
+    {
+        if (*p == '"')
+            inside_quotes = !inside_quotes;
+        if (*p == 0 || (!inside_quotes && (*p == ';' || *p == '\n' || *p == '\r' || *p == ',')))
+        {
+            if (p > start)
+                apply_statement(start, (size_t)(p - start));
+            if (*p == 0)
+                break;
+            start = p + 1;
+        }
+    }
+}
+
+static long __stdcall stub_login(void) { return 0; }
+static long __stdcall stub_logout(void) { return 0; }
+static long __stdcall stub_run_voicemeeter(long kind)
+{
+    (void)kind;
+    return 0;
+}
+
+static long __stdcall stub_get_type(long *type)
+{
+    *type = 2;
+    return 0;
+}
+
+static long __stdcall stub_get_version(long *version)
+{
+    *version = 0x02010000;
+    return 0;
+}
+
+static long __stdcall stub_is_parameters_dirty(void)
+{
+    stats.dirty_polls++;
+    simulate_latency();
+    if (dirty)
+    {
+        dirty = false;
+        return 1;
+    }
+    return 0;
+}
+
+static long __stdcall stub_get_parameter_float(char *name, float *f)
+{
+    stats.gets++;
+    simulate_latency();
+    struct stub_param *p = lookup(name, strlen(name));
+    if (p == NULL || p->is_string)
+        return -3;
+    *f = p->f;
+    return 0;
+}
+
+static long __stdcall stub_get_parameter_string_w(char *name, unsigned short *s)
+{
+    stats.gets++;
+    simulate_latency();
+    struct stub_param *p = lookup(name, strlen(name));
+    if (p == NULL || !p->is_string)
+        return -3;
+    memcpy(s, p->s, sizeof(p->s));
+    return 0;
+}
+
+static long __stdcall stub_set_parameter_float(char *name, float f)
+{
+    stats.sets++;
+    simulate_latency();
+    struct stub_param *p = lookup(name, strlen(name));
+    if (p == NULL || p->is_string)
+        return -3;
+    p->f = f;
+    dirty = true;
+    return 0;
+}
+
+static long __stdcall stub_set_parameter_string_a(char *name, char *s)
+{
+    stats.sets++;
+    simulate_latency();
+    struct stub_param *p = lookup(name, strlen(name));
+    if (p == NULL || !p->is_string)
+        return -3;
+    unsigned short wide[STUB_STRING_SZ];
+    widen(s, wide, STUB_STRING_SZ);
+    store_string(p, wide, STUB_STRING_SZ);
+    dirty = true;
+    return 0;
+}
+
+static long __stdcall stub_set_parameter_string_w(char *name, unsigned short *s)
+{
+    stats.sets++;
+    simulate_latency();
+    struct stub_param *p = lookup(name, strlen(name));
+    if (p == NULL || !p->is_string)
+        return -3;
+    store_string(p, s, STUB_STRING_SZ);
+    dirty = true;
+    return 0;
+}
+
+static long __stdcall stub_set_parameters(char *script)
+{
+    static unsigned short wide[STUB_SCRIPT_SZ];
+
+    stats.scripts++;
+    simulate_latency();
+    widen(script, wide, STUB_SCRIPT_SZ);
+    apply_script(wide);
+    dirty = true;
+    return 0;
+}
+
+static long __stdcall stub_set_parameters_w(unsigned short *script)
+{
+    stats.scripts++;
+    simulate_latency();
+    apply_script(script);
+    dirty = true;
+    return 0;
+}
+
+static long __stdcall stub_get_level(long type, long channel, float *f)
+{
+    (void)type;
+    (void)channel;
+    simulate_latency();
+    *f = 0.0f;
+    return 0;
+}
+
+/**
+ * @struct A fake audio device
+ */
+static const struct
+{
+    bool output;
+    long type;
+    const char *name;
+    const char *hwid;
+} stub_devices[] = {
+    {false, VBVMR_DEVTYPE_WDM, "Microphone (Realtek(R) Audio)", "{0.0.1.00000000}.{mic}"},
+    {false, VBVMR_DEVTYPE_MME, "Microphone (Realtek(R) Audio)", "{0.0.1.00000000}.{mic}"},
+    {false, VBVMR_DEVTYPE_WDM, "Podcast Mic (USB Audio)", "{0.0.1.00000000}.{usb}"},
+    {true, VBVMR_DEVTYPE_WDM, "Speakers (Realtek(R) Audio)", "{0.0.0.00000000}.{spk}"},
+    {true, VBVMR_DEVTYPE_WDM, "Headphones (USB Audio)", "{0.0.0.00000000}.{usb}"},
+    {true, VBVMR_DEVTYPE_ASIO, "ASIO4ALL v2", "asio4all"},
+    {true, VBVMR_DEVTYPE_WDM, "Haut-parleurs (Périphérique audio)", "{0.0.0.00000000}.{hdmi}"},
+};
+
+static long count_devices(bool output)
+{
+    long n = 0;
+    for (size_t i = 0; i < sizeof(stub_devices) / sizeof(stub_devices[0]); i++)
+        n += stub_devices[i].output == output;
+    return n;
+}
+
+static long describe_device(bool output, long index, long *type, char *name, char *hwid)
+{
+    simulate_latency();
+    for (size_t i = 0; i < sizeof(stub_devices) / sizeof(stub_devices[0]); i++)
+    {
+        if (stub_devices[i].output != output || index-- > 0)
+            continue;
+        *type = stub_devices[i].type;
+        strcpy(name, stub_devices[i].name);
+        strcpy(hwid, stub_devices[i].hwid);
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Describe a device with its name and hardware id as UTF-16, as the W entry points do
+ */
+static long describe_device_w(bool output, long index, long *type, unsigned short *name, unsigned short *hwid)
+{
+    char name_utf8[256], hwid_utf8[256];
+    long rep = describe_device(output, index, type, name_utf8, hwid_utf8);
+    if (rep == 0)
+    {
+        name[utf8_to_utf16(name_utf8, strlen(name_utf8), (uint16_t *)name, 255)] = 0;
+        hwid[utf8_to_utf16(hwid_utf8, strlen(hwid_utf8), (uint16_t *)hwid, 255)] = 0;
+    }
+    return rep;
+}
+
+static long __stdcall stub_input_get_device_number(void) { return count_devices(false); }
+static long __stdcall stub_output_get_device_number(void) { return count_devices(true); }
+
+static long __stdcall stub_input_get_device_desc_a(long index, long *type, char *name, char *hwid)
+{
+    return describe_device(false, index, type, name, hwid);
+}
+
+static long __stdcall stub_output_get_device_desc_a(long index, long *type, char *name, char *hwid)
+{
+    return describe_device(true, index, type, name, hwid);
+}
+
+static long __stdcall stub_input_get_device_desc_w(long index, long *type, unsigned short *name, unsigned short *hwid)
+{
+    return describe_device_w(false, index, type, name, hwid);
+}
+
+static long __stdcall stub_output_get_device_desc_w(long index, long *type, unsigned short *name, unsigned short *hwid)
+{
+    return describe_device_w(true, index, type, name, hwid);
+}
+
+static long __stdcall stub_macrobutton_is_dirty(void) { return 0; }
+
+static long __stdcall stub_macrobutton_get_status(long n, float *f, long mode)
+{
+    (void)n;
+    (void)mode;
+    *f = 0.0f;
+    return 0;
+}
+
+static long __stdcall stub_macrobutton_set_status(long n, float f, long mode)
+{
+    (void)n;
+    (void)f;
+    (void)mode;
+    return 0;
+}
+
+/**
+ * @brief Create a stub interface object
+ *
+ * @param latency_us Simulated latency of every engine call, in microseconds
+ * @return PT_VMR Pointer to a stub iVMR interface
+ * May return NULL if the interface fails to allocate
+ */
+PT_VMR create_stub_interface(long latency_us)
+{
+    PT_VMR vmr = calloc(1, sizeof(T_VBVMR_INTERFACE));
+    if (vmr == NULL)
+        return NULL;
+
+    latency = latency_us;
+    QueryPerformanceFrequency(&frequency);
+
+    vmr->VBVMR_Login = stub_login;
+    vmr->VBVMR_Logout = stub_logout;
+    vmr->VBVMR_RunVoicemeeter = stub_run_voicemeeter;
+    vmr->VBVMR_GetVoicemeeterType = stub_get_type;
+    vmr->VBVMR_GetVoicemeeterVersion = stub_get_version;
+
+    vmr->VBVMR_IsParametersDirty = stub_is_parameters_dirty;
+    vmr->VBVMR_GetParameterFloat = stub_get_parameter_float;
+    vmr->VBVMR_GetParameterStringW = stub_get_parameter_string_w;
+    vmr->VBVMR_GetLevel = stub_get_level;
+
+    vmr->VBVMR_SetParameterFloat = stub_set_parameter_float;
+    vmr->VBVMR_SetParameters = stub_set_parameters;
+    vmr->VBVMR_SetParametersW = stub_set_parameters_w;
+    vmr->VBVMR_SetParameterStringA = stub_set_parameter_string_a;
+    vmr->VBVMR_SetParameterStringW = stub_set_parameter_string_w;
+
+    vmr->VBVMR_Output_GetDeviceNumber = stub_output_get_device_number;
+    vmr->VBVMR_Input_GetDeviceNumber = stub_input_get_device_number;
+    vmr->VBVMR_Output_GetDeviceDescA = stub_output_get_device_desc_a;
+    vmr->VBVMR_Input_GetDeviceDescA = stub_input_get_device_desc_a;
+    vmr->VBVMR_Output_GetDeviceDescW = stub_output_get_device_desc_w;
+    vmr->VBVMR_Input_GetDeviceDescW = stub_input_get_device_desc_w;
+
+    vmr->VBVMR_MacroButton_IsDirty = stub_macrobutton_is_dirty;
+    vmr->VBVMR_MacroButton_GetStatus = stub_macrobutton_get_status;
+    vmr->VBVMR_MacroButton_SetStatus = stub_macrobutton_set_status;
+
+    return vmr;
+}
+
+/**
+ * @brief Zero the call counters
+ */
+void stub_reset_stats(void)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+/**
+ * @brief Get a copy of the call counters
+ *
+ * @return struct stub_stats
+ */
+struct stub_stats stub_get_stats(void)
+{
+    return stats;
+}
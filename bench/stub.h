@@ -0,0 +1,28 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `stub.c` for details.
+ */
+
+#ifndef __STUB_H__
+#define __STUB_H__
+
+#include "VoicemeeterRemote.h"
+
+/**
+ * @struct Counters for the calls made into the stub backend
+ */
+struct stub_stats
+{
+    long long gets;
+    long long sets;
+    long long scripts;
+    long long dirty_polls;
+};
+
+PT_VMR create_stub_interface(long latency_us);
+void stub_reset_stats(void);
+struct stub_stats stub_get_stats(void);
+
+#endif /* __STUB_H__ */
@@ -0,0 +1,79 @@
+/**
+ * @file stublib.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Exports the stub backend under the names of the remote API.
+ * Built with stub.c into a shared library that vmrcli loads in place of
+ * VoicemeeterRemote64.dll (see --dll and VMRCLI_DLL). Like an older library,
+ * it exports no levels, MIDI or audio callback entry points.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include "stub.h"
+
+#define STUB_API __declspec(dllexport)
+
+static PT_VMR vmr;
+
+/**
+ * @brief Create the stub interface on first use
+ *
+ * @return PT_VMR The stub interface, NULL if it could not be allocated
+ */
+static PT_VMR stub(void)
+{
+    if (vmr == NULL)
+        vmr = create_stub_interface(0);
+    return vmr;
+}
+
+STUB_API long __stdcall VBVMR_Login(void)
+{
+    return stub() ? stub()->VBVMR_Login() : -1;
+}
+
+STUB_API long __stdcall VBVMR_Logout(void) { return stub()->VBVMR_Logout(); }
+STUB_API long __stdcall VBVMR_RunVoicemeeter(long kind) { return stub()->VBVMR_RunVoicemeeter(kind); }
+STUB_API long __stdcall VBVMR_GetVoicemeeterType(long *kind) { return stub()->VBVMR_GetVoicemeeterType(kind); }
+STUB_API long __stdcall VBVMR_GetVoicemeeterVersion(long *version) { return stub()->VBVMR_GetVoicemeeterVersion(version); }
+
+STUB_API long __stdcall VBVMR_IsParametersDirty(void) { return stub()->VBVMR_IsParametersDirty(); }
+STUB_API long __stdcall VBVMR_GetParameterFloat(char *param, float *f) { return stub()->VBVMR_GetParameterFloat(param, f); }
+STUB_API long __stdcall VBVMR_GetParameterStringW(char *param, unsigned short *s) { return stub()->VBVMR_GetParameterStringW(param, s); }
+
+STUB_API long __stdcall VBVMR_SetParameterFloat(char *param, float f) { return stub()->VBVMR_SetParameterFloat(param, f); }
+STUB_API long __stdcall VBVMR_SetParameters(char *script) { return stub()->VBVMR_SetParameters(script); }
+STUB_API long __stdcall VBVMR_SetParametersW(unsigned short *script) { return stub()->VBVMR_SetParametersW(script); }
+STUB_API long __stdcall VBVMR_SetParameterStringA(char *param, char *s) { return stub()->VBVMR_SetParameterStringA(param, s); }
+STUB_API long __stdcall VBVMR_SetParameterStringW(char *param, unsigned short *s) { return stub()->VBVMR_SetParameterStringW(param, s); }
+
+STUB_API long __stdcall VBVMR_Output_GetDeviceNumber(void) { return stub()->VBVMR_Output_GetDeviceNumber(); }
+STUB_API long __stdcall VBVMR_Input_GetDeviceNumber(void) { return stub()->VBVMR_Input_GetDeviceNumber(); }
+
+STUB_API long __stdcall VBVMR_Output_GetDeviceDescA(long i, long *type, char *name, char *hwid)
+{
+    return stub()->VBVMR_Output_GetDeviceDescA(i, type, name, hwid);
+}
+
+STUB_API long __stdcall VBVMR_Input_GetDeviceDescA(long i, long *type, char *name, char *hwid)
+{
+    return stub()->VBVMR_Input_GetDeviceDescA(i, type, name, hwid);
+}
+
+STUB_API long __stdcall VBVMR_Output_GetDeviceDescW(long i, long *type, unsigned short *name, unsigned short *hwid)
+{
+    return stub()->VBVMR_Output_GetDeviceDescW(i, type, name, hwid);
+}
+
+STUB_API long __stdcall VBVMR_Input_GetDeviceDescW(long i, long *type, unsigned short *name, unsigned short *hwid)
+{
+    return stub()->VBVMR_Input_GetDeviceDescW(i, type, name, hwid);
+}
+
+STUB_API long __stdcall VBVMR_MacroButton_IsDirty(void) { return stub()->VBVMR_MacroButton_IsDirty(); }
+STUB_API long __stdcall VBVMR_MacroButton_GetStatus(long n, float *f, long mode) { return stub()->VBVMR_MacroButton_GetStatus(n, f, mode); }
+STUB_API long __stdcall VBVMR_MacroButton_SetStatus(long n, float f, long mode) { return stub()->VBVMR_MacroButton_SetStatus(n, f, mode); }
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `cache.c` for details.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @enum The kind of value held by a cache entry.
+ */
+enum cache_type : int
+{
+    CACHE_NONE,
+    CACHE_FLOAT,
+    CACHE_STRING,
+};
+
+/**
+ * @struct The last known value of a single parameter
+ */
+struct cache_entry
+{
+    char *name; /* Lower cased parameter name, NULL if the slot is free */
+    enum cache_type type;
+    float f;
+    char *s;
+    unsigned generation; /* The cache generation the value was last confirmed in */
+};
+
+/**
+ * @struct Counters describing how the cache has been used
+ */
+struct cache_stats
+{
+    long long writes;
+    long long suppressed;
+    long long refreshes;
+};
+
+/**
+ * @struct A write-through cache of parameter values
+ */
+struct cache
+{
+    struct cache_entry *entries;
+    size_t cap;
+    size_t count;
+    unsigned generation; /* Bumped whenever the engine may have changed state behind our back */
+    uint64_t applied_hash; /* Hash of the profile or scene last applied in full, 0 if unknown or written over since */
+    unsigned applied_generation; /* The generation applied_hash was recorded in */
+    struct cache_stats stats;
+};
+
+void cache_init(struct cache *c);
+void cache_free(struct cache *c);
+struct cache_entry *cache_lookup(struct cache *c, const char *name);
+void cache_store_float(struct cache *c, const char *name, float f);
+void cache_store_string(struct cache *c, const char *name, const char *s);
+void cache_invalidate(struct cache *c, const char *name);
+void cache_new_generation(struct cache *c);
+bool cache_entry_is_current(const struct cache *c, const struct cache_entry *e);
+void cache_set_applied(struct cache *c, uint64_t hash);
+bool cache_is_applied(const struct cache *c, uint64_t hash);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `channels.c` for details.
+ */
+
+#ifndef __CHANNELS_H__
+#define __CHANNELS_H__
+
+#include <stdint.h>
+
+#define CHANNELS_MAX_STRIPS 8
+#define CHANNELS_MAX_BUSES 8
+#define CHANNELS_PER_BUS 8 /* Every bus and virtual strip carries 8 channels, physical strips 2 */
+
+/* The type argument of VBVMR_GetLevel */
+#define LEVEL_PRE_FADER 0
+#define LEVEL_POST_FADER 1
+#define LEVEL_POST_MUTE 2
+#define LEVEL_OUTPUT 3
+
+/**
+ * @struct The level channels of one strip or bus
+ */
+struct channel_span
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+/**
+ * @struct The level channel assignment of a kind of Voicemeeter.
+ * Input levels (pre fader, post fader and post mute) share the strip layout,
+ * output levels the bus layout.
+ */
+struct channel_map
+{
+    int num_strips;
+    int num_physical_strips;
+    int num_buses;
+    int num_physical_buses; /* Named A1, A2..., the virtual buses after them B1, B2... */
+    uint32_t strip_channels;
+    uint32_t bus_channels;
+    struct channel_span strips[CHANNELS_MAX_STRIPS];
+    struct channel_span buses[CHANNELS_MAX_BUSES];
+};
+
+const struct channel_map *channel_map(int kind);
+int channel_bus_index(const struct channel_map *map, const char *name);
+
+#endif /* __CHANNELS_H__ */
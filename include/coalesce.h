@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `coalesce.c` for details.
+ */
+
+#ifndef __COALESCE_H__
+#define __COALESCE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "voicemeeterRemote.h"
+#include "scheduler.h"
+#include "cache.h"
+
+/**
+ * @struct The latest value set on a parameter during the current frame
+ */
+struct pending_write
+{
+    char *name;
+    char *value;
+    bool numeric;
+    float f;
+};
+
+/**
+ * @struct How much the writes were coalesced
+ */
+struct coalesce_stats
+{
+    long long in;      /* Sets accepted */
+    long long out;     /* Parameters written */
+    long long flushes; /* Scripts written */
+    long long first_us;
+    long long last_us;
+};
+
+/**
+ * @struct Sets held for one frame, keeping only the last value of each parameter
+ */
+struct coalescer
+{
+    struct pending_write *items;
+    size_t count;
+    size_t cap;
+    PT_VMR vmr;
+    struct sched *sched;
+    struct cache *cache;
+    long long frame_us; /* 0 writes every set straight away */
+    uint32_t timer;     /* 0 while nothing is pending */
+    char *script;
+    struct coalesce_stats stats;
+};
+
+void coalesce_init(struct coalescer *c, PT_VMR vmr, struct sched *sched, struct cache *cache, long long frame_us);
+bool coalesce_is_pending(const struct coalescer *c, const char *name);
+bool coalesce_set(struct coalescer *c, const char *name, const char *value, bool numeric, float f);
+void coalesce_flush(struct coalescer *c);
+void coalesce_free(struct coalescer *c);
+
+#endif /* __COALESCE_H__ */
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `command.c` for details.
+ */
+
+#ifndef __COMMAND_H__
+#define __COMMAND_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_EXPANSION 8 /* The most strips or buses of any kind */
+
+/**
+ * @enum The kinds of operation a single command may perform.
+ */
+enum op_kind : int
+{
+    OP_GET,
+    OP_SET,
+    OP_INC,
+    OP_DEC,
+    OP_TOGGLE,
+    OP_QUICK,
+    OP_RAMP,
+};
+
+/**
+ * @enum The shapes a ramp may follow from its start value to its target.
+ */
+enum ramp_curve : int
+{
+    CURVE_LIN,
+    CURVE_EXP, /* Slow start, fast finish */
+    CURVE_LOG, /* Fast start, slow finish */
+};
+
+/**
+ * @struct A command classified by op kind.
+ * All strings point into the token (or a compiled image) the command was parsed from.
+ */
+struct command
+{
+    enum op_kind op;
+    char *param;  /* The parameter name, or the full command for OP_QUICK */
+    char *value;  /* The raw value for OP_SET, OP_INC and OP_DEC, the ramp spec for OP_RAMP, NULL otherwise */
+    char *script; /* A pre-formatted script, NULL if it should be formatted on demand */
+    bool numeric; /* The value parsed as a float, for OP_RAMP the spec is valid */
+    float f;      /* The value, or the target of a ramp */
+};
+
+typedef void (*token_fn)(char *token, void *udata);
+
+void command_tokenize(char *input, const char *delimiters, token_fn fn, void *udata);
+bool command_parse(char *token, struct command *cmd);
+bool command_format_script(const struct command *cmd, char *output, size_t max_len);
+bool command_parse_ramp(const char *spec, float *target, long long *duration_us, enum ramp_curve *curve);
+bool command_has_selector(const char *token);
+int command_expand(const char *token, int num_strips, int num_buses, char *buf, char *tokens[MAX_EXPANSION]);
+
+#endif /* __COMMAND_H__ */
@@ -0,0 +1,33 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `compile.c` for details.
+ */
+
+#ifndef __COMPILE_H__
+#define __COMPILE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "command.h"
+
+/**
+ * @struct A compiled script image, mapped into memory by image_open()
+ */
+struct image
+{
+    void *file;
+    void *mapping;
+    unsigned char *base;
+    const struct vmrc_op *ops;
+    char *strings;
+    uint32_t num_ops;
+};
+
+bool compile_script(const char *script_path, const char *image_path, const char *delimiters, int kind);
+bool image_open(const char *image_path, struct image *img);
+bool image_command(const struct image *img, uint32_t i, struct command *cmd);
+void image_close(struct image *img);
+
+#endif /* __COMPILE_H__ */
@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `devices.c` for details.
+ */
+
+#ifndef __DEVICES_H__
+#define __DEVICES_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "voicemeeterRemote.h"
+#include "wrapper.h"
+
+#define DEVICE_NAME_SZ DEVICE_DESC_UTF8_SZ /* Names and hardware ids as UTF-8, see get_device_desc() */
+
+/**
+ * @struct An audio device as enumerated by the API
+ */
+struct device
+{
+    bool output;
+    long type; /* VBVMR_DEVTYPE_MME, _WDM, _KS or _ASIO */
+    char name[DEVICE_NAME_SZ];
+    char hwid[DEVICE_NAME_SZ];
+};
+
+/**
+ * @struct The devices last enumerated, inputs first then outputs.
+ * The store is only enumerated again when the number of devices changes.
+ */
+struct devices
+{
+    struct device *items;
+    size_t count;
+    size_t cap;
+    long num_inputs;
+    long num_outputs;
+    bool valid; /* The store has been enumerated at least once */
+    long long enumerations;
+};
+
+void devices_init(struct devices *d);
+bool devices_refresh(struct devices *d, PT_VMR vmr, bool force);
+const struct device *devices_match(struct devices *d, PT_VMR vmr, bool output, long type, const char *pattern);
+bool devices_glob(const char *pattern, const char *s);
+long device_type_from_string(const char *s);
+const char *device_type_string(long type);
+void devices_free(struct devices *d);
+
+#endif /* __DEVICES_H__ */
@@ -11,7 +11,8 @@
 #include "VoicemeeterRemote.h"
 
 #define IS_64_BIT sizeof(void *) == 8
+#define SYMBOL_MISSING -200 /* Returned by an optional entry point the library does not export */
 
-PT_VMR create_interface();
+PT_VMR create_interface(const char *dll_path);
 
 #endif /* __IVMR_H__ */
\ No newline at end of file
@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `jobs.c` for details.
+ */
+
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scheduler.h"
+
+/**
+ * @brief Called on the scheduler thread, with the scheduler lock held, to run a job's line.
+ * The line is a copy the callee may modify.
+ */
+typedef void (*job_fn)(void *udata, char *line);
+
+/**
+ * @struct An input line scheduled to run later, once or repeatedly
+ */
+struct job
+{
+    uint32_t id; /* The id of the job's timer */
+    char *line;
+    bool repeat;
+    size_t index; /* Position in the store, so a job is removed without searching */
+    struct jobs *owner;
+};
+
+/**
+ * @struct The jobs pending, guarded by the scheduler lock
+ */
+struct jobs
+{
+    struct job **items;
+    size_t count;
+    size_t cap;
+    size_t num_once; /* Jobs that run once and have not run yet */
+    struct sched *sched;
+    job_fn run;
+    void *udata;
+};
+
+void jobs_init(struct jobs *j, struct sched *sched, job_fn run, void *udata);
+uint32_t jobs_add(struct jobs *j, long long delay_us, bool repeat, const char *line);
+bool jobs_cancel(struct jobs *j, uint32_t id);
+size_t jobs_cancel_all(struct jobs *j);
+void jobs_wait(struct jobs *j);
+void jobs_free(struct jobs *j);
+
+#endif /* __JOBS_H__ */
@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `lang.c` for details.
+ */
+
+#ifndef __LANG_H__
+#define __LANG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @struct What a program needs from the program running it
+ */
+struct lang_host
+{
+    void *udata;
+    /* Read a parameter, sync is true when the program has written since its last read */
+    bool (*read)(void *udata, const char *name, bool sync, float *f);
+    /* Run an input line, the line may be modified */
+    void (*exec)(void *udata, char *line);
+    /* Output the text of a print statement */
+    void (*print)(void *udata, const char *text);
+    int num_strips;
+    int num_buses;
+};
+
+/**
+ * @enum What became of a line fed to the language
+ */
+enum lang_status : int
+{
+    LANG_NOT_MINE, /* A plain line, the caller should run it as before */
+    LANG_PENDING,  /* The line was added to an unfinished if or for block */
+    LANG_DONE,     /* The line completed a statement, which has run */
+};
+
+/**
+ * @struct A variable, shared by every statement of a session
+ */
+struct lang_var
+{
+    char *name;
+    double value;
+};
+
+/**
+ * @struct A line of a block waiting for its end
+ */
+struct lang_line
+{
+    char *text;
+    int line_no;
+};
+
+/**
+ * @struct The state of the language across the lines of one input
+ */
+struct lang
+{
+    struct lang_host host;
+    struct lang_var *vars;
+    size_t num_vars;
+    size_t vars_cap;
+    struct lang_line *block;
+    size_t block_len;
+    size_t block_cap;
+    int depth; /* if and for blocks opened but not yet ended */
+    int line_no;
+};
+
+void lang_init(struct lang *l, const struct lang_host *host);
+enum lang_status lang_feed(struct lang *l, const char *line);
+bool lang_pending(const struct lang *l);
+bool lang_is_statement(const char *line);
+void lang_finish(struct lang *l);
+void lang_free(struct lang *l);
+
+#endif /* __LANG_H__ */
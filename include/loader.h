@@ -0,0 +1,20 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `loader.c` for details.
+ */
+
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include <stddef.h>
+
+/* The type symbols are returned as, cast to the real type before calling */
+typedef void (*loader_fn)(void);
+
+void *loader_open(const char *path);
+loader_fn loader_symbol(void *module, const char *name);
+void loader_error(char *buf, size_t n);
+
+#endif /* __LOADER_H__ */
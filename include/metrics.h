@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `metrics.c` for details.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "state.h"
+
+/**
+ * @struct A complete HTTP response, status line, headers and exposition
+ */
+struct metrics_page
+{
+    char *text;
+    size_t start; /* The response begins here, the headers are written in front of the exposition */
+    size_t len;   /* Bytes of the response from start */
+    size_t cap;
+    int readers; /* Scrapes sending this page */
+};
+
+/**
+ * @struct Serves the engine's state as a Prometheus text exposition.
+ * Pages are rendered from each snapshot on the scheduler thread and served
+ * as they are by a listener thread, so a scrape never calls the engine.
+ */
+struct metrics
+{
+    CRITICAL_SECTION lock; /* Guards front, readers and scrapes */
+    struct metrics_page pages[2];
+    int front;          /* The page served, -1 until the first is rendered */
+    uintptr_t listener; /* The listening socket */
+    HANDLE thread;      /* NULL while not serving */
+    volatile LONG stopping;
+    long long scrapes;  /* Pages served */
+    long long renders;  /* Pages rendered */
+    long long skipped;  /* Snapshots not rendered, the back page was still being sent */
+};
+
+void metrics_init(struct metrics *m);
+bool metrics_start(struct metrics *m, const char *address);
+void metrics_render(struct metrics *m, const struct vmrcli_state *s);
+void metrics_stop(struct metrics *m);
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,21 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `net.c` for details.
+ */
+
+#ifndef __NET_H__
+#define __NET_H__
+
+/* Winsock must come before windows.h, include this header first */
+#include <winsock2.h>
+#include <windows.h>
+#include <stdbool.h>
+
+bool net_start(void);
+void net_stop(void);
+SOCKET net_bind(const char *address, int type);
+void net_set_timeout(SOCKET s, int timeout_ms);
+
+#endif /* __NET_H__ */
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `osc.c` for details.
+ */
+
+#ifndef __OSC_H__
+#define __OSC_H__
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "vmrcli.h"
+
+#define OSC_PACKET_SZ 8192    /* Largest datagram handled, control surfaces send far smaller */
+#define OSC_TEXT_SZ 16384     /* Commands of one packet, an address grows by a few bytes as a parameter name */
+#define OSC_MAX_COMMANDS 256  /* Sets in one packet */
+#define OSC_MAX_QUERIES 16    /* Queries in one packet */
+
+/**
+ * @struct What the server has handled
+ */
+struct osc_stats
+{
+    long long packets;
+    long long bundles;
+    long long messages;
+    long long queries;
+    long long replies;
+    long long errors; /* Malformed packets and messages */
+};
+
+/**
+ * @struct An OSC server on a UDP socket, driving a session through its public API.
+ * A packet is decoded in place into the buffers below, nothing is allocated per packet.
+ */
+struct osc_server
+{
+    struct vmrcli_session *session;
+    uintptr_t sock; /* The bound socket */
+    HANDLE thread;  /* NULL while not serving */
+    volatile LONG stopping;
+    char packet[OSC_PACKET_SZ];
+    char text[OSC_TEXT_SZ]; /* Commands and query names of the packet, each NUL terminated */
+    size_t text_len;
+    const char *commands[OSC_MAX_COMMANDS];
+    size_t num_commands;
+    struct vmrcli_get gets[OSC_MAX_QUERIES];
+    const char *reply_to[OSC_MAX_QUERIES]; /* The address each query came in on, inside packet */
+    size_t num_queries;
+    struct vmrcli_request request;
+    char reply[OSC_PACKET_SZ];
+    struct osc_stats stats;
+};
+
+void osc_init(struct osc_server *o);
+bool osc_start(struct osc_server *o, struct vmrcli_session *session, const char *address);
+void osc_stop(struct osc_server *o);
+
+#endif /* __OSC_H__ */
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `paramset.c` for details.
+ */
+
+#ifndef __PARAMSET_H__
+#define __PARAMSET_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @struct The value of a single parameter
+ */
+struct param
+{
+    char *name;
+    char *value; /* The value as it would be written in a script */
+    bool is_string;
+    float f;
+    uint64_t hash; /* Hash of the name and value */
+};
+
+/**
+ * @struct A set of parameter values, sorted by name once finished
+ */
+struct paramset
+{
+    struct param *params;
+    size_t count;
+    size_t cap;
+    uint64_t hash; /* Hash of every parameter, valid once finished */
+};
+
+extern const char *const strip_param_names[];
+extern const size_t num_strip_param_names;
+extern const char *const bus_param_names[];
+extern const size_t num_bus_param_names;
+
+void paramset_init(struct paramset *ps);
+void paramset_free(struct paramset *ps);
+bool paramset_add(struct paramset *ps, const char *name, const char *value);
+void paramset_finish(struct paramset *ps);
+const struct param *paramset_find(const struct paramset *ps, const char *name);
+bool param_is_continuous(const char *name);
+bool param_is_string(const char *name);
+
+#endif /* __PARAMSET_H__ */
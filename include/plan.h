@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `plan.c` for details.
+ */
+
+#ifndef __PLAN_H__
+#define __PLAN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "command.h"
+
+/**
+ * @struct The commands parsed from a single input line, in input order.
+ * Commands point into the input line or into buffers owned by the batch.
+ */
+struct batch
+{
+    struct command *cmds;
+    size_t count;
+    size_t cap;
+    char **owned; /* Buffers freed when the batch is cleared */
+    size_t num_owned;
+    size_t owned_cap;
+};
+
+void batch_init(struct batch *b);
+bool batch_push(struct batch *b, const struct command *cmd);
+bool batch_own(struct batch *b, char *buf);
+void batch_clear(struct batch *b);
+void batch_free(struct batch *b);
+size_t plan_phase_length(const struct command *cmds, size_t n);
+size_t plan_optimise(struct batch *b);
+
+#endif /* __PLAN_H__ */
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `profile.c` for details.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "paramset.h"
+
+/**
+ * @struct A profile parsed from a Voicemeeter XML settings file
+ */
+struct profile
+{
+    char *path;
+    struct paramset params;
+};
+
+/**
+ * @struct Profiles parsed so far, kept so switching between them costs no parsing
+ */
+struct profiles
+{
+    struct profile *items;
+    size_t count;
+    size_t cap;
+};
+
+bool profile_parse(const char *path, struct paramset *ps);
+void profiles_init(struct profiles *store);
+const struct paramset *profiles_get(struct profiles *store, const char *path, bool reload);
+void profiles_free(struct profiles *store);
+
+#endif /* __PROFILE_H__ */
@@ -0,0 +1,49 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `publish.c` for details.
+ */
+
+#ifndef __PUBLISH_H__
+#define __PUBLISH_H__
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "voicemeeterRemote.h"
+#include "scheduler.h"
+#include "cache.h"
+#include "state.h"
+
+/**
+ * @brief Receives each snapshot as it is gathered, on the scheduler thread with its lock held
+ */
+typedef void (*snapshot_fn)(void *udata, const struct vmrcli_state *s);
+
+/**
+ * @struct Keeps a snapshot of the engine's state in shared memory
+ */
+struct publisher
+{
+    HANDLE mapping;
+    struct vmrcli_state *shared; /* NULL if the snapshots are only handed to on_snapshot */
+    struct vmrcli_state next; /* The snapshot being gathered */
+    PT_VMR vmr;
+    struct sched *sched;
+    struct cache *cache;
+    uint32_t timer;        /* 0 while not publishing */
+    unsigned generation;   /* The cache generation the parameters were last read in */
+    bool have_parameters;  /* The parameters have been read at least once */
+    bool levels;           /* False once the library is found not to export levels */
+    snapshot_fn on_snapshot;
+    void *udata;
+};
+
+void publisher_init(struct publisher *p, PT_VMR vmr, struct sched *sched, struct cache *cache, int kind);
+bool publisher_share(struct publisher *p, const char *name);
+void publisher_watch(struct publisher *p, snapshot_fn fn, void *udata);
+bool publisher_start(struct publisher *p);
+void publisher_stop(struct publisher *p);
+
+#endif /* __PUBLISH_H__ */
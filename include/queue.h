@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `queue.c` for details.
+ */
+
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUEUE_MAX_LINES 65536 /* Lines held before the reader waits */
+
+/**
+ * @enum The order queued lines run in, most urgent first
+ */
+enum priority : int
+{
+    PRIORITY_URGENT, /* Mutes, lock and unlock */
+    PRIORITY_NORMAL,
+    PRIORITY_BULK, /* Lines made only of label, device and EQ writes */
+    PRIORITIES,
+};
+
+/**
+ * @struct A line waiting to run, allocated together with its text and keys
+ */
+struct queued_line
+{
+    struct queued_line *prev;
+    struct queued_line *next;
+    uint64_t seq;          /* Arrival order */
+    long long queued_us;   /* The time it arrived, see now_us() */
+    enum priority priority; /* The level it is held in */
+    bool barrier;          /* Ordered against every other line, a directive or a line of the language */
+    size_t num_keys;
+    char *keys; /* The lower cased parameters the line touches, each NUL terminated */
+    char *line;
+};
+
+/**
+ * @struct The lines of one priority, in arrival order
+ */
+struct queue_level
+{
+    struct queued_line *head;
+    struct queued_line *tail;
+    size_t count;
+    size_t barriers;
+};
+
+/**
+ * @struct How many lines of one priority a parameter has pending
+ */
+struct queue_key
+{
+    char *name; /* NULL for an empty slot */
+    uint32_t pending[PRIORITIES];
+    uint32_t mark; /* Set while promoting, see promote() */
+};
+
+/**
+ * @struct What the queue has held
+ */
+struct queue_stats
+{
+    long long queued;
+    long long run[PRIORITIES];
+    long long total_wait_us[PRIORITIES]; /* Summed over the lines run at each priority */
+    long long max_wait_us[PRIORITIES];
+    long long promoted; /* Lines moved up so writes to a parameter stay in order */
+    size_t max_depth;
+};
+
+/**
+ * @struct Input lines waiting to run, most urgent first.
+ * Lines of a priority run in arrival order, and a line never overtakes an earlier
+ * one touching the same parameter, the earlier line is moved up with it instead.
+ */
+struct line_queue
+{
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE ready; /* Signalled when a line is pushed or the queue is closed */
+    CONDITION_VARIABLE space; /* Signalled when a line is popped */
+    struct queue_level levels[PRIORITIES];
+    size_t depth;
+    uint64_t next_seq;
+    bool closed;
+    struct queue_key *keys;
+    size_t num_keys;
+    size_t keys_cap;
+    uint32_t mark;
+    const char *delimiters;
+    int num_strips;
+    int num_buses;
+    struct queue_stats stats;
+};
+
+void queue_init(struct line_queue *q, const char *delimiters, int num_strips, int num_buses);
+bool queue_push(struct line_queue *q, const char *line);
+struct queued_line *queue_pop(struct line_queue *q);
+void queue_done(struct queued_line *l);
+size_t queue_depth(struct line_queue *q);
+void queue_close(struct line_queue *q);
+void queue_free(struct line_queue *q);
+
+#endif /* __QUEUE_H__ */
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `ramp.c` for details.
+ */
+
+#ifndef __RAMP_H__
+#define __RAMP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "voicemeeterRemote.h"
+#include "command.h"
+#include "scheduler.h"
+#include "cache.h"
+
+/**
+ * @struct A parameter moving towards a target
+ */
+struct ramp
+{
+    char *name;
+    float from;
+    float to;
+    float current; /* The value last written */
+    long long start_us;
+    long long duration_us;
+    enum ramp_curve curve;
+};
+
+/**
+ * @struct How the ramps kept to their schedule
+ */
+struct ramp_stats
+{
+    long long started;
+    long long ticks;
+    long long max_late_us;
+};
+
+/**
+ * @struct The ramps in progress, advanced together by one scheduler timer
+ */
+struct ramps
+{
+    struct ramp *items;
+    size_t count;
+    size_t cap;
+    PT_VMR vmr;
+    struct sched *sched;
+    struct cache *cache;
+    uint32_t timer; /* 0 while no ramp is in progress */
+    char *script;
+    struct ramp_stats stats;
+};
+
+void ramps_init(struct ramps *r, PT_VMR vmr, struct sched *sched, struct cache *cache);
+bool ramp_current(const struct ramps *r, const char *name, float *f);
+bool ramp_start(struct ramps *r, const char *name, float from, float to, long long duration_us, enum ramp_curve curve);
+bool ramp_cancel(struct ramps *r, const char *name);
+void ramps_wait(struct ramps *r);
+void ramps_free(struct ramps *r);
+
+#endif /* __RAMP_H__ */
@@ -0,0 +1,38 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `reader.c` for details.
+ */
+
+#ifndef __READER_H__
+#define __READER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @struct A source of input lines.
+ * Regular files are memory mapped, pipes and consoles are streamed in large chunks.
+ */
+struct reader
+{
+    void *file;
+    void *mapping;
+    bool mapped;
+    bool owns_file;
+    bool eof;
+    char *buf;   /* The mapped view, or the stream buffer */
+    size_t size; /* Bytes of valid data in buf */
+    size_t cap;  /* Capacity of the stream buffer */
+    size_t pos;  /* Start of the next line */
+    size_t scan; /* Bytes after pos already searched for a newline */
+    char *tail;  /* Copy of a final line with no newline in a mapped file */
+};
+
+bool reader_open(struct reader *r, const char *path);
+bool reader_open_stdin(struct reader *r);
+char *reader_next_line(struct reader *r, size_t *len);
+void reader_close(struct reader *r);
+
+#endif /* __READER_H__ */
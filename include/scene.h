@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `scene.c` for details.
+ */
+
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "voicemeeterRemote.h"
+#include "paramset.h"
+#include "scheduler.h"
+#include "cache.h"
+
+#define SCENE_EXT ".vmrs"
+
+/**
+ * @struct A named snapshot of strip and bus parameters
+ */
+struct scene
+{
+    char *name;
+    struct paramset params;
+};
+
+/**
+ * @struct How a morph kept to its schedule
+ */
+struct morph_stats
+{
+    long long ticks;
+    long long late; /* Times the morph fell a whole tick behind */
+    long long max_late_us;
+};
+
+/**
+ * @struct A continuous parameter being faded
+ */
+struct fade
+{
+    char *name;
+    float from;
+    float to;
+};
+
+/**
+ * @struct A parameter that flips at the switch point
+ */
+struct morph_switch
+{
+    char *name;
+    char *value;
+    bool is_string;
+    float f;
+};
+
+/**
+ * @struct A fade between two scenes, advanced by a scheduler timer
+ */
+struct morph
+{
+    PT_VMR vmr;
+    struct sched *sched;
+    struct cache *cache;
+    uint32_t timer; /* 0 while no morph is in progress */
+    struct fade *fades;
+    size_t num_fades;
+    struct morph_switch *switches;
+    size_t num_switches;
+    bool switched;
+    float switch_at;
+    long long start_us;
+    long long duration_us;
+    uint64_t to_hash;
+    char *from_name;
+    char *to_name;
+    char *script;
+    struct morph_stats stats;
+};
+
+/**
+ * @struct Scenes held in memory, so applying one costs no file access
+ */
+struct scenes
+{
+    struct scene *items;
+    size_t count;
+    size_t cap;
+};
+
+bool scene_capture(PT_VMR vmr, int num_strips, int num_buses, struct paramset *ps);
+bool scene_write(const char *path, const struct paramset *ps);
+bool scene_read(const char *path, struct paramset *ps);
+void scenes_init(struct scenes *store);
+const struct paramset *scenes_get(struct scenes *store, const char *name, bool reload);
+const struct paramset *scenes_put(struct scenes *store, const char *name, struct paramset *ps);
+void scenes_free(struct scenes *store);
+void morph_init(struct morph *m, PT_VMR vmr, struct sched *sched, struct cache *cache);
+bool morph_start(struct morph *m, const char *from_name, const struct paramset *from, const char *to_name,
+                 const struct paramset *to, long long duration_us, float switch_at);
+void morph_release(struct morph *m, const char *name);
+void morph_wait(struct morph *m);
+void morph_free(struct morph *m);
+
+#endif /* __SCENE_H__ */
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `scheduler.c` for details.
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_TICK_US 1000 /* Resolution of the timer wheel */
+#define WHEEL_SPAN_US ((long long)WHEEL_TICK_US << (WHEEL_BITS * WHEEL_LEVELS)) /* About 4h 40m */
+
+/**
+ * @brief Called on the scheduler thread, with the scheduler lock held, when a timer expires.
+ * deadline_us is the time (see now_us()) the timer was due, not the time it ran.
+ */
+typedef void (*timer_fn)(void *udata, long long deadline_us);
+
+/**
+ * @struct A pending timer
+ */
+struct timer
+{
+    uint32_t id;
+    long long expires; /* The wheel tick the timer is due at, the time it was posted for sched_post() */
+    long long period;  /* Ticks between repeats, 0 for a one shot timer */
+    timer_fn fn;
+    void *udata;
+    struct timer *next;
+};
+
+/**
+ * @struct A scheduler thread driving a hierarchical timer wheel.
+ * The lock also serialises the thread's callbacks with the caller's own use of the engine.
+ */
+struct sched
+{
+    CRITICAL_SECTION lock;
+    HANDLE thread;
+    HANDLE wake;  /* Signalled when a timer is added or the thread must stop */
+    HANDLE timer; /* Waitable timer for the next expiry */
+    bool stopping;
+    long long start_us; /* The time of wheel tick 0 */
+    long long tick;     /* The last wheel tick processed */
+    struct timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    size_t count;
+    uint32_t next_id;
+    struct timer *posted; /* Run at the next wakeup, in the order posted */
+    struct timer *posted_tail;
+};
+
+void sched_init(struct sched *s);
+void sched_lock(struct sched *s);
+void sched_unlock(struct sched *s);
+uint32_t sched_add(struct sched *s, long long delay_us, long long period_us, timer_fn fn, void *udata);
+bool sched_cancel(struct sched *s, uint32_t id);
+bool sched_post(struct sched *s, struct timer *t, timer_fn fn, void *udata);
+void sched_stop(struct sched *s);
+
+#endif /* __SCHEDULER_H__ */
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `session.c` for details.
+ */
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include "vmrcli.h"
+#include "voicemeeterRemote.h"
+#include "cache.h"
+#include "plan.h"
+#include "profile.h"
+#include "scene.h"
+#include "devices.h"
+#include "scheduler.h"
+#include "ramp.h"
+#include "coalesce.h"
+#include "publish.h"
+#include "metrics.h"
+#include "osc.h"
+#include "jobs.h"
+#include "lang.h"
+
+/**
+ * @struct Everything a connection to the engine keeps between lines.
+ * The scheduler lock guards all of it.
+ */
+struct vmrcli_session
+{
+    struct vmrcli_options options;
+    const char *delimiters; /* Characters input lines are split on */
+    PT_VMR vmr;
+    enum kind kind; /* The kind of Voicemeeter actually running */
+    struct cache cache;
+    struct batch batch; /* The commands of the line being executed */
+    struct profiles profiles;
+    struct scenes scenes;
+    struct devices devices; /* Audio devices, enumerated on first use */
+    struct sched sched; /* Runs timers, its lock is held whenever the engine is used */
+    struct ramps ramps;
+    struct morph morph; /* The scene morph in progress */
+    struct coalescer coalescer; /* Sets held until the end of the frame */
+    struct publisher publisher; /* Idle unless the options name a section or a metrics address */
+    struct metrics metrics;     /* Pages rendered from the publisher's snapshots */
+    struct osc_server osc;      /* Idle unless the options name an OSC address */
+    struct jobs jobs; /* Lines scheduled with at and every */
+    struct lang lang; /* Variables and open blocks of the input being read */
+    CONDITION_VARIABLE done; /* Signalled as asynchronous requests complete */
+};
+
+void session_init(struct vmrcli_session *session, PT_VMR vmr, const struct vmrcli_options *opts);
+void session_free(struct vmrcli_session *session);
+void session_feed(struct vmrcli_session *session, char *input);
+void session_print(struct vmrcli_session *session, const char *fmt, ...);
+bool session_is_directive(const char *input);
+
+#endif /* __SESSION_H__ */
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `publish.c` for details.
+ */
+
+#ifndef __STATE_H__
+#define __STATE_H__
+
+#include <stdint.h>
+
+#define VMRCLI_STATE_MAGIC 0x43524D56u /* "VMRC" */
+#define VMRCLI_STATE_VERSION 1
+#define VMRCLI_STATE_STRIPS 8
+#define VMRCLI_STATE_BUSES 8
+#define VMRCLI_STATE_STRIP_CHANNELS 34 /* Input channels of Potato, the most of any kind */
+#define VMRCLI_STATE_BUS_CHANNELS 64
+#define VMRCLI_STATE_LABEL_SZ 64
+
+/**
+ * @struct The engine's state as published in shared memory, the layout is fixed.
+ * Guarded by a seqlock: seq is odd while the publisher is writing. A reader
+ * reads seq, copies the struct, then reads seq again, and keeps the copy only
+ * if both reads returned the same even number. vmrcli_state_read() does this.
+ */
+struct vmrcli_state
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; /* sizeof(struct vmrcli_state) as published */
+    volatile int32_t seq;
+    int32_t kind;
+    uint32_t num_strips;
+    uint32_t num_buses;
+    uint32_t num_strip_channels; /* Entries of strip_level in use */
+    uint32_t num_bus_channels;   /* Entries of bus_level in use */
+    uint32_t strip_mute;         /* Bit i is set while strip[i] is muted */
+    uint32_t bus_mute;
+    uint32_t reserved;
+    uint64_t updates;   /* Snapshots published so far */
+    int64_t updated_us; /* When the last snapshot was published, on the publisher's clock */
+    float strip_gain[VMRCLI_STATE_STRIPS];
+    float bus_gain[VMRCLI_STATE_BUSES];
+    float strip_level[VMRCLI_STATE_STRIP_CHANNELS]; /* Post fader, linear amplitude */
+    float bus_level[VMRCLI_STATE_BUS_CHANNELS];     /* Output, linear amplitude */
+    char strip_label[VMRCLI_STATE_STRIPS][VMRCLI_STATE_LABEL_SZ]; /* UTF-8 */
+    char bus_label[VMRCLI_STATE_BUSES][VMRCLI_STATE_LABEL_SZ];
+};
+
+#endif /* __STATE_H__ */
@@ -0,0 +1,20 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `utf.c` for details.
+ */
+
+#ifndef __UTF_H__
+#define __UTF_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+bool utf8_is_ascii(const char *s, size_t len);
+size_t utf16_to_utf8(const uint16_t *src, size_t cap, char *dst, size_t dst_sz);
+size_t utf8_to_utf16(const char *src, size_t len, uint16_t *dst, size_t dst_cap);
+size_t utf8_copy(const char *src, char *dst, size_t dst_sz);
+
+#endif /* __UTF_H__ */
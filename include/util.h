@@ -17,9 +17,14 @@ struct quickcommand
 void remove_last_part_of_path(char *fullpath);
 int log_level_from_string(const char *level);
 char *kind_as_string(char *s, int kind, int n);
+int kind_num_strips(int kind);
+int kind_num_buses(int kind);
 char *version_as_string(char *s, long v, int n);
 bool is_comment(char *s);
 struct quickcommand *command_in_quickcommands(const char *command, const struct quickcommand *quickcommands, int n);
-bool add_quotes_if_needed(const char *command, char *output, size_t max_len);
+bool parse_float(const char *s, float *f);
+long long now_us(void);
+long long now_ns(void);
+bool parse_duration(const char *s, long long *us);
 
 #endif /* __UTIL_H__ */
\ No newline at end of file
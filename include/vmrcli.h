@@ -0,0 +1,125 @@
+/**
+ * Copyright (c) 2024 Onyx and Iris
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the MIT license. See `session.c` for details.
+ */
+
+#ifndef __VMRCLI_H__
+#define __VMRCLI_H__
+
+#include <windows.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "wrapper.h"
+#include "scheduler.h"
+#include "state.h"
+
+#ifdef VMRCLI_EXPORTS
+#define VMRCLI_API __declspec(dllexport)
+#else
+#define VMRCLI_API
+#endif
+
+#define VMRCLI_STRING_SZ PARAM_STRING_UTF8_SZ /* Size of the UTF-8 buffer of a string get */
+
+/**
+ * @enum The status returned by the library functions
+ */
+enum vmrcli_status : int
+{
+    VMRCLI_OK = 0,
+    VMRCLI_ERR_INTERFACE = -1, /* The Voicemeeter Remote DLL could not be loaded */
+    VMRCLI_ERR_LOGIN = -2,
+    VMRCLI_ERR_TIMEOUT = -3,
+    VMRCLI_ERR_MEMORY = -4,
+    VMRCLI_ERR_PARAM = -5, /* Unknown parameter */
+    VMRCLI_ERR_FILE = -6,
+};
+
+/**
+ * @brief Receives each line of output, without its newline.
+ * Called with the session's lock held, possibly on the scheduler thread.
+ */
+typedef void (*vmrcli_output_fn)(void *udata, const char *text);
+
+/**
+ * @struct How a session behaves, zero initialised fields take their defaults
+ */
+struct vmrcli_options
+{
+    enum kind kind;          /* The kind launched if Voicemeeter is not running */
+    bool extra_output;       /* Print toggle, set and ramp messages */
+    bool full_line;          /* Do not split input on spaces */
+    vmrcli_output_fn output; /* NULL prints to stdout */
+    void *udata;             /* Passed to output */
+    const char *dll_path;    /* The remote API library, NULL reads VMRCLI_DLL and then the registry */
+    long long coalesce_us;   /* Hold sets for this long, writing only the last value of each, 0 writes at once */
+    const char *publish;     /* Name of a shared memory section to publish the engine's state to, NULL for none */
+    const char *metrics_listen; /* Address and port to serve Prometheus metrics on, NULL for none */
+    const char *osc_listen;     /* Address and port to serve OSC on, NULL for none */
+};
+
+/**
+ * @enum The kind of value a get returned
+ */
+enum vmrcli_type : int
+{
+    VMRCLI_FLOAT,
+    VMRCLI_STRING,
+};
+
+/**
+ * @struct One parameter read by vmrcli_get_async, owned by the caller
+ */
+struct vmrcli_get
+{
+    const char *param;
+    enum vmrcli_type type;
+    float f;
+    char s[VMRCLI_STRING_SZ]; /* UTF-8 */
+    int status;               /* VMRCLI_OK or VMRCLI_ERR_PARAM */
+};
+
+struct vmrcli_session;
+struct vmrcli_request;
+
+/**
+ * @brief Called on the scheduler thread, with the session's lock held, once every get of a request is filled.
+ */
+typedef void (*vmrcli_done_fn)(struct vmrcli_request *req, void *udata);
+
+/**
+ * @struct An asynchronous read, owned by the caller and untouched by the library once done
+ */
+struct vmrcli_request
+{
+    struct timer timer; /* Queues the request on the scheduler, no allocation is made */
+    struct vmrcli_session *session;
+    struct vmrcli_get *gets;
+    size_t n;
+    bool done;
+    vmrcli_done_fn callback;
+    void *udata;
+};
+
+VMRCLI_API int vmrcli_open(struct vmrcli_session **session, const struct vmrcli_options *opts);
+VMRCLI_API int vmrcli_close(struct vmrcli_session *session);
+VMRCLI_API void vmrcli_submit(struct vmrcli_session *session, const char *line);
+VMRCLI_API int vmrcli_submit_batch(struct vmrcli_session *session, const char *const *commands, size_t n);
+VMRCLI_API int vmrcli_get_async(struct vmrcli_session *session, struct vmrcli_request *req,
+                                struct vmrcli_get *gets, size_t n, vmrcli_done_fn callback, void *udata);
+VMRCLI_API bool vmrcli_poll(struct vmrcli_request *req);
+VMRCLI_API int vmrcli_wait(struct vmrcli_request *req, long timeout_ms);
+VMRCLI_API bool vmrcli_pending(struct vmrcli_session *session);
+VMRCLI_API void vmrcli_end_input(struct vmrcli_session *session);
+VMRCLI_API void vmrcli_flush(struct vmrcli_session *session);
+VMRCLI_API int vmrcli_load_profile(struct vmrcli_session *session, const char *path, bool full_load);
+VMRCLI_API int vmrcli_run_image(struct vmrcli_session *session, const char *path);
+
+/* Reading a state published by another process, see state.h */
+VMRCLI_API const struct vmrcli_state *vmrcli_state_open(const char *name);
+VMRCLI_API int vmrcli_state_read(const struct vmrcli_state *state, struct vmrcli_state *snapshot);
+VMRCLI_API void vmrcli_state_close(const struct vmrcli_state *state);
+
+#endif /* __VMRCLI_H__ */
@@ -9,8 +9,14 @@
 #define __WRAPPER_H__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "voicemeeterRemote.h"
 
+#define PARAM_STRING_SZ 512                        /* UTF-16 units of a string parameter, as the API writes them */
+#define PARAM_STRING_UTF8_SZ (PARAM_STRING_SZ * 3) /* Bytes that hold any string parameter as UTF-8 */
+#define DEVICE_DESC_SZ 256                         /* UTF-16 units of a device name or hardware id, as the API writes them */
+#define DEVICE_DESC_UTF8_SZ (DEVICE_DESC_SZ * 3)   /* Bytes that hold any device name or hardware id as UTF-8 */
+
 enum kind : int
 {
     UNKNOWN = -1,
@@ -24,6 +30,33 @@ enum kind : int
     STREAMERVIEW
 };
 
+/**
+ * @enum The engine calls whose latency is counted
+ */
+enum api_call : int
+{
+    API_GET,    /* GetParameterFloat and GetParameterStringW */
+    API_SET,    /* SetParameterFloat and SetParameterString */
+    API_SCRIPT, /* SetParameters and SetParametersW */
+    API_DIRTY,  /* IsParametersDirty */
+    API_LEVEL,  /* GetLevel */
+    API_CALLS
+};
+
+/**
+ * @struct Call counts and latencies of the engine calls made by this process.
+ * Updated by the wrappers, with the scheduler lock held like every other use of the engine.
+ */
+struct api_stats
+{
+    long long calls[API_CALLS];
+    long long total_ns[API_CALLS];
+    long long max_ns[API_CALLS];
+};
+
+extern struct api_stats api_stats;
+extern const char *api_call_names[API_CALLS];
+
 long login(PT_VMR vmr, int kind);
 long logout(PT_VMR vmr);
 long run_voicemeeter(PT_VMR vmr, int kind);
@@ -32,15 +65,22 @@ long version(PT_VMR vmr, long *version);
 
 bool is_pdirty(PT_VMR vmr);
 long get_parameter_float(PT_VMR vmr, char *param, float *f);
-long get_parameter_string(PT_VMR vmr, char *param, wchar_t *s);
+long get_parameter_string(PT_VMR vmr, char *param, char *s, size_t n);
 long set_parameter_float(PT_VMR vmr, char *param, float val);
 long set_parameter_string(PT_VMR vmr, char *param, char *s);
 long set_parameters(PT_VMR vmr, char *command);
 
+long get_level(PT_VMR vmr, long type, long channel, float *f);
+
+long get_device_count(PT_VMR vmr, bool output);
+long get_device_desc(PT_VMR vmr, bool output, long index, long *type, char *name, char *hwid);
+
 bool is_mdirty(PT_VMR vmr);
 long macrobutton_getstatus(PT_VMR vmr, long n, float *val, long mode);
 long macrobutton_setstatus(PT_VMR vmr, long n, float val, long mode);
 
+long load_profile(PT_VMR vmr, char *path, long long *elapsed_us);
+
 void clear(PT_VMR vmr, bool (*f)(PT_VMR));
 
 #endif /* __WRAPPER_H__ */
\ No newline at end of file
@@ -0,0 +1,249 @@
+/**
+ * @file cache.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief A write-through cache of the last known value of each parameter.
+ * Parameter names are case insensitive so they are stored lower cased.
+ * Each value is stamped with the generation it was confirmed in, a new
+ * generation begins whenever the engine reports dirty parameters.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cache.h"
+#include "log.h"
+
+#define INITIAL_CAP 256 /* Must be a power of two */
+
+static size_t hash_name(const char *name)
+{
+    size_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char)tolower((unsigned char)*name++)) * 16777619u;
+    return h;
+}
+
+static bool names_equal(const char *stored, const char *name)
+{
+    while (*stored && *stored == tolower((unsigned char)*name))
+    {
+        stored++;
+        name++;
+    }
+    return *stored == '\0' && *name == '\0';
+}
+
+/**
+ * @brief Find the slot for a name, the slot is free if the name is not cached.
+ */
+static struct cache_entry *find_slot(struct cache_entry *entries, size_t cap, const char *name)
+{
+    size_t i = hash_name(name) & (cap - 1);
+    while (entries[i].name != NULL && !names_equal(entries[i].name, name))
+        i = (i + 1) & (cap - 1);
+    return &entries[i];
+}
+
+static bool grow(struct cache *c)
+{
+    size_t cap = c->cap ? c->cap * 2 : INITIAL_CAP;
+    struct cache_entry *entries = calloc(cap, sizeof(struct cache_entry));
+    if (entries == NULL)
+        return false;
+
+    for (size_t i = 0; i < c->cap; i++)
+    {
+        if (c->entries[i].name != NULL)
+            *find_slot(entries, cap, c->entries[i].name) = c->entries[i];
+    }
+
+    free(c->entries);
+    c->entries = entries;
+    c->cap = cap;
+    return true;
+}
+
+/**
+ * @brief Find or create the entry for a name.
+ * May return NULL if memory could not be allocated, the value then simply goes uncached.
+ */
+static struct cache_entry *upsert(struct cache *c, const char *name)
+{
+    if ((c->count + 1) * 2 > c->cap && !grow(c))
+        return NULL;
+
+    struct cache_entry *e = find_slot(c->entries, c->cap, name);
+    if (e->name == NULL)
+    {
+        size_t len = strlen(name);
+        if ((e->name = malloc(len + 1)) == NULL)
+            return NULL;
+        for (size_t i = 0; i <= len; i++)
+            e->name[i] = (char)tolower((unsigned char)name[i]);
+        c->count++;
+    }
+    return e;
+}
+
+/**
+ * @brief Initialize an empty cache
+ *
+ * @param c Pointer to the cache
+ */
+void cache_init(struct cache *c)
+{
+    *c = (struct cache){0};
+}
+
+/**
+ * @brief Free every entry held by the cache
+ *
+ * @param c Pointer to the cache
+ */
+void cache_free(struct cache *c)
+{
+    for (size_t i = 0; i < c->cap; i++)
+    {
+        free(c->entries[i].name);
+        free(c->entries[i].s);
+    }
+    free(c->entries);
+    *c = (struct cache){0};
+}
+
+/**
+ * @brief Look up the cached value of a parameter.
+ *
+ * @param c Pointer to the cache
+ * @param name The parameter name, any case
+ * @return struct cache_entry* May return NULL if no value is cached
+ */
+struct cache_entry *cache_lookup(struct cache *c, const char *name)
+{
+    if (c->cap == 0)
+        return NULL;
+
+    struct cache_entry *e = find_slot(c->entries, c->cap, name);
+    return e->name != NULL && e->type != CACHE_NONE ? e : NULL;
+}
+
+/**
+ * @brief Record a float value confirmed in the current generation
+ *
+ * @param c Pointer to the cache
+ * @param name The parameter name, any case
+ * @param f The value
+ */
+void cache_store_float(struct cache *c, const char *name, float f)
+{
+    struct cache_entry *e = upsert(c, name);
+    if (e == NULL)
+        return;
+
+    free(e->s);
+    e->s = NULL;
+    e->type = CACHE_FLOAT;
+    e->f = f;
+    e->generation = c->generation;
+}
+
+/**
+ * @brief Record a string value confirmed in the current generation
+ *
+ * @param c Pointer to the cache
+ * @param name The parameter name, any case
+ * @param s The value
+ */
+void cache_store_string(struct cache *c, const char *name, const char *s)
+{
+    struct cache_entry *e = upsert(c, name);
+    if (e == NULL)
+        return;
+
+    if (e->type != CACHE_STRING || strcmp(e->s, s) != 0)
+    {
+        char *copy = malloc(strlen(s) + 1);
+        if (copy == NULL)
+        {
+            cache_invalidate(c, name);
+            return;
+        }
+        strcpy(copy, s);
+        free(e->s);
+        e->s = copy;
+    }
+    e->type = CACHE_STRING;
+    e->generation = c->generation;
+}
+
+/**
+ * @brief Forget the value of a parameter, for writes whose result is not known locally
+ *
+ * @param c Pointer to the cache
+ * @param name The parameter name, any case
+ */
+void cache_invalidate(struct cache *c, const char *name)
+{
+    struct cache_entry *e = cache_lookup(c, name);
+    if (e == NULL)
+        return;
+
+    free(e->s);
+    e->s = NULL;
+    e->type = CACHE_NONE;
+}
+
+/**
+ * @brief Begin a new generation, every cached value must be confirmed before it is trusted again
+ *
+ * @param c Pointer to the cache
+ */
+void cache_new_generation(struct cache *c)
+{
+    c->generation++;
+    log_trace("Cache generation %u", c->generation);
+}
+
+/**
+ * @brief Has the entry been confirmed since the engine last reported dirty parameters
+ *
+ * @param c Pointer to the cache
+ * @param e Pointer to an entry
+ * @return true The value may be trusted
+ * @return false The value must be read again before it is trusted
+ */
+bool cache_entry_is_current(const struct cache *c, const struct cache_entry *e)
+{
+    return e->generation == c->generation;
+}
+
+/**
+ * @brief Record that a profile or scene is now applied in full
+ *
+ * @param c Pointer to the cache
+ * @param hash Hash of the profile or scene
+ */
+void cache_set_applied(struct cache *c, uint64_t hash)
+{
+    c->applied_hash = hash;
+    c->applied_generation = c->generation;
+}
+
+/**
+ * @brief Is a profile or scene still applied, nothing written and no dirty parameters
+ * reported since it was recorded. Whoever reads the engine's dirty flag begins a new
+ * generation, so a change seen by any reader is seen here.
+ *
+ * @param c Pointer to the cache
+ * @param hash Hash of the profile or scene
+ * @return true The profile or scene need not be applied again
+ */
+bool cache_is_applied(const struct cache *c, uint64_t hash)
+{
+    return c->applied_hash != 0 && c->applied_hash == hash && c->applied_generation == c->generation;
+}
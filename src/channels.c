@@ -0,0 +1,106 @@
+/**
+ * @file channels.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief The level channel assignment of each kind of Voicemeeter.
+ * VBVMR_GetLevel takes a channel index that counts across every strip or
+ * every bus of the running kind. The tables here give the channels of each
+ * strip and bus, so a level read fetches exactly the channels it reports.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include "channels.h"
+#include "wrapper.h"
+
+/* 2 stereo hardware inputs and 1 virtual input, hardware out A and virtual out B */
+static const struct channel_map basic = {
+    .num_strips = 3,
+    .num_physical_strips = 2,
+    .num_buses = 2,
+    .num_physical_buses = 1,
+    .strip_channels = 12,
+    .bus_channels = 16,
+    .strips = {{0, 2}, {2, 2}, {4, 8}},
+    .buses = {{0, 8}, {8, 8}},
+};
+
+/* 3 hardware inputs and 2 virtual inputs, A1-A3 and B1-B2 */
+static const struct channel_map banana = {
+    .num_strips = 5,
+    .num_physical_strips = 3,
+    .num_buses = 5,
+    .num_physical_buses = 3,
+    .strip_channels = 22,
+    .bus_channels = 40,
+    .strips = {{0, 2}, {2, 2}, {4, 2}, {6, 8}, {14, 8}},
+    .buses = {{0, 8}, {8, 8}, {16, 8}, {24, 8}, {32, 8}},
+};
+
+/* 5 hardware inputs and 3 virtual inputs, A1-A5 and B1-B3 */
+static const struct channel_map potato = {
+    .num_strips = 8,
+    .num_physical_strips = 5,
+    .num_buses = 8,
+    .num_physical_buses = 5,
+    .strip_channels = 34,
+    .bus_channels = 64,
+    .strips = {{0, 2}, {2, 2}, {4, 2}, {6, 2}, {8, 2}, {10, 8}, {18, 8}, {26, 8}},
+    .buses = {{0, 8}, {8, 8}, {16, 8}, {24, 8}, {32, 8}, {40, 8}, {48, 8}, {56, 8}},
+};
+
+static const struct channel_map *maps[] = {
+    [BASIC] = &basic,
+    [BANANA] = &banana,
+    [POTATO] = &potato,
+    [BASICX64] = &basic,
+    [BANANAX64] = &banana,
+    [POTATOX64] = &potato,
+};
+
+/**
+ * @brief Get the level channel assignment of a kind
+ *
+ * @param kind The kind of Voicemeeter, 32 or 64 bit
+ * @return const struct channel_map* The assignment, NULL for an unknown kind
+ */
+const struct channel_map *channel_map(int kind)
+{
+    if (kind < BASIC || kind > POTATOX64)
+        return NULL;
+    return maps[kind];
+}
+
+/**
+ * @brief Look up a bus by its name on the mixer, A1 is the first hardware bus and B1 the first virtual one.
+ * Basic names its buses A and B, both spellings are accepted.
+ *
+ * @param map The assignment of the running kind
+ * @param name The name, case is ignored
+ * @return int Index of the bus, -1 if the kind has no such bus
+ */
+int channel_bus_index(const struct channel_map *map, const char *name)
+{
+    char letter = (char)toupper((unsigned char)name[0]);
+    if (letter != 'A' && letter != 'B')
+        return -1;
+
+    long n = 1;
+    if (name[1] != '\0')
+    {
+        char *end;
+        n = strtol(name + 1, &end, 10);
+        if (*end != '\0' || !isdigit((unsigned char)name[1]))
+            return -1;
+    }
+
+    int count = letter == 'A' ? map->num_physical_buses : map->num_buses - map->num_physical_buses;
+    if (n < 1 || n > count)
+        return -1;
+    return (letter == 'A' ? 0 : map->num_physical_buses) + (int)n - 1;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file coalesce.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for coalescing high rate sets into one script per frame.
+ * A fader or a piped generator may set the same parameter hundreds of times
+ * a second. Sets are held for a frame, only the last value of each parameter
+ * is kept, and a single scheduler timer writes them all with one script when
+ * the frame ends. The engine sees at most one write per parameter per frame,
+ * however fast the input arrives.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "coalesce.h"
+#include "command.h"
+#include "wrapper.h"
+#include "util.h"
+#include "log.h"
+
+#define MAX_SCRIPT 48000 /* SetParameters accepts scripts of up to 48kB */
+
+static struct pending_write *find(const struct coalescer *c, const char *name)
+{
+    for (size_t i = 0; i < c->count; i++)
+    {
+        if (strcasecmp(c->items[i].name, name) == 0)
+            return &c->items[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Write a script holding the pending writes from first up to but not including last,
+ * then bring the cache into line with the result.
+ */
+static void write_script(struct coalescer *c, size_t first, size_t last)
+{
+    if (first == last)
+        return;
+
+    long rep = set_parameters(c->vmr, c->script);
+    if (rep != 0)
+        log_error("Failed applying coalesced writes (%ld)", rep);
+    c->stats.out += (long long)(last - first);
+    c->stats.flushes++;
+    c->cache->applied_hash = 0;
+
+    for (size_t i = first; i < last; i++)
+    {
+        const struct pending_write *w = &c->items[i];
+        if (rep != 0)
+            cache_invalidate(c->cache, w->name);
+        else if (w->numeric)
+            cache_store_float(c->cache, w->name, w->f);
+        else
+            cache_store_string(c->cache, w->name, w->value);
+    }
+}
+
+/**
+ * @brief End the frame, runs on the scheduler thread.
+ */
+static void frame_end(void *udata, long long deadline_us)
+{
+    (void)deadline_us;
+    struct coalescer *c = udata;
+
+    c->timer = 0;
+    coalesce_flush(c);
+}
+
+/**
+ * @brief Initialize an empty coalescer
+ *
+ * @param c Pointer to the coalescer
+ * @param vmr Pointer to the iVMR interface
+ * @param sched The scheduler that ends each frame, its lock guards the coalescer
+ * @param cache Written parameters are stored once the frame is flushed
+ * @param frame_us Length of a frame, 0 disables coalescing
+ */
+void coalesce_init(struct coalescer *c, PT_VMR vmr, struct sched *sched, struct cache *cache, long long frame_us)
+{
+    *c = (struct coalescer){.vmr = vmr, .sched = sched, .cache = cache, .frame_us = frame_us};
+}
+
+/**
+ * @brief Check whether a parameter has a write waiting for the end of the frame
+ *
+ * @param c Pointer to the coalescer
+ * @param name The parameter name
+ * @return true The parameter is pending
+ */
+bool coalesce_is_pending(const struct coalescer *c, const char *name)
+{
+    return find(c, name) != NULL;
+}
+
+/**
+ * @brief Hold a set until the end of the frame, replacing any value already held for the parameter.
+ * The caller must hold the scheduler lock.
+ *
+ * @param c Pointer to the coalescer
+ * @param name The parameter name
+ * @param value The value as given
+ * @param numeric The value parsed as a float
+ * @param f The parsed value
+ * @return true The set will be written when the frame ends
+ * @return false Memory could not be allocated or the frame could not be scheduled,
+ * the caller should write the set itself
+ */
+bool coalesce_set(struct coalescer *c, const char *name, const char *value, bool numeric, float f)
+{
+    char *copy = malloc(strlen(value) + 1);
+    if (copy == NULL)
+        return false;
+    strcpy(copy, value);
+
+    struct pending_write *w = find(c, name);
+    if (w != NULL)
+    {
+        free(w->value);
+    }
+    else
+    {
+        if (c->script == NULL && (c->script = malloc(MAX_SCRIPT)) == NULL)
+        {
+            free(copy);
+            return false;
+        }
+        if (c->count == c->cap)
+        {
+            size_t cap = c->cap ? c->cap * 2 : 16;
+            struct pending_write *items = realloc(c->items, cap * sizeof(struct pending_write));
+            if (items == NULL)
+            {
+                free(copy);
+                return false;
+            }
+            c->items = items;
+            c->cap = cap;
+        }
+
+        char *name_copy = malloc(strlen(name) + 1);
+        if (name_copy == NULL)
+        {
+            free(copy);
+            return false;
+        }
+        strcpy(name_copy, name);
+
+        if (c->timer == 0 && (c->timer = sched_add(c->sched, c->frame_us, 0, frame_end, c)) == 0)
+        {
+            free(name_copy);
+            free(copy);
+            return false;
+        }
+        w = &c->items[c->count++];
+        w->name = name_copy;
+    }
+
+    w->value = copy;
+    w->numeric = numeric;
+    w->f = f;
+
+    long long now = now_us();
+    if (c->stats.in++ == 0)
+        c->stats.first_us = now;
+    c->stats.last_us = now;
+    return true;
+}
+
+/**
+ * @brief Write every pending set now, as one script unless it exceeds the engine's limit.
+ * Called when the frame ends, and before anything that must see the writes: reads,
+ * relative writes and directives. The caller must hold the scheduler lock.
+ *
+ * @param c Pointer to the coalescer
+ */
+void coalesce_flush(struct coalescer *c)
+{
+    if (c->count == 0)
+        return;
+    if (c->timer != 0)
+    {
+        sched_cancel(c->sched, c->timer);
+        c->timer = 0;
+    }
+
+    size_t len = 0, first = 0;
+    for (size_t i = 0; i < c->count; i++)
+    {
+        const struct pending_write *w = &c->items[i];
+        struct command cmd = {.op = OP_SET, .param = w->name, .value = w->value};
+
+        /* separator and terminator */
+        if (len > 0 && !command_format_script(&cmd, c->script + len + 1, MAX_SCRIPT - len - 1))
+        {
+            write_script(c, first, i);
+            len = 0;
+            first = i;
+        }
+        if (len > 0)
+        {
+            c->script[len++] = ';';
+            len += strlen(c->script + len);
+            continue;
+        }
+        if (!command_format_script(&cmd, c->script, MAX_SCRIPT))
+        {
+            log_error("Coalesced write of %s is too long, it was dropped", w->name);
+            cache_invalidate(c->cache, w->name);
+            first = i + 1;
+            continue;
+        }
+        len = strlen(c->script);
+    }
+    write_script(c, first, c->count);
+    c->stats.last_us = now_us();
+
+    for (size_t i = 0; i < c->count; i++)
+    {
+        free(c->items[i].name);
+        free(c->items[i].value);
+    }
+    c->count = 0;
+}
+
+/**
+ * @brief Free the coalescer, anything still pending must have been flushed first
+ *
+ * @param c Pointer to the coalescer
+ */
+void coalesce_free(struct coalescer *c)
+{
+    for (size_t i = 0; i < c->count; i++)
+    {
+        free(c->items[i].name);
+        free(c->items[i].value);
+    }
+    free(c->items);
+    free(c->script);
+    *c = (struct coalescer){0};
+}
@@ -0,0 +1,396 @@
+/**
+ * @file command.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for splitting input lines into commands and
+ * classifying each command by the kind of operation it performs.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "command.h"
+#include "util.h"
+#include "log.h"
+
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#define RAMP_SPEC_SZ 64
+#define MAX_INDEX_DIGITS 2 /* Indices are below MAX_EXPANSION, longer digit runs are rejected before they can overflow */
+
+static const struct quickcommand quickcommands[] = {
+    {.name = "lock", .fullcommand = "command.lock=1"},
+    {.name = "unlock", .fullcommand = "command.lock=0"},
+    {.name = "show", .fullcommand = "command.show=1"},
+    {.name = "hide", .fullcommand = "command.show=0"},
+    {.name = "restart", .fullcommand = "command.restart=1"}};
+
+/* Helper functions for command_tokenize */
+static inline bool is_quote_char(char c)
+{
+    return (c == '"' || c == '\'');
+}
+
+static inline bool is_delimiter_char(char c, const char *delimiters)
+{
+    return strchr(delimiters, c) != NULL;
+}
+
+static char *skip_consecutive_delimiters(char *p, const char *delimiters)
+{
+    while (*p != '\0' && is_delimiter_char(*p, delimiters))
+    {
+        p++;
+    }
+    return p;
+}
+
+/* Only digits, stars, dashes, commas and blanks stand between p and the ']' of a selector */
+static bool closes_selector(const char *p)
+{
+    while (*p != '\0' && strchr("0123456789*-, \t", *p) != NULL)
+    {
+        p++;
+    }
+    return *p == ']';
+}
+
+/**
+ * @brief Split an input line into separate commands.
+ * Commands are split based on the delimiters argument, but quoted strings are preserved as single commands.
+ * Tokens are built in place, quote characters are squeezed out and each token is
+ * NUL terminated within the input, so there is no limit on the length of a token.
+ * See the test cases for examples of how input lines are parsed:
+ * https://github.com/onyx-and-iris/vmrcli?tab=readme-ov-file#api-commands
+ *
+ * @param input Each input line, from stdin, CLI args or a script. Modified in place.
+ * @param delimiters A string of delimiter characters to split each input line
+ * @param fn Called once for each token, in order
+ * @param udata Passed through to fn
+ */
+void command_tokenize(char *input, const char *delimiters, token_fn fn, void *udata)
+{
+    char *current = input;
+    char *token = input; /* start of the token being built */
+    char *write = input; /* trails current, never ahead of it */
+    bool inside_quotes = false;
+    int bracket_depth = 0; /* delimiters within an index selector such as [1,3] do not split */
+    char quote_char = '\0';
+
+    while (*current != '\0')
+    {
+        if (!inside_quotes && is_quote_char(*current))
+        {
+            inside_quotes = true;
+            quote_char = *current;
+            current++;
+            log_trace("Entering quotes with char '%c'", quote_char);
+            continue;
+        }
+        else if (inside_quotes && *current == quote_char)
+        {
+            inside_quotes = false;
+            quote_char = '\0';
+            current++;
+            log_trace("Exiting quotes");
+            continue;
+        }
+        else if (!inside_quotes && is_delimiter_char(*current, delimiters) &&
+                 (bracket_depth == 0 || !closes_selector(current)))
+        {
+            /* an unclosed '[' never swallows the commands after it */
+            char *next = skip_consecutive_delimiters(current, delimiters);
+            bracket_depth = 0;
+            if (write > token)
+            {
+                *write = '\0';
+                fn(token, udata);
+            }
+
+            token = write = current = next;
+            continue;
+        }
+        else
+        {
+            if (!inside_quotes && *current == '[')
+                bracket_depth++;
+            else if (!inside_quotes && *current == ']' && bracket_depth > 0)
+                bracket_depth--;
+            *write++ = *current;
+            log_trace("Added char '%c' to token, current token: '%.*s'", *current, (int)(write - token), token);
+        }
+        current++;
+    }
+
+    if (write > token)
+    {
+        *write = '\0';
+        fn(token, udata);
+    }
+}
+
+/**
+ * @brief Classify a single token by the kind of operation it performs.
+ * The token is split in place, cmd->param and cmd->value point into it.
+ * See command type definitions in:
+ * https://github.com/onyx-and-iris/vmrcli?tab=readme-ov-file#api-commands
+ *
+ * @param token A single command string, modified in place
+ * @param cmd Pointer to the command struct to be filled
+ * @return true The token was classified
+ * @return false The token has no parameter name
+ */
+bool command_parse(char *token, struct command *cmd)
+{
+    *cmd = (struct command){.op = OP_GET, .param = token};
+
+    struct quickcommand *qc_ptr = command_in_quickcommands(token, quickcommands, (int)COUNT_OF(quickcommands));
+    if (qc_ptr != NULL)
+    {
+        cmd->op = OP_QUICK;
+        cmd->param = qc_ptr->fullcommand;
+        cmd->script = qc_ptr->fullcommand;
+        return true;
+    }
+
+    if (token[0] == '!') /* toggle */
+    {
+        cmd->op = OP_TOGGLE;
+        cmd->param = token + 1;
+        return cmd->param[0] != '\0';
+    }
+
+    /* only the name may hold a ramp, a set's value such as label="a~>b" is left alone */
+    char *ramp_pos = strstr(token, "~>");
+    char *first_equals = strchr(token, '=');
+    if (ramp_pos != NULL && (first_equals == NULL || ramp_pos < first_equals)) /* ramp */
+    {
+        long long duration_us;
+        enum ramp_curve curve;
+        cmd->op = OP_RAMP;
+        *ramp_pos = '\0';
+        cmd->value = ramp_pos + 2;
+        cmd->numeric = command_parse_ramp(cmd->value, &cmd->f, &duration_us, &curve);
+        return cmd->param[0] != '\0';
+    }
+
+    char *equals_pos = strchr(token, '=');
+    if (equals_pos != NULL) /* set, increment or decrement */
+    {
+        char *op_pos = equals_pos;
+        cmd->op = OP_SET;
+        if (equals_pos > token && equals_pos[-1] == '+')
+        {
+            cmd->op = OP_INC;
+            op_pos--;
+        }
+        else if (equals_pos > token && equals_pos[-1] == '-')
+        {
+            cmd->op = OP_DEC;
+            op_pos--;
+        }
+        *op_pos = '\0';
+        cmd->value = equals_pos + 1;
+        cmd->numeric = parse_float(cmd->value, &cmd->f);
+    }
+
+    return cmd->param[0] != '\0';
+}
+
+/**
+ * @brief Parse the spec of a ramp, the part after "~>", such as "-20@1500ms:exp".
+ * The duration takes the units accepted by parse_duration, the curve is one of
+ * lin, exp or log and defaults to lin.
+ *
+ * @param spec The ramp spec
+ * @param target Receives the value to ramp to
+ * @param duration_us Receives the length of the ramp
+ * @param curve Receives the shape of the ramp
+ * @return true The spec is valid
+ * @return false The spec is malformed
+ */
+bool command_parse_ramp(const char *spec, float *target, long long *duration_us, enum ramp_curve *curve)
+{
+    static const char *curves[] = {[CURVE_LIN] = "lin", [CURVE_EXP] = "exp", [CURVE_LOG] = "log"};
+    char buf[RAMP_SPEC_SZ];
+
+    if (snprintf(buf, sizeof(buf), "%s", spec) >= (int)sizeof(buf))
+        return false;
+
+    char *at_pos = strchr(buf, '@');
+    if (at_pos == NULL)
+        return false;
+    *at_pos = '\0';
+
+    char *colon_pos = strchr(at_pos + 1, ':');
+    *curve = CURVE_LIN;
+    if (colon_pos != NULL)
+    {
+        *colon_pos = '\0';
+        size_t i = 0;
+        while (i < COUNT_OF(curves) && strcasecmp(colon_pos + 1, curves[i]) != 0)
+            i++;
+        if (i == COUNT_OF(curves))
+            return false;
+        *curve = (enum ramp_curve)i;
+    }
+
+    return parse_float(buf, target) && parse_duration(at_pos + 1, duration_us);
+}
+
+/**
+ * @brief Format a set, increment, decrement or quick command as a script.
+ * Values containing spaces or tabs are wrapped in quotes.
+ *
+ * @param cmd The command to be formatted
+ * @param output Buffer to store the result
+ * @param max_len Maximum length of the output buffer
+ * @return true The script was written to output
+ * @return false The command has no script form or is too long
+ */
+bool command_format_script(const struct command *cmd, char *output, size_t max_len)
+{
+    static const char *ops[] = {[OP_SET] = "=", [OP_INC] = "+=", [OP_DEC] = "-="};
+    int n;
+
+    if (cmd->script != NULL)
+    {
+        n = snprintf(output, max_len, "%s", cmd->script);
+    }
+    else if (cmd->op == OP_SET || cmd->op == OP_INC || cmd->op == OP_DEC)
+    {
+        bool needs_quotes = strpbrk(cmd->value, " \t") != NULL;
+        n = snprintf(output, max_len, needs_quotes ? "%s%s\"%s\"" : "%s%s%s",
+                     cmd->param, ops[cmd->op], cmd->value);
+    }
+    else
+    {
+        return false;
+    }
+
+    return n >= 0 && (size_t)n < max_len;
+}
+
+/**
+ * @brief Parse an index selector such as "*", "0-4" or "1,3" into a bitmask of indices.
+ *
+ * @param sel The selector, up to but not including the closing ']'
+ * @param len Length of the selector
+ * @param count The number of strips or buses available
+ * @param mask Receives the selected indices
+ * @return true The selector is valid and within range
+ * @return false The selector is malformed or out of range
+ */
+static bool parse_selector(const char *sel, size_t len, int count, unsigned *mask)
+{
+    const char *end = sel + len;
+    *mask = 0;
+
+    if (len == 1 && sel[0] == '*')
+    {
+        *mask = (1u << count) - 1;
+        return count > 0;
+    }
+
+    while (sel < end)
+    {
+        int lo = 0, hi;
+        const char *start = sel;
+        for (; sel < end && *sel >= '0' && *sel <= '9'; sel++)
+        {
+            if (sel - start == MAX_INDEX_DIGITS)
+                return false;
+            lo = lo * 10 + (*sel - '0');
+        }
+        if (sel == start)
+            return false;
+
+        hi = lo;
+        if (sel < end && *sel == '-')
+        {
+            start = ++sel;
+            for (hi = 0; sel < end && *sel >= '0' && *sel <= '9'; sel++)
+            {
+                if (sel - start == MAX_INDEX_DIGITS)
+                    return false;
+                hi = hi * 10 + (*sel - '0');
+            }
+            if (sel == start || hi < lo)
+                return false;
+        }
+        if (hi >= count)
+            return false;
+
+        for (int i = lo; i <= hi; i++)
+            *mask |= 1u << i;
+
+        if (sel < end && *sel++ != ',')
+            return false;
+    }
+    return *mask != 0;
+}
+
+/**
+ * @brief Check whether a command's strip or bus index selects more than one index.
+ * Cheap enough to be asked of every token, see command_expand().
+ *
+ * @param token A single command string
+ * @return true The token holds a wildcard, range or list selector
+ */
+bool command_has_selector(const char *token)
+{
+    const char *name = token[0] == '!' ? token + 1 : token;
+
+    if (strncasecmp(name, "strip[", 6) != 0 && strncasecmp(name, "bus[", 4) != 0)
+        return false;
+
+    const char *open = strchr(name, '[');
+    const char *close = strchr(open, ']');
+    if (close == NULL)
+        return false;
+
+    size_t sel_len = (size_t)(close - open - 1);
+    return sel_len == 0 || strspn(open + 1, "0123456789") != sel_len;
+}
+
+/**
+ * @brief Expand a strip or bus index selector into one token per index.
+ * Supports wildcards, ranges and lists, for example:
+ * strip[0-4].mute=1, bus[*].gain-=3, !strip[1,3].solo, strip[*].label
+ * Only the strip/bus index is expanded, it is bounded by the counts for the running kind.
+ *
+ * @param token A single command string
+ * @param num_strips Number of strips available
+ * @param num_buses Number of buses available
+ * @param buf Storage for the expanded tokens, at least MAX_EXPANSION * (strlen(token) + 3) bytes
+ * @param tokens Receives pointers into buf, one per expanded token
+ * @return int The number of expanded tokens, 0 if the token holds no selector, -1 if the selector is invalid
+ */
+int command_expand(const char *token, int num_strips, int num_buses, char *buf, char *tokens[MAX_EXPANSION])
+{
+    if (!command_has_selector(token))
+        return 0;
+
+    const char *name = token[0] == '!' ? token + 1 : token;
+    int count = strncasecmp(name, "strip[", 6) == 0 ? num_strips : num_buses;
+    const char *open = strchr(name, '[');
+    const char *close = strchr(open, ']');
+    size_t sel_len = (size_t)(close - open - 1);
+
+    unsigned mask;
+    if (count > MAX_EXPANSION || !parse_selector(open + 1, sel_len, count, &mask))
+        return -1;
+
+    int n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+        tokens[n++] = buf;
+        buf += sprintf(buf, "%.*s%d%s", (int)(open + 1 - token), token, i, close) + 1;
+    }
+    return n;
+}
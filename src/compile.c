@@ -0,0 +1,457 @@
+/**
+ * @file compile.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for precompiling scripts into a compact binary image
+ * and mapping those images back into memory for execution.
+ *
+ * Image layout:
+ * | header | op[num_ops] | string table (strings_size bytes) |
+ * Parameter names, values and scripts are interned into the string table
+ * and referenced from each op by offset.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compile.h"
+#include "reader.h"
+#include "plan.h"
+#include "session.h"
+#include "util.h"
+#include "log.h"
+
+#define VMRC_MAGIC "VMRC"
+#define VMRC_VERSION 1
+#define VMRC_NONE UINT32_MAX
+#define MAX_LINE 4096 /* Size of the script buffer */
+
+/**
+ * @struct The image header
+ */
+struct vmrc_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t num_ops;
+    uint32_t strings_size;
+};
+
+/**
+ * @struct A single precompiled command, strings are offsets into the string table
+ */
+struct vmrc_op
+{
+    uint8_t op;
+    uint8_t numeric;
+    uint16_t reserved;
+    uint32_t param;
+    uint32_t value;
+    uint32_t script;
+    float f;
+};
+
+/**
+ * @struct State held while compiling a script
+ */
+struct compiler
+{
+    struct vmrc_op *ops;
+    uint32_t num_ops;
+    uint32_t ops_cap;
+    char *strings;
+    uint32_t strings_size;
+    uint32_t strings_cap;
+    uint32_t *interned; /* Open addressed table of string offsets, VMRC_NONE if empty */
+    uint32_t interned_cap;
+    uint32_t num_interned;
+    struct batch batch; /* The commands of the line being compiled */
+    int num_strips;     /* Index selectors are expanded for the kind given to compile_script() */
+    int num_buses;
+    size_t line_no;
+    size_t rejected; /* Lines that can not be compiled */
+    bool failed;
+};
+
+static uint32_t hash_string(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static bool grow_interned(struct compiler *c)
+{
+    uint32_t cap = c->interned_cap ? c->interned_cap * 2 : 256;
+    uint32_t *table = malloc(cap * sizeof(uint32_t));
+    if (table == NULL)
+        return false;
+    memset(table, 0xFF, cap * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < c->interned_cap; i++)
+    {
+        uint32_t off = c->interned[i];
+        if (off == VMRC_NONE)
+            continue;
+        uint32_t j = hash_string(c->strings + off) & (cap - 1);
+        while (table[j] != VMRC_NONE)
+            j = (j + 1) & (cap - 1);
+        table[j] = off;
+    }
+
+    free(c->interned);
+    c->interned = table;
+    c->interned_cap = cap;
+    return true;
+}
+
+/**
+ * @brief Add a string to the string table, reusing an existing copy if present.
+ *
+ * @param c Pointer to the compiler state
+ * @param s The string to intern, may be NULL
+ * @return uint32_t Offset of the string, VMRC_NONE if s is NULL or on failure
+ */
+static uint32_t intern(struct compiler *c, const char *s)
+{
+    if (s == NULL)
+        return VMRC_NONE;
+
+    if ((c->num_interned + 1) * 2 > c->interned_cap && !grow_interned(c))
+    {
+        c->failed = true;
+        return VMRC_NONE;
+    }
+
+    uint32_t j = hash_string(s) & (c->interned_cap - 1);
+    while (c->interned[j] != VMRC_NONE)
+    {
+        if (strcmp(c->strings + c->interned[j], s) == 0)
+            return c->interned[j];
+        j = (j + 1) & (c->interned_cap - 1);
+    }
+
+    size_t len = strlen(s) + 1;
+    if (c->strings_size + len > c->strings_cap)
+    {
+        uint32_t cap = c->strings_cap ? c->strings_cap : 4096;
+        while (c->strings_size + len > cap)
+            cap *= 2;
+        char *strings = realloc(c->strings, cap);
+        if (strings == NULL)
+        {
+            c->failed = true;
+            return VMRC_NONE;
+        }
+        c->strings = strings;
+        c->strings_cap = cap;
+    }
+
+    uint32_t off = c->strings_size;
+    memcpy(c->strings + off, s, len);
+    c->strings_size += (uint32_t)len;
+    c->interned[j] = off;
+    c->num_interned++;
+    return off;
+}
+
+/**
+ * @brief Token callback, expands any index selector then classifies each token
+ * and adds it to the line's batch.
+ */
+static void compile_token(char *token, void *udata)
+{
+    struct compiler *c = udata;
+    struct command cmd;
+
+    char *tokens[MAX_EXPANSION] = {token};
+    int n = 1;
+    if (command_has_selector(token))
+    {
+        char *buf = malloc(MAX_EXPANSION * (strlen(token) + 3));
+        if (buf == NULL)
+        {
+            c->failed = true;
+            return;
+        }
+        n = command_expand(token, c->num_strips, c->num_buses, buf, tokens);
+        if (n <= 0)
+        {
+            log_error("line %zu: invalid or out of range index selector in '%s'", c->line_no, token);
+            c->rejected++;
+            free(buf);
+            return;
+        }
+        if (!batch_own(&c->batch, buf))
+        {
+            c->failed = true;
+            return;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (!command_parse(tokens[i], &cmd))
+        {
+            log_warn("Skipping empty command '%s'", tokens[i]);
+            continue;
+        }
+        if (!batch_push(&c->batch, &cmd))
+            c->failed = true;
+    }
+}
+
+/**
+ * @brief Append a classified command as an op.
+ */
+static void emit_command(struct compiler *c, const struct command *cmd)
+{
+    char script[MAX_LINE];
+
+    if (c->num_ops == c->ops_cap)
+    {
+        uint32_t cap = c->ops_cap ? c->ops_cap * 2 : 64;
+        struct vmrc_op *ops = realloc(c->ops, cap * sizeof(struct vmrc_op));
+        if (ops == NULL)
+        {
+            c->failed = true;
+            return;
+        }
+        c->ops = ops;
+        c->ops_cap = cap;
+    }
+
+    struct vmrc_op *op = &c->ops[c->num_ops++];
+    *op = (struct vmrc_op){
+        .op = (uint8_t)cmd->op,
+        .numeric = cmd->numeric,
+        .param = intern(c, cmd->param),
+        .value = intern(c, cmd->value),
+        .script = VMRC_NONE,
+        .f = cmd->f,
+    };
+
+    if (command_format_script(cmd, script, MAX_LINE))
+    {
+        op->script = intern(c, script);
+    }
+}
+
+/**
+ * @brief Parse a script once and write it out as a binary image.
+ * Each line is optimised as a batch before it is written, see plan_optimise().
+ * Only plain commands are compiled, a directive or a line of the language fails the script.
+ * Index selectors are expanded here, @pattern device values are matched when the image runs.
+ *
+ * @param script_path Path to the script to be compiled
+ * @param image_path Path the image will be written to
+ * @param delimiters A string of delimiter characters to split each script line
+ * @param kind The kind of Voicemeeter the image is for, bounds the index selectors
+ * @return true The image was written
+ * @return false The script could not be read or compiled, or the image could not be written
+ */
+bool compile_script(const char *script_path, const char *image_path, const char *delimiters, int kind)
+{
+    struct compiler c = {.num_strips = kind_num_strips(kind), .num_buses = kind_num_buses(kind)};
+    struct reader r;
+    char *line;
+    bool ok = false;
+
+    if (!reader_open(&r, script_path))
+        return false;
+
+    while (!c.failed && (line = reader_next_line(&r, NULL)) != NULL)
+    {
+        c.line_no++;
+        if (is_comment(line))
+            continue;
+        if (session_is_directive(line) || lang_is_statement(line))
+        {
+            log_error("line %zu: '%s' is a directive or a statement, only plain commands can be compiled", c.line_no, line);
+            c.rejected++;
+            continue;
+        }
+        batch_clear(&c.batch);
+        command_tokenize(line, delimiters, compile_token, &c);
+        plan_optimise(&c.batch);
+        for (size_t i = 0; i < c.batch.count; i++)
+            emit_command(&c, &c.batch.cmds[i]);
+    }
+    reader_close(&r);
+
+    if (c.failed)
+    {
+        log_error("Out of memory compiling '%s'", script_path);
+        goto cleanup;
+    }
+    if (c.rejected > 0)
+    {
+        log_error("%zu lines of '%s' could not be compiled, no image written", c.rejected, script_path);
+        goto cleanup;
+    }
+
+    FILE *out = fopen(image_path, "wb");
+    if (out == NULL)
+    {
+        log_error("Unable to open '%s' for writing", image_path);
+        goto cleanup;
+    }
+
+    struct vmrc_header header = {
+        .magic = VMRC_MAGIC,
+        .version = VMRC_VERSION,
+        .num_ops = c.num_ops,
+        .strings_size = c.strings_size,
+    };
+    ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+         fwrite(c.ops, sizeof(struct vmrc_op), c.num_ops, out) == c.num_ops &&
+         fwrite(c.strings, 1, c.strings_size, out) == c.strings_size;
+    ok = fclose(out) == 0 && ok;
+
+    if (ok)
+        log_info("Compiled %u commands (%u bytes of strings) into %s",
+                 c.num_ops, c.strings_size, image_path);
+    else
+        log_error("Failed writing image '%s'", image_path);
+
+cleanup:
+    free(c.ops);
+    free(c.strings);
+    free(c.interned);
+    batch_free(&c.batch);
+    return ok;
+}
+
+/**
+ * @brief Validate that every offset held by the ops lies within the string table.
+ */
+static bool image_is_valid(const struct image *img, uint32_t strings_size)
+{
+    if (strings_size > 0 && img->strings[strings_size - 1] != '\0')
+        return false;
+
+    for (uint32_t i = 0; i < img->num_ops; i++)
+    {
+        const struct vmrc_op *op = &img->ops[i];
+        if (op->op > OP_RAMP || op->param >= strings_size ||
+            (op->value != VMRC_NONE && op->value >= strings_size) ||
+            (op->script != VMRC_NONE && op->script >= strings_size))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Map a compiled image into memory.
+ * The view is copy-on-write so commands may be handed to the API as mutable strings.
+ *
+ * @param image_path Path to the image
+ * @param img Pointer to the image struct to be filled
+ * @return true The image was mapped and validated
+ * @return false The image could not be mapped or is malformed
+ */
+bool image_open(const char *image_path, struct image *img)
+{
+    LARGE_INTEGER size;
+    *img = (struct image){0};
+
+    img->file = CreateFile(image_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (img->file == INVALID_HANDLE_VALUE)
+    {
+        img->file = NULL;
+        log_error("Unable to open image '%s'", image_path);
+        return false;
+    }
+
+    if (!GetFileSizeEx(img->file, &size) || size.QuadPart < (LONGLONG)sizeof(struct vmrc_header))
+    {
+        log_error("'%s' is not a vmrcli image", image_path);
+        image_close(img);
+        return false;
+    }
+
+    img->mapping = CreateFileMapping(img->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (img->mapping != NULL)
+        img->base = MapViewOfFile(img->mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (img->base == NULL)
+    {
+        log_error("Unable to map image '%s'", image_path);
+        image_close(img);
+        return false;
+    }
+
+    const struct vmrc_header *header = (const struct vmrc_header *)img->base;
+    if (memcmp(header->magic, VMRC_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != VMRC_VERSION ||
+        (LONGLONG)sizeof(*header) + (LONGLONG)header->num_ops * (LONGLONG)sizeof(struct vmrc_op) +
+                header->strings_size !=
+            size.QuadPart)
+    {
+        log_error("'%s' is not a vmrcli image (version %d)", image_path, VMRC_VERSION);
+        image_close(img);
+        return false;
+    }
+
+    img->num_ops = header->num_ops;
+    img->ops = (const struct vmrc_op *)(img->base + sizeof(*header));
+    img->strings = (char *)(img->ops + img->num_ops);
+
+    if (!image_is_valid(img, header->strings_size))
+    {
+        log_error("Image '%s' is corrupt", image_path);
+        image_close(img);
+        return false;
+    }
+
+    log_debug("Mapped %u commands from %s", img->num_ops, image_path);
+    return true;
+}
+
+/**
+ * @brief Fill a command struct from the i'th op of an image without copying.
+ *
+ * @param img Pointer to a mapped image
+ * @param i Index of the op
+ * @param cmd Pointer to the command struct to be filled
+ * @return true The command was filled
+ * @return false i is out of range
+ */
+bool image_command(const struct image *img, uint32_t i, struct command *cmd)
+{
+    if (i >= img->num_ops)
+        return false;
+
+    const struct vmrc_op *op = &img->ops[i];
+    *cmd = (struct command){
+        .op = (enum op_kind)op->op,
+        .param = img->strings + op->param,
+        .value = op->value == VMRC_NONE ? NULL : img->strings + op->value,
+        .script = op->script == VMRC_NONE ? NULL : img->strings + op->script,
+        .numeric = op->numeric,
+        .f = op->f,
+    };
+    return true;
+}
+
+/**
+ * @brief Unmap an image and release its handles.
+ *
+ * @param img Pointer to the image
+ */
+void image_close(struct image *img)
+{
+    if (img->base != NULL)
+        UnmapViewOfFile(img->base);
+    if (img->mapping != NULL)
+        CloseHandle(img->mapping);
+    if (img->file != NULL)
+        CloseHandle(img->file);
+    *img = (struct image){0};
+}
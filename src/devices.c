@@ -0,0 +1,244 @@
+/**
+ * @file devices.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for enumerating audio devices and matching them by name.
+ * Enumerating asks the engine for every device in turn, so the results are kept
+ * and only enumerated again when the number of input or output devices changes.
+ * Counting the devices is a single call, enumerating them is one call per device.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "devices.h"
+#include "wrapper.h"
+#include "util.h"
+#include "log.h"
+
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+
+static const struct
+{
+    long type;
+    const char *name;
+} device_types[] = {
+    {.type = VBVMR_DEVTYPE_MME, .name = "mme"},
+    {.type = VBVMR_DEVTYPE_WDM, .name = "wdm"},
+    {.type = VBVMR_DEVTYPE_KS, .name = "ks"},
+    {.type = VBVMR_DEVTYPE_ASIO, .name = "asio"},
+};
+
+/**
+ * @brief Initialize an empty device store, nothing is enumerated until it is first used
+ *
+ * @param d Pointer to the device store
+ */
+void devices_init(struct devices *d)
+{
+    *d = (struct devices){0};
+}
+
+/**
+ * @brief Read the descriptor of every device into the store
+ */
+static bool enumerate(struct devices *d, PT_VMR vmr, long num_inputs, long num_outputs)
+{
+    size_t n = (size_t)(num_inputs + num_outputs);
+    if (n > d->cap)
+    {
+        struct device *items = realloc(d->items, n * sizeof(struct device));
+        if (items == NULL)
+        {
+            log_error("Failed to allocate memory for %zu devices", n);
+            return false;
+        }
+        d->items = items;
+        d->cap = n;
+    }
+
+    long long start = now_us();
+    d->count = 0;
+    for (long i = 0; i < num_inputs + num_outputs; i++)
+    {
+        struct device *dev = &d->items[d->count];
+        dev->output = i >= num_inputs;
+        dev->name[0] = dev->hwid[0] = '\0';
+        if (get_device_desc(vmr, dev->output, dev->output ? i - num_inputs : i, &dev->type, dev->name, dev->hwid) != 0)
+        {
+            log_warn("Failed reading %s device %ld", dev->output ? "output" : "input", dev->output ? i - num_inputs : i);
+            continue;
+        }
+        dev->name[DEVICE_NAME_SZ - 1] = dev->hwid[DEVICE_NAME_SZ - 1] = '\0';
+        d->count++;
+    }
+    d->num_inputs = num_inputs;
+    d->num_outputs = num_outputs;
+    d->valid = true;
+    d->enumerations++;
+    log_debug("Enumerated %ld input and %ld output devices in %.1f ms",
+              num_inputs, num_outputs, (now_us() - start) / 1000.0);
+    return true;
+}
+
+/**
+ * @brief Enumerate the devices again if their number has changed since the store was filled
+ *
+ * @param d Pointer to the device store
+ * @param vmr Pointer to the iVMR interface
+ * @param force Enumerate even if the number of devices is unchanged
+ * @return true The store was enumerated again
+ * @return false The store was already up to date, or enumerating failed
+ */
+bool devices_refresh(struct devices *d, PT_VMR vmr, bool force)
+{
+    long num_inputs = get_device_count(vmr, false);
+    long num_outputs = get_device_count(vmr, true);
+    if (num_inputs < 0 || num_outputs < 0)
+    {
+        log_error("Failed counting the audio devices");
+        return false;
+    }
+
+    if (!force && d->valid && num_inputs == d->num_inputs && num_outputs == d->num_outputs)
+        return false;
+    return enumerate(d, vmr, num_inputs, num_outputs);
+}
+
+/**
+ * @brief Find the first device of a type whose name matches a pattern.
+ * The store is enumerated on first use. When nothing matches, it is enumerated
+ * again if the number of devices has changed, in case the device has just arrived.
+ *
+ * @param d Pointer to the device store
+ * @param vmr Pointer to the iVMR interface
+ * @param output Match output devices rather than input devices
+ * @param type The device type, 0 for any
+ * @param pattern A name, matched without regard to case, where * and ? are wildcards
+ * @return const struct device* The device, NULL if none matches.
+ * Valid until the store is next refreshed.
+ */
+const struct device *devices_match(struct devices *d, PT_VMR vmr, bool output, long type, const char *pattern)
+{
+    if (!d->valid)
+        devices_refresh(d, vmr, false);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        for (size_t i = 0; i < d->count; i++)
+        {
+            const struct device *dev = &d->items[i];
+            if (dev->output == output && (type == 0 || dev->type == type) && devices_glob(pattern, dev->name))
+                return dev;
+        }
+        if (attempt == 0 && !devices_refresh(d, vmr, false))
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Step over one UTF-8 character
+ */
+static const char *next_char(const char *s)
+{
+    s++;
+    while ((*s & 0xC0) == 0x80)
+        s++;
+    return s;
+}
+
+/**
+ * @brief Match a string against a pattern without regard to ASCII case, * matches any run
+ * of characters and ? any single character. Both are UTF-8, ? and * step over whole characters.
+ *
+ * @param pattern The pattern
+ * @param s The string to be matched
+ * @return true The whole string matches
+ */
+bool devices_glob(const char *pattern, const char *s)
+{
+    const char *star = NULL;
+    const char *resume = NULL;
+
+    while (*s != '\0')
+    {
+        if (*pattern == '*')
+        {
+            star = ++pattern;
+            resume = s;
+        }
+        else if (*pattern == '?')
+        {
+            pattern++;
+            s = next_char(s);
+        }
+        else if (tolower((unsigned char)*pattern) == tolower((unsigned char)*s))
+        {
+            pattern++;
+            s++;
+        }
+        else if (star != NULL)
+        {
+            /* let the last star swallow one more character */
+            pattern = star;
+            s = resume = next_char(resume);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+/**
+ * @brief The device type named by the last part of a parameter such as bus[0].device.wdm
+ *
+ * @param s The type name, mme, wdm, ks or asio
+ * @return long The VBVMR_DEVTYPE value, 0 if the name is unknown
+ */
+long device_type_from_string(const char *s)
+{
+    for (size_t i = 0; i < COUNT_OF(device_types); i++)
+    {
+        if (strcasecmp(s, device_types[i].name) == 0)
+            return device_types[i].type;
+    }
+    return 0;
+}
+
+/**
+ * @brief The name of a device type
+ *
+ * @param type A VBVMR_DEVTYPE value
+ * @return const char* The name, "?" if the type is unknown
+ */
+const char *device_type_string(long type)
+{
+    for (size_t i = 0; i < COUNT_OF(device_types); i++)
+    {
+        if (device_types[i].type == type)
+            return device_types[i].name;
+    }
+    return "?";
+}
+
+/**
+ * @brief Free the device store
+ *
+ * @param d Pointer to the device store
+ */
+void devices_free(struct devices *d)
+{
+    free(d->items);
+    *d = (struct devices){0};
+}
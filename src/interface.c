@@ -14,27 +14,43 @@
  */
 
 #include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "interface.h"
+#include "loader.h"
 #include "util.h"
 #include "log.h"
 
-#define PRAGMA_IgnoreWCastIncompatibleFuncTypes \
-    _Pragma("GCC diagnostic push")              \
-        _Pragma("GCC diagnostic ignored \"-Wcast-function-type\"")
+#define DLL_FULLPATH_SZ 1024
+#define DLL_ENV "VMRCLI_DLL"
+#define DLL64_NAME "\\VoicemeeterRemote64.dll"
+#define DLL32_NAME "\\VoicemeeterRemote.dll"
 
-#define PRAGMA_Pop \
-    _Pragma("GCC diagnostic pop")
+/**
+ * @brief The library is loaded once per process, every interface shares it.
+ * It is never unloaded, the lazy entry points keep the addresses they bind.
+ */
+static struct
+{
+    char path[DLL_FULLPATH_SZ];
+    void *module;
+} dll;
 
-static long initialize_dll_interfaces(PT_VMR vmr);
+static long initialize_dll_interfaces(PT_VMR vmr, const char *dll_path);
+static bool resolve_dll_path(const char *dll_path, char *dll_fullpath);
 static bool registry_get_voicemeeter_folder(char *dll_fullpath);
 
 /**
  * @brief Create an interface object
  *
+ * @param dll_path Full path to the remote API library, NULL to read it from
+ * the VMRCLI_DLL environment variable or else the registry.
+ * Ignored once a library has been loaded, the first one is kept for the life of the process.
  * @return PT_VMR Pointer to the iVMR interface
  * May return NULL if the interface fails to initialize
  */
-PT_VMR create_interface()
+PT_VMR create_interface(const char *dll_path)
 {
     PT_VMR vmr = malloc(sizeof(T_VBVMR_INTERFACE));
     if (vmr == NULL)
@@ -43,12 +59,18 @@ PT_VMR create_interface()
         return NULL;
     }
 
-    LONG rep = initialize_dll_interfaces(vmr);
+    LONG rep = initialize_dll_interfaces(vmr, dll_path);
     if (rep < 0)
     {
         if (rep == -100)
         {
-            log_fatal("Voicemeeter is not installed");
+            log_fatal("Voicemeeter is not installed, set " DLL_ENV " to the remote API library");
+        }
+        else if (rep == -101)
+        {
+            char err[256];
+            loader_error(err, sizeof(err));
+            log_fatal("Error loading %s: %s", dll.path, err);
         }
         else
         {
@@ -61,70 +83,131 @@ PT_VMR create_interface()
     return vmr;
 }
 
+/*******************************************************************************/
+/**                          OPTIONAL ENTRY POINTS                            **/
+/*******************************************************************************/
+
+/**
+ * @brief Look up an entry point that older libraries may not export
+ *
+ * @param name Name of the entry point
+ * @return loader_fn Its address, NULL if it is missing
+ */
+static loader_fn bind_optional(const char *name)
+{
+    loader_fn fn = loader_symbol(dll.module, name);
+    if (fn == NULL)
+        log_warn("%s is not exported by %s, calls to it will fail", name, dll.path);
+    else
+        log_debug("Bound %s", name);
+    return fn;
+}
+
+/*
+ * Each optional entry point starts out as one of these, it binds the real
+ * function the first time it is called and forwards to it from then on.
+ * Short invocations never pay for lookups they do not use, and a library
+ * without the function only fails the calls that need it.
+ * A race between two first calls binds the same address twice, which is harmless.
+ */
+#define LAZY_ENTRY(name, params, args)                                           \
+    static long __stdcall lazy_##name params                                     \
+    {                                                                            \
+        static loader_fn fn;                                                     \
+        static bool missing;                                                     \
+        if (fn == NULL && !missing)                                              \
+            missing = (fn = bind_optional(#name)) == NULL;                       \
+        if (missing)                                                             \
+            return SYMBOL_MISSING;                                               \
+        return ((T_##name)fn) args;                                              \
+    }
+
+LAZY_ENTRY(VBVMR_GetParameterStringA, (char *param, char *s), (param, s))
+LAZY_ENTRY(VBVMR_GetLevel, (long type, long channel, float *value), (type, channel, value))
+LAZY_ENTRY(VBVMR_GetMidiMessage, (unsigned char *buf, long max), (buf, max))
+LAZY_ENTRY(VBVMR_SendMidiMessage, (unsigned char *buf, long max), (buf, max))
+
+LAZY_ENTRY(VBVMR_Output_GetDeviceNumber, (void), ())
+LAZY_ENTRY(VBVMR_Output_GetDeviceDescA, (long i, long *type, char *name, char *hwid), (i, type, name, hwid))
+LAZY_ENTRY(VBVMR_Output_GetDeviceDescW, (long i, long *type, unsigned short *name, unsigned short *hwid), (i, type, name, hwid))
+LAZY_ENTRY(VBVMR_Input_GetDeviceNumber, (void), ())
+LAZY_ENTRY(VBVMR_Input_GetDeviceDescA, (long i, long *type, char *name, char *hwid), (i, type, name, hwid))
+LAZY_ENTRY(VBVMR_Input_GetDeviceDescW, (long i, long *type, unsigned short *name, unsigned short *hwid), (i, type, name, hwid))
+
+LAZY_ENTRY(VBVMR_AudioCallbackRegister, (long mode, T_VBVMR_VBAUDIOCALLBACK cb, void *udata, char name[64]), (mode, cb, udata, name))
+LAZY_ENTRY(VBVMR_AudioCallbackStart, (void), ())
+LAZY_ENTRY(VBVMR_AudioCallbackStop, (void), ())
+LAZY_ENTRY(VBVMR_AudioCallbackUnregister, (void), ())
+
+LAZY_ENTRY(VBVMR_MacroButton_IsDirty, (void), ())
+LAZY_ENTRY(VBVMR_MacroButton_GetStatus, (long n, float *value, long mode), (n, value, mode))
+LAZY_ENTRY(VBVMR_MacroButton_SetStatus, (long n, float value, long mode), (n, value, mode))
+
 /*******************************************************************************/
 /**                                GET DLL INTERFACE                          **/
 /*******************************************************************************/
-#define DLL_FULLPATH_SZ 1024
-#define DLL64_NAME "\\VoicemeeterRemote64.dll"
-#define DLL32_NAME "\\VoicemeeterRemote.dll"
 
-static long initialize_dll_interfaces(PT_VMR vmr)
+static long initialize_dll_interfaces(PT_VMR vmr, const char *dll_path)
 {
-    HMODULE G_H_Module = NULL;
-    char dll_fullpath[DLL_FULLPATH_SZ];
     memset(vmr, 0, sizeof(T_VBVMR_INTERFACE));
 
-    // get Voicemeeter installation directory
-    if (!registry_get_voicemeeter_folder(dll_fullpath))
+    if (dll.module == NULL)
     {
-        // Voicemeeter not installed
-        return -100;
+        if (!resolve_dll_path(dll_path, dll.path))
+        {
+            // Voicemeeter not installed
+            return -100;
+        }
+
+        // Load Dll
+        dll.module = loader_open(dll.path);
+        if (dll.module == NULL)
+            return -101;
+        log_debug("Loaded %s", dll.path);
+    }
+    else if (dll_path != NULL && strcmp(dll_path, dll.path) != 0)
+    {
+        log_warn("%s is already loaded, ignoring %s", dll.path, dll_path);
     }
-    // use right dll according to O/S type
-    if (IS_64_BIT)
-        strncat(dll_fullpath, DLL64_NAME, DLL_FULLPATH_SZ - strlen(DLL64_NAME) - 1);
-    else
-        strncat(dll_fullpath, DLL32_NAME, DLL_FULLPATH_SZ - strlen(DLL32_NAME) - 1);
-
-    // Load Dll
-    G_H_Module = LoadLibrary(dll_fullpath);
-    if (G_H_Module == NULL)
-        return -101;
-
-    PRAGMA_IgnoreWCastIncompatibleFuncTypes;
-
-    // Get function pointers
-    vmr->VBVMR_Login = (T_VBVMR_Login)GetProcAddress(G_H_Module, "VBVMR_Login");
-    vmr->VBVMR_Logout = (T_VBVMR_Logout)GetProcAddress(G_H_Module, "VBVMR_Logout");
-    vmr->VBVMR_RunVoicemeeter = (T_VBVMR_RunVoicemeeter)GetProcAddress(G_H_Module, "VBVMR_RunVoicemeeter");
-    vmr->VBVMR_GetVoicemeeterType = (T_VBVMR_GetVoicemeeterType)GetProcAddress(G_H_Module, "VBVMR_GetVoicemeeterType");
-    vmr->VBVMR_GetVoicemeeterVersion = (T_VBVMR_GetVoicemeeterVersion)GetProcAddress(G_H_Module, "VBVMR_GetVoicemeeterVersion");
-
-    vmr->VBVMR_IsParametersDirty = (T_VBVMR_IsParametersDirty)GetProcAddress(G_H_Module, "VBVMR_IsParametersDirty");
-    vmr->VBVMR_GetParameterFloat = (T_VBVMR_GetParameterFloat)GetProcAddress(G_H_Module, "VBVMR_GetParameterFloat");
-    vmr->VBVMR_GetParameterStringA = (T_VBVMR_GetParameterStringA)GetProcAddress(G_H_Module, "VBVMR_GetParameterStringA");
-    vmr->VBVMR_GetParameterStringW = (T_VBVMR_GetParameterStringW)GetProcAddress(G_H_Module, "VBVMR_GetParameterStringW");
-    vmr->VBVMR_GetLevel = (T_VBVMR_GetLevel)GetProcAddress(G_H_Module, "VBVMR_GetLevel");
-    vmr->VBVMR_GetMidiMessage = (T_VBVMR_GetMidiMessage)GetProcAddress(G_H_Module, "VBVMR_GetMidiMessage");
-
-    vmr->VBVMR_SetParameterFloat = (T_VBVMR_SetParameterFloat)GetProcAddress(G_H_Module, "VBVMR_SetParameterFloat");
-    vmr->VBVMR_SetParameters = (T_VBVMR_SetParameters)GetProcAddress(G_H_Module, "VBVMR_SetParameters");
-    vmr->VBVMR_SetParametersW = (T_VBVMR_SetParametersW)GetProcAddress(G_H_Module, "VBVMR_SetParametersW");
-    vmr->VBVMR_SetParameterStringA = (T_VBVMR_SetParameterStringA)GetProcAddress(G_H_Module, "VBVMR_SetParameterStringA");
-    vmr->VBVMR_SetParameterStringW = (T_VBVMR_SetParameterStringW)GetProcAddress(G_H_Module, "VBVMR_SetParameterStringW");
-
-    vmr->VBVMR_Output_GetDeviceNumber = (T_VBVMR_Output_GetDeviceNumber)GetProcAddress(G_H_Module, "VBVMR_Output_GetDeviceNumber");
-    vmr->VBVMR_Output_GetDeviceDescA = (T_VBVMR_Output_GetDeviceDescA)GetProcAddress(G_H_Module, "VBVMR_Output_GetDeviceDescA");
-    vmr->VBVMR_Output_GetDeviceDescW = (T_VBVMR_Output_GetDeviceDescW)GetProcAddress(G_H_Module, "VBVMR_Output_GetDeviceDescW");
-    vmr->VBVMR_Input_GetDeviceNumber = (T_VBVMR_Input_GetDeviceNumber)GetProcAddress(G_H_Module, "VBVMR_Input_GetDeviceNumber");
-    vmr->VBVMR_Input_GetDeviceDescA = (T_VBVMR_Input_GetDeviceDescA)GetProcAddress(G_H_Module, "VBVMR_Input_GetDeviceDescA");
-    vmr->VBVMR_Input_GetDeviceDescW = (T_VBVMR_Input_GetDeviceDescW)GetProcAddress(G_H_Module, "VBVMR_Input_GetDeviceDescW");
-
-    vmr->VBVMR_MacroButton_IsDirty = (T_VBVMR_MacroButton_IsDirty)GetProcAddress(G_H_Module, "VBVMR_MacroButton_IsDirty");
-    vmr->VBVMR_MacroButton_GetStatus = (T_VBVMR_MacroButton_GetStatus)GetProcAddress(G_H_Module, "VBVMR_MacroButton_GetStatus");
-    vmr->VBVMR_MacroButton_SetStatus = (T_VBVMR_MacroButton_SetStatus)GetProcAddress(G_H_Module, "VBVMR_MacroButton_SetStatus");
-
-    PRAGMA_Pop;
+
+    // Get function pointers, every command needs these
+    vmr->VBVMR_Login = (T_VBVMR_Login)loader_symbol(dll.module, "VBVMR_Login");
+    vmr->VBVMR_Logout = (T_VBVMR_Logout)loader_symbol(dll.module, "VBVMR_Logout");
+    vmr->VBVMR_RunVoicemeeter = (T_VBVMR_RunVoicemeeter)loader_symbol(dll.module, "VBVMR_RunVoicemeeter");
+    vmr->VBVMR_GetVoicemeeterType = (T_VBVMR_GetVoicemeeterType)loader_symbol(dll.module, "VBVMR_GetVoicemeeterType");
+    vmr->VBVMR_GetVoicemeeterVersion = (T_VBVMR_GetVoicemeeterVersion)loader_symbol(dll.module, "VBVMR_GetVoicemeeterVersion");
+
+    vmr->VBVMR_IsParametersDirty = (T_VBVMR_IsParametersDirty)loader_symbol(dll.module, "VBVMR_IsParametersDirty");
+    vmr->VBVMR_GetParameterFloat = (T_VBVMR_GetParameterFloat)loader_symbol(dll.module, "VBVMR_GetParameterFloat");
+    vmr->VBVMR_GetParameterStringW = (T_VBVMR_GetParameterStringW)loader_symbol(dll.module, "VBVMR_GetParameterStringW");
+
+    vmr->VBVMR_SetParameterFloat = (T_VBVMR_SetParameterFloat)loader_symbol(dll.module, "VBVMR_SetParameterFloat");
+    vmr->VBVMR_SetParameters = (T_VBVMR_SetParameters)loader_symbol(dll.module, "VBVMR_SetParameters");
+    vmr->VBVMR_SetParametersW = (T_VBVMR_SetParametersW)loader_symbol(dll.module, "VBVMR_SetParametersW");
+    vmr->VBVMR_SetParameterStringA = (T_VBVMR_SetParameterStringA)loader_symbol(dll.module, "VBVMR_SetParameterStringA");
+    vmr->VBVMR_SetParameterStringW = (T_VBVMR_SetParameterStringW)loader_symbol(dll.module, "VBVMR_SetParameterStringW");
+
+    // The rest are bound on first use
+    vmr->VBVMR_GetParameterStringA = lazy_VBVMR_GetParameterStringA;
+    vmr->VBVMR_GetLevel = lazy_VBVMR_GetLevel;
+    vmr->VBVMR_GetMidiMessage = lazy_VBVMR_GetMidiMessage;
+    vmr->VBVMR_SendMidiMessage = lazy_VBVMR_SendMidiMessage;
+
+    vmr->VBVMR_Output_GetDeviceNumber = lazy_VBVMR_Output_GetDeviceNumber;
+    vmr->VBVMR_Output_GetDeviceDescA = lazy_VBVMR_Output_GetDeviceDescA;
+    vmr->VBVMR_Output_GetDeviceDescW = lazy_VBVMR_Output_GetDeviceDescW;
+    vmr->VBVMR_Input_GetDeviceNumber = lazy_VBVMR_Input_GetDeviceNumber;
+    vmr->VBVMR_Input_GetDeviceDescA = lazy_VBVMR_Input_GetDeviceDescA;
+    vmr->VBVMR_Input_GetDeviceDescW = lazy_VBVMR_Input_GetDeviceDescW;
+
+    vmr->VBVMR_AudioCallbackRegister = lazy_VBVMR_AudioCallbackRegister;
+    vmr->VBVMR_AudioCallbackStart = lazy_VBVMR_AudioCallbackStart;
+    vmr->VBVMR_AudioCallbackStop = lazy_VBVMR_AudioCallbackStop;
+    vmr->VBVMR_AudioCallbackUnregister = lazy_VBVMR_AudioCallbackUnregister;
+
+    vmr->VBVMR_MacroButton_IsDirty = lazy_VBVMR_MacroButton_IsDirty;
+    vmr->VBVMR_MacroButton_GetStatus = lazy_VBVMR_MacroButton_GetStatus;
+    vmr->VBVMR_MacroButton_SetStatus = lazy_VBVMR_MacroButton_SetStatus;
 
     // check pointers are valid
     if (vmr->VBVMR_Login == NULL)
@@ -141,12 +224,8 @@ static long initialize_dll_interfaces(PT_VMR vmr)
         return -6;
     if (vmr->VBVMR_GetParameterFloat == NULL)
         return -7;
-    if (vmr->VBVMR_GetParameterStringA == NULL)
-        return -8;
     if (vmr->VBVMR_GetParameterStringW == NULL)
         return -9;
-    if (vmr->VBVMR_GetLevel == NULL)
-        return -10;
     if (vmr->VBVMR_SetParameterFloat == NULL)
         return -11;
     if (vmr->VBVMR_SetParameters == NULL)
@@ -157,32 +236,40 @@ static long initialize_dll_interfaces(PT_VMR vmr)
         return -14;
     if (vmr->VBVMR_SetParameterStringW == NULL)
         return -15;
-    if (vmr->VBVMR_GetMidiMessage == NULL)
-        return -16;
-
-    if (vmr->VBVMR_Output_GetDeviceNumber == NULL)
-        return -30;
-    if (vmr->VBVMR_Output_GetDeviceDescA == NULL)
-        return -31;
-    if (vmr->VBVMR_Output_GetDeviceDescW == NULL)
-        return -32;
-    if (vmr->VBVMR_Input_GetDeviceNumber == NULL)
-        return -33;
-    if (vmr->VBVMR_Input_GetDeviceDescA == NULL)
-        return -34;
-    if (vmr->VBVMR_Input_GetDeviceDescW == NULL)
-        return -35;
-
-    if (vmr->VBVMR_MacroButton_IsDirty == NULL)
-        return -36;
-    if (vmr->VBVMR_MacroButton_GetStatus == NULL)
-        return -37;
-    if (vmr->VBVMR_MacroButton_SetStatus == NULL)
-        return -38;
 
     return 0;
 }
 
+/**
+ * @brief Find the remote API library
+ *
+ * @param dll_path An explicit path, or NULL
+ * @param dll_fullpath Buffer of DLL_FULLPATH_SZ chars receiving the path
+ * @return true A path was found
+ * @return false Voicemeeter is not installed and no path was given
+ */
+static bool resolve_dll_path(const char *dll_path, char *dll_fullpath)
+{
+    if (dll_path == NULL || *dll_path == '\0')
+        dll_path = getenv(DLL_ENV);
+    if (dll_path != NULL && *dll_path != '\0')
+    {
+        snprintf(dll_fullpath, DLL_FULLPATH_SZ, "%s", dll_path);
+        return true;
+    }
+
+    // get Voicemeeter installation directory
+    if (!registry_get_voicemeeter_folder(dll_fullpath))
+        return false;
+
+    // use right dll according to O/S type
+    if (IS_64_BIT)
+        strncat(dll_fullpath, DLL64_NAME, DLL_FULLPATH_SZ - strlen(dll_fullpath) - 1);
+    else
+        strncat(dll_fullpath, DLL32_NAME, DLL_FULLPATH_SZ - strlen(dll_fullpath) - 1);
+    return true;
+}
+
 /*******************************************************************************/
 /**                           GET VOICEMEETER DIRECTORY                       **/
 /*******************************************************************************/
@@ -231,4 +318,4 @@ static bool registry_get_voicemeeter_folder(char *dll_fullpath)
     snprintf(dll_fullpath, DLL_FULLPATH_SZ, uninstall_path);
 
     return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,199 @@
+/**
+ * @file jobs.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for running input lines later, once or repeatedly.
+ * Each job is a timer on the scheduler's wheel, so adding one and running it
+ * costs the same however many are pending. Jobs run on the scheduler thread,
+ * the line reading input is never blocked by them.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jobs.h"
+#include "log.h"
+
+#define WAIT_POLL_MS 10
+
+/**
+ * @brief Take a job out of the store and free it, the job's timer must already be gone.
+ */
+static void remove_job(struct jobs *j, struct job *job)
+{
+    struct job *last = j->items[--j->count];
+    j->items[job->index] = last;
+    last->index = job->index;
+    if (!job->repeat)
+        j->num_once--;
+
+    free(job->line);
+    free(job);
+}
+
+/**
+ * @brief Run a job's line, runs on the scheduler thread.
+ */
+static void fire(void *udata, long long deadline_us)
+{
+    (void)deadline_us;
+    struct job *job = udata;
+    struct jobs *j = job->owner;
+
+    /* the line is tokenised in place and may cancel its own job, so run a copy */
+    char *line = malloc(strlen(job->line) + 1);
+    if (line == NULL)
+    {
+        log_error("Failed to allocate memory for job %u", job->id);
+        /* a one shot job is dropped all the same, jobs_wait() must not wait for it */
+        if (!job->repeat)
+            remove_job(j, job);
+        return;
+    }
+    strcpy(line, job->line);
+    log_debug("Running job %u: %s", job->id, line);
+
+    if (!job->repeat)
+        remove_job(j, job);
+    j->run(j->udata, line);
+    free(line);
+}
+
+/**
+ * @brief Initialize an empty job store
+ *
+ * @param j Pointer to the job store
+ * @param sched The scheduler that runs the jobs, its lock guards the store
+ * @param run Called to run each job's line
+ * @param udata Passed to run
+ */
+void jobs_init(struct jobs *j, struct sched *sched, job_fn run, void *udata)
+{
+    *j = (struct jobs){.sched = sched, .run = run, .udata = udata};
+}
+
+/**
+ * @brief Schedule a line to run after a delay, and again every delay after that if it repeats.
+ * The caller must hold the scheduler lock.
+ *
+ * @param j Pointer to the job store
+ * @param delay_us Time until the line first runs, also the period of a repeating job
+ * @param repeat Run the line repeatedly until the job is cancelled
+ * @param line The input line to run
+ * @return uint32_t The id of the job, 0 if it could not be scheduled
+ */
+uint32_t jobs_add(struct jobs *j, long long delay_us, bool repeat, const char *line)
+{
+    if (j->count == j->cap)
+    {
+        size_t cap = j->cap ? j->cap * 2 : 16;
+        struct job **items = realloc(j->items, cap * sizeof(struct job *));
+        if (items == NULL)
+            return 0;
+        j->items = items;
+        j->cap = cap;
+    }
+
+    struct job *job = malloc(sizeof(struct job));
+    char *copy = malloc(strlen(line) + 1);
+    if (job == NULL || copy == NULL)
+    {
+        free(job);
+        free(copy);
+        return 0;
+    }
+    strcpy(copy, line);
+    *job = (struct job){.line = copy, .repeat = repeat, .index = j->count, .owner = j};
+
+    job->id = sched_add(j->sched, delay_us, repeat ? delay_us : 0, fire, job);
+    if (job->id == 0)
+    {
+        free(copy);
+        free(job);
+        return 0;
+    }
+    j->items[j->count++] = job;
+    if (!repeat)
+        j->num_once++;
+    return job->id;
+}
+
+/**
+ * @brief Cancel a pending job.
+ * The caller must hold the scheduler lock.
+ *
+ * @param j Pointer to the job store
+ * @param id The id returned by jobs_add
+ * @return true The job was cancelled
+ * @return false No job with that id is pending
+ */
+bool jobs_cancel(struct jobs *j, uint32_t id)
+{
+    for (size_t i = 0; i < j->count; i++)
+    {
+        if (j->items[i]->id == id)
+        {
+            sched_cancel(j->sched, id);
+            remove_job(j, j->items[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Cancel every pending job.
+ * The caller must hold the scheduler lock.
+ *
+ * @param j Pointer to the job store
+ * @return size_t Number of jobs cancelled
+ */
+size_t jobs_cancel_all(struct jobs *j)
+{
+    size_t n = j->count;
+    while (j->count > 0)
+    {
+        sched_cancel(j->sched, j->items[j->count - 1]->id);
+        remove_job(j, j->items[j->count - 1]);
+    }
+    return n;
+}
+
+/**
+ * @brief Block until every job that runs once has run, repeating jobs are not waited for.
+ * Must be called without holding the scheduler lock.
+ *
+ * @param j Pointer to the job store
+ */
+void jobs_wait(struct jobs *j)
+{
+    for (;;)
+    {
+        sched_lock(j->sched);
+        size_t n = j->num_once;
+        sched_unlock(j->sched);
+        if (n == 0)
+            break;
+        Sleep(WAIT_POLL_MS);
+    }
+}
+
+/**
+ * @brief Free the job store, the scheduler must have been stopped first
+ *
+ * @param j Pointer to the job store
+ */
+void jobs_free(struct jobs *j)
+{
+    for (size_t i = 0; i < j->count; i++)
+    {
+        free(j->items[i]->line);
+        free(j->items[i]);
+    }
+    free(j->items);
+    *j = (struct jobs){0};
+}
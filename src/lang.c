@@ -0,0 +1,1070 @@
+/**
+ * @file lang.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief A small language for scripts and interactive input.
+ *
+ * Statements, one per line:
+ * | let <name> = <expr>                 | Assign a variable                      |
+ * | print <text>                        | Print a line                           |
+ * | if <expr> / elif <expr> / else / end | Run lines conditionally               |
+ * | for <name> in <a>..<b> ... end      | Loop over an inclusive range           |
+ * | for <name> in strips|buses ... end  | Loop over every strip or bus           |
+ * Any other line is an input line, $name and $(expr) in it are replaced by their values.
+ * Expressions take numbers, variables, parameters such as strip[i].gain (which are
+ * read from the engine), + - * / %, comparisons, && || ! and parentheses.
+ *
+ * A statement, or a whole if or for block once its end arrives, is compiled into
+ * bytecode for a small stack machine and run at once. Loops run their bytecode again
+ * rather than parsing their lines again. Lines that use none of this are left to the
+ * caller, so plain scripts run exactly as they always have.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include "lang.h"
+#include "util.h"
+#include "log.h"
+
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#define LINE_SZ 4096 /* Longest line, after interpolation */
+#define NAME_SZ 256  /* Longest parameter or variable name */
+#define STACK_SZ 64
+#define MAX_BRANCHES 64 /* elif branches of one if */
+#define HOLE '\x01'     /* Marks where a value goes in a template */
+
+/**
+ * @enum The instructions of the stack machine
+ */
+enum ins_op : int
+{
+    INS_PUSH,  /* Push num */
+    INS_LOAD,  /* Push variable arg */
+    INS_STORE, /* Pop into variable arg */
+    INS_READ,  /* Pop n indices into template arg, push the parameter it names */
+    INS_EXEC,  /* Pop n values into template arg, run it as an input line */
+    INS_PRINT, /* Pop n values into template arg, print it */
+    INS_ADD,
+    INS_SUB,
+    INS_MUL,
+    INS_DIV,
+    INS_MOD,
+    INS_NEG,
+    INS_EQ,
+    INS_NE,
+    INS_LT,
+    INS_LE,
+    INS_GT,
+    INS_GE,
+    INS_AND,
+    INS_OR,
+    INS_NOT,
+    INS_JMP, /* Continue at arg */
+    INS_JZ,  /* Pop, continue at arg if zero */
+};
+
+struct insn
+{
+    enum ins_op op;
+    int line_no;
+    double num;
+    size_t arg;
+    int n;
+};
+
+/**
+ * @struct Compiled bytecode and the templates it refers to
+ */
+struct program
+{
+    struct insn *code;
+    size_t count;
+    size_t cap;
+    char **strings;
+    size_t num_strings;
+    size_t strings_cap;
+};
+
+/**
+ * @struct The state of compiling one statement or block
+ */
+struct compiler
+{
+    struct lang *l;
+    struct program *p;
+    const struct lang_line *lines;
+    size_t num_lines;
+    size_t i;        /* The next line */
+    int line_no;     /* The line being compiled, for errors */
+    const char *s;   /* Position within the expression being compiled */
+    int loop_depth;
+    bool failed;
+};
+
+enum keyword : int
+{
+    KW_NONE = -1,
+    KW_LET,
+    KW_PRINT,
+    KW_IF,
+    KW_ELIF,
+    KW_ELSE,
+    KW_END,
+    KW_FOR,
+};
+
+static const char *keywords[] = {
+    [KW_LET] = "let",
+    [KW_PRINT] = "print",
+    [KW_IF] = "if",
+    [KW_ELIF] = "elif",
+    [KW_ELSE] = "else",
+    [KW_END] = "end",
+    [KW_FOR] = "for",
+};
+
+static bool is_ident_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/**
+ * @brief Find the keyword a line begins with
+ *
+ * @param line The line
+ * @param rest Receives the rest of the line after the keyword and any whitespace
+ * @return enum keyword The keyword, KW_NONE if the line does not begin with one
+ */
+static enum keyword keyword(const char *line, const char **rest)
+{
+    line += strspn(line, " \t");
+    for (size_t i = 0; i < COUNT_OF(keywords); i++)
+    {
+        size_t n = strlen(keywords[i]);
+        if (strncasecmp(line, keywords[i], n) == 0 && (line[n] == '\0' || isspace((unsigned char)line[n])))
+        {
+            *rest = line + n + strspn(line + n, " \t\r\n");
+            return (enum keyword)i;
+        }
+    }
+    return KW_NONE;
+}
+
+static long find_var(const struct lang *l, const char *name)
+{
+    for (size_t i = 0; i < l->num_vars; i++)
+    {
+        if (strcmp(l->vars[i].name, name) == 0)
+            return (long)i;
+    }
+    return -1;
+}
+
+static long declare_var(struct lang *l, const char *name)
+{
+    long slot = find_var(l, name);
+    if (slot >= 0)
+        return slot;
+
+    if (l->num_vars == l->vars_cap)
+    {
+        size_t cap = l->vars_cap ? l->vars_cap * 2 : 16;
+        struct lang_var *vars = realloc(l->vars, cap * sizeof(struct lang_var));
+        if (vars == NULL)
+            return -1;
+        l->vars = vars;
+        l->vars_cap = cap;
+    }
+    char *copy = malloc(strlen(name) + 1);
+    if (copy == NULL)
+        return -1;
+    strcpy(copy, name);
+    l->vars[l->num_vars] = (struct lang_var){.name = copy};
+    return (long)l->num_vars++;
+}
+
+/**
+ * @brief Does the line use $name of a known variable or $(expr)
+ */
+static bool has_interpolation(const struct lang *l, const char *line)
+{
+    for (const char *p = strchr(line, '$'); p != NULL; p = strchr(p + 1, '$'))
+    {
+        if (p[1] == '(' || p[1] == '$')
+            return true;
+
+        char name[NAME_SZ];
+        size_t n = 0;
+        for (const char *q = p + 1; is_ident_char(*q) && n < NAME_SZ - 1; q++)
+            name[n++] = *q;
+        name[n] = '\0';
+        if (n > 0 && find_var(l, name) >= 0)
+            return true;
+    }
+    return false;
+}
+
+static void program_free(struct program *p)
+{
+    for (size_t i = 0; i < p->num_strings; i++)
+        free(p->strings[i]);
+    free(p->strings);
+    free(p->code);
+    *p = (struct program){0};
+}
+
+/* Compiler */
+
+static void fail(struct compiler *c, const char *msg)
+{
+    if (!c->failed)
+        log_error("line %d: %s", c->line_no, msg);
+    c->failed = true;
+}
+
+static size_t emit(struct compiler *c, enum ins_op op, double num, size_t arg, int n)
+{
+    struct program *p = c->p;
+    if (p->count == p->cap)
+    {
+        size_t cap = p->cap ? p->cap * 2 : 64;
+        struct insn *code = realloc(p->code, cap * sizeof(struct insn));
+        if (code == NULL)
+        {
+            fail(c, "out of memory");
+            return 0;
+        }
+        p->code = code;
+        p->cap = cap;
+    }
+    p->code[p->count] = (struct insn){.op = op, .line_no = c->line_no, .num = num, .arg = arg, .n = n};
+    return p->count++;
+}
+
+static void patch(struct compiler *c, size_t at)
+{
+    if (!c->failed)
+        c->p->code[at].arg = c->p->count;
+}
+
+static size_t add_string(struct compiler *c, const char *s)
+{
+    struct program *p = c->p;
+    if (p->num_strings == p->strings_cap)
+    {
+        size_t cap = p->strings_cap ? p->strings_cap * 2 : 16;
+        char **strings = realloc(p->strings, cap * sizeof(char *));
+        if (strings == NULL)
+        {
+            fail(c, "out of memory");
+            return 0;
+        }
+        p->strings = strings;
+        p->strings_cap = cap;
+    }
+    char *copy = malloc(strlen(s) + 1);
+    if (copy == NULL)
+    {
+        fail(c, "out of memory");
+        return 0;
+    }
+    strcpy(copy, s);
+    p->strings[p->num_strings] = copy;
+    return p->num_strings++;
+}
+
+static void skip_space(struct compiler *c)
+{
+    c->s += strspn(c->s, " \t\r\n");
+}
+
+static bool accept(struct compiler *c, const char *tok)
+{
+    skip_space(c);
+    size_t n = strlen(tok);
+    if (strncmp(c->s, tok, n) != 0)
+        return false;
+    c->s += n;
+    return true;
+}
+
+static bool read_ident(struct compiler *c, char *name)
+{
+    size_t n = 0;
+    while (is_ident_char(*c->s))
+    {
+        if (n == NAME_SZ - 1)
+        {
+            fail(c, "name too long");
+            return false;
+        }
+        name[n++] = *c->s++;
+    }
+    name[n] = '\0';
+    return n > 0;
+}
+
+static void expr(struct compiler *c);
+
+/**
+ * @brief Compile a parameter read such as strip[i].gain or bus[0].eq.channel[j].cell[0].gain.
+ * Literal indices are kept in the name, the rest are left as holes filled at run time.
+ */
+static void param_ref(struct compiler *c, const char *first)
+{
+    char tmpl[NAME_SZ];
+    size_t len = strlen(first);
+    int holes = 0;
+    memcpy(tmpl, first, len + 1);
+
+    while (!c->failed && len < NAME_SZ - 4)
+    {
+        if (*c->s == '[')
+        {
+            c->s++;
+            skip_space(c);
+            size_t digits = strspn(c->s, "0123456789");
+            const char *after = c->s + digits;
+            after += strspn(after, " \t");
+            if (digits > 0 && *after == ']' && len + digits + 2 < NAME_SZ)
+            {
+                len += (size_t)snprintf(tmpl + len, NAME_SZ - len, "[%.*s]", (int)digits, c->s);
+                c->s = after + 1;
+                continue;
+            }
+            expr(c);
+            if (!accept(c, "]"))
+            {
+                fail(c, "expected ']'");
+                return;
+            }
+            tmpl[len++] = '[';
+            tmpl[len++] = HOLE;
+            tmpl[len++] = ']';
+            tmpl[len] = '\0';
+            holes++;
+        }
+        else if (*c->s == '.' && is_ident_start(c->s[1]))
+        {
+            char name[NAME_SZ];
+            c->s++;
+            read_ident(c, name);
+            if (len + strlen(name) + 1 >= NAME_SZ)
+                break;
+            len += (size_t)snprintf(tmpl + len, NAME_SZ - len, ".%s", name);
+        }
+        else
+        {
+            emit(c, INS_READ, 0, add_string(c, tmpl), holes);
+            return;
+        }
+    }
+    fail(c, "parameter name too long");
+}
+
+static void primary(struct compiler *c)
+{
+    skip_space(c);
+    if (accept(c, "("))
+    {
+        expr(c);
+        if (!accept(c, ")"))
+            fail(c, "expected ')'");
+        return;
+    }
+    if (isdigit((unsigned char)*c->s) || (*c->s == '.' && isdigit((unsigned char)c->s[1])))
+    {
+        char *end;
+        double num = strtod(c->s, &end);
+        c->s = end;
+        emit(c, INS_PUSH, num, 0, 0);
+        return;
+    }
+    if (*c->s == '$')
+        c->s++;
+    if (is_ident_start(*c->s))
+    {
+        char name[NAME_SZ];
+        if (!read_ident(c, name))
+            return;
+        if (*c->s == '[' || *c->s == '.')
+        {
+            param_ref(c, name);
+            return;
+        }
+        long slot = find_var(c->l, name);
+        if (slot < 0)
+        {
+            char msg[NAME_SZ + 32];
+            snprintf(msg, sizeof(msg), "unknown variable '%s'", name);
+            fail(c, msg);
+            return;
+        }
+        emit(c, INS_LOAD, 0, (size_t)slot, 0);
+        return;
+    }
+    fail(c, "expected a number, variable or parameter");
+}
+
+static void unary(struct compiler *c)
+{
+    if (accept(c, "-"))
+    {
+        unary(c);
+        emit(c, INS_NEG, 0, 0, 0);
+    }
+    else if (accept(c, "!"))
+    {
+        unary(c);
+        emit(c, INS_NOT, 0, 0, 0);
+    }
+    else
+    {
+        primary(c);
+    }
+}
+
+static void term(struct compiler *c)
+{
+    unary(c);
+    while (!c->failed)
+    {
+        if (accept(c, "*"))
+            unary(c), emit(c, INS_MUL, 0, 0, 0);
+        else if (accept(c, "/"))
+            unary(c), emit(c, INS_DIV, 0, 0, 0);
+        else if (accept(c, "%"))
+            unary(c), emit(c, INS_MOD, 0, 0, 0);
+        else
+            break;
+    }
+}
+
+static void sum(struct compiler *c)
+{
+    term(c);
+    while (!c->failed)
+    {
+        if (accept(c, "+"))
+            term(c), emit(c, INS_ADD, 0, 0, 0);
+        else if (accept(c, "-"))
+            term(c), emit(c, INS_SUB, 0, 0, 0);
+        else
+            break;
+    }
+}
+
+static void comparison(struct compiler *c)
+{
+    static const struct
+    {
+        const char *tok;
+        enum ins_op op;
+    } ops[] = {
+        {"==", INS_EQ}, {"!=", INS_NE}, {"<=", INS_LE}, {">=", INS_GE}, {"<", INS_LT}, {">", INS_GT},
+    };
+
+    sum(c);
+    for (size_t i = 0; i < COUNT_OF(ops) && !c->failed; i++)
+    {
+        if (accept(c, ops[i].tok))
+        {
+            sum(c);
+            emit(c, ops[i].op, 0, 0, 0);
+            return;
+        }
+    }
+}
+
+static void conjunction(struct compiler *c)
+{
+    comparison(c);
+    while (!c->failed && accept(c, "&&"))
+    {
+        comparison(c);
+        emit(c, INS_AND, 0, 0, 0);
+    }
+}
+
+static void expr(struct compiler *c)
+{
+    conjunction(c);
+    while (!c->failed && accept(c, "||"))
+    {
+        conjunction(c);
+        emit(c, INS_OR, 0, 0, 0);
+    }
+}
+
+/**
+ * @brief Compile the whole of text as one expression
+ */
+static void expr_text(struct compiler *c, const char *text)
+{
+    const char *saved = c->s;
+    c->s = text;
+    expr(c);
+    skip_space(c);
+    if (*c->s != '\0')
+        fail(c, "unexpected text after expression");
+    c->s = saved;
+}
+
+/**
+ * @brief Compile a line containing $name and $(expr) into a template and the code for its values.
+ * $$ stands for a literal $, a $name that is not a variable is left as it is.
+ *
+ * @return size_t Index of the template, the number of holes is written to holes
+ */
+static size_t template(struct compiler *c, const char *text, int *holes)
+{
+    char out[LINE_SZ];
+    size_t len = 0;
+    *holes = 0;
+
+    for (const char *p = text; *p != '\0' && !c->failed;)
+    {
+        if (len >= LINE_SZ - 2)
+        {
+            fail(c, "line too long");
+            break;
+        }
+        if (p[0] == '$' && p[1] == '$')
+        {
+            out[len++] = '$';
+            p += 2;
+            continue;
+        }
+        if (p[0] == '$' && p[1] == '(')
+        {
+            const char *end = p + 2;
+            for (int depth = 1; *end != '\0'; end++)
+            {
+                if (*end == '(')
+                    depth++;
+                else if (*end == ')' && --depth == 0)
+                    break;
+            }
+            if (*end == '\0')
+            {
+                fail(c, "unterminated $(");
+                break;
+            }
+            char inner[LINE_SZ];
+            snprintf(inner, sizeof(inner), "%.*s", (int)(end - p - 2), p + 2);
+            expr_text(c, inner);
+            out[len++] = HOLE;
+            (*holes)++;
+            p = end + 1;
+            continue;
+        }
+        if (p[0] == '$' && is_ident_start(p[1]))
+        {
+            char name[NAME_SZ];
+            size_t n = 0;
+            const char *q = p + 1;
+            while (is_ident_char(*q) && n < NAME_SZ - 1)
+                name[n++] = *q++;
+            name[n] = '\0';
+            long slot = find_var(c->l, name);
+            if (slot >= 0)
+            {
+                emit(c, INS_LOAD, 0, (size_t)slot, 0);
+                out[len++] = HOLE;
+                (*holes)++;
+                p = q;
+                continue;
+            }
+        }
+        out[len++] = *p++;
+    }
+    out[len] = '\0';
+    return add_string(c, out);
+}
+
+static enum keyword body(struct compiler *c);
+
+static void let_statement(struct compiler *c, const char *rest)
+{
+    char name[NAME_SZ];
+    c->s = rest;
+    if (!read_ident(c, name) || !accept(c, "=") || *c->s == '=')
+    {
+        fail(c, "expected let <name> = <expression>");
+        return;
+    }
+    expr_text(c, c->s);
+    long slot = declare_var(c->l, name);
+    if (slot < 0)
+    {
+        fail(c, "out of memory");
+        return;
+    }
+    emit(c, INS_STORE, 0, (size_t)slot, 0);
+}
+
+static void if_statement(struct compiler *c, const char *rest)
+{
+    size_t exits[MAX_BRANCHES];
+    size_t num_exits = 0;
+
+    expr_text(c, rest);
+    size_t jz = emit(c, INS_JZ, 0, 0, 0);
+    for (;;)
+    {
+        enum keyword kw = body(c);
+        if (c->failed)
+            return;
+        if (kw == KW_NONE)
+        {
+            fail(c, "if without end");
+            return;
+        }
+
+        const char *branch;
+        keyword(c->lines[c->i].text, &branch);
+        c->line_no = c->lines[c->i].line_no;
+        c->i++;
+        if (kw == KW_END)
+        {
+            patch(c, jz);
+            break;
+        }
+        if (num_exits == MAX_BRANCHES)
+        {
+            fail(c, "too many elif branches");
+            return;
+        }
+        exits[num_exits++] = emit(c, INS_JMP, 0, 0, 0);
+        patch(c, jz);
+        if (kw == KW_ELIF)
+        {
+            expr_text(c, branch);
+            jz = emit(c, INS_JZ, 0, 0, 0);
+            continue;
+        }
+
+        /* else, the only way on is end */
+        if (*branch != '\0')
+        {
+            fail(c, "unexpected text after else");
+            return;
+        }
+        if (body(c) != KW_END)
+        {
+            fail(c, "expected end after else");
+            return;
+        }
+        c->i++;
+        break;
+    }
+    for (size_t i = 0; i < num_exits; i++)
+        patch(c, exits[i]);
+}
+
+static void for_statement(struct compiler *c, const char *rest)
+{
+    char name[NAME_SZ];
+    char bound[LINE_SZ];
+
+    c->s = rest;
+    if (!read_ident(c, name) || !accept(c, "in"))
+    {
+        fail(c, "expected for <name> in <from>..<to>, strips or buses");
+        return;
+    }
+    skip_space(c);
+
+    long slot = declare_var(c->l, name);
+    snprintf(bound, sizeof(bound), "#for%d", c->loop_depth);
+    long end_slot = declare_var(c->l, bound);
+    if (slot < 0 || end_slot < 0)
+    {
+        fail(c, "out of memory");
+        return;
+    }
+
+    if (strcasecmp(c->s, "strips") == 0 || strcasecmp(c->s, "buses") == 0)
+    {
+        int count = tolower((unsigned char)c->s[0]) == 's' ? c->l->host.num_strips : c->l->host.num_buses;
+        emit(c, INS_PUSH, 0, 0, 0);
+        emit(c, INS_STORE, 0, (size_t)slot, 0);
+        emit(c, INS_PUSH, count - 1, 0, 0);
+    }
+    else
+    {
+        const char *dots = strstr(c->s, "..");
+        if (dots == NULL)
+        {
+            fail(c, "expected a range such as 0..4");
+            return;
+        }
+        snprintf(bound, sizeof(bound), "%.*s", (int)(dots - c->s), c->s);
+        expr_text(c, bound);
+        emit(c, INS_STORE, 0, (size_t)slot, 0);
+        expr_text(c, dots + 2);
+    }
+    emit(c, INS_STORE, 0, (size_t)end_slot, 0);
+
+    size_t top = emit(c, INS_LOAD, 0, (size_t)slot, 0);
+    emit(c, INS_LOAD, 0, (size_t)end_slot, 0);
+    emit(c, INS_LE, 0, 0, 0);
+    size_t jz = emit(c, INS_JZ, 0, 0, 0);
+
+    c->loop_depth++;
+    enum keyword kw = body(c);
+    c->loop_depth--;
+    if (kw != KW_END)
+    {
+        fail(c, kw == KW_NONE ? "for without end" : "else or elif inside for without if");
+        return;
+    }
+    c->line_no = c->lines[c->i].line_no;
+    c->i++;
+
+    emit(c, INS_LOAD, 0, (size_t)slot, 0);
+    emit(c, INS_PUSH, 1, 0, 0);
+    emit(c, INS_ADD, 0, 0, 0);
+    emit(c, INS_STORE, 0, (size_t)slot, 0);
+    emit(c, INS_JMP, 0, top, 0);
+    patch(c, jz);
+}
+
+/**
+ * @brief Compile statements until a line beginning with elif, else or end, which is not consumed.
+ *
+ * @return enum keyword The keyword that ended the body, KW_NONE if the lines ran out
+ */
+static enum keyword body(struct compiler *c)
+{
+    while (c->i < c->num_lines && !c->failed)
+    {
+        const struct lang_line *line = &c->lines[c->i];
+        const char *rest;
+        enum keyword kw = keyword(line->text, &rest);
+        if (kw == KW_ELIF || kw == KW_ELSE || kw == KW_END)
+            return kw;
+
+        c->line_no = line->line_no;
+        c->i++;
+        int holes;
+        switch (kw)
+        {
+        case KW_LET:
+            let_statement(c, rest);
+            break;
+        case KW_PRINT:
+        {
+            size_t s = template(c, rest, &holes);
+            emit(c, INS_PRINT, 0, s, holes);
+            break;
+        }
+        case KW_IF:
+            if_statement(c, rest);
+            break;
+        case KW_FOR:
+            for_statement(c, rest);
+            break;
+        default:
+        {
+            size_t s = template(c, line->text, &holes);
+            emit(c, INS_EXEC, 0, s, holes);
+            break;
+        }
+        }
+    }
+    return KW_NONE;
+}
+
+/* Stack machine */
+
+/**
+ * @brief Write a template out with its holes filled by values
+ */
+static bool fill(const char *tmpl, const double *values, char *out, size_t max)
+{
+    size_t len = 0;
+    for (const char *p = tmpl; *p != '\0'; p++)
+    {
+        int n = *p == HOLE ? snprintf(out + len, max - len, "%g", *values++)
+                           : snprintf(out + len, max - len, "%c", *p);
+        if (n < 0 || (size_t)n >= max - len)
+            return false;
+        len += (size_t)n;
+    }
+    out[len] = '\0';
+    return true;
+}
+
+static bool runtime_error(const struct insn *in, const char *msg, const char *detail)
+{
+    log_error("line %d: %s%s", in->line_no, msg, detail);
+    return false;
+}
+
+static bool run(struct lang *l, const struct program *p)
+{
+    double stack[STACK_SZ];
+    size_t sp = 0;
+    bool wrote = true; /* sync before the first read, earlier input may still be in flight */
+    char line[LINE_SZ];
+
+    for (size_t pc = 0; pc < p->count; pc++)
+    {
+        const struct insn *in = &p->code[pc];
+        if (sp + 1 >= STACK_SZ)
+            return runtime_error(in, "expression too deep", "");
+
+        double b = sp > 0 ? stack[sp - 1] : 0;
+        double a = sp > 1 ? stack[sp - 2] : 0;
+        switch (in->op)
+        {
+        case INS_PUSH:
+            stack[sp++] = in->num;
+            break;
+        case INS_LOAD:
+            stack[sp++] = l->vars[in->arg].value;
+            break;
+        case INS_STORE:
+            l->vars[in->arg].value = stack[--sp];
+            break;
+        case INS_READ:
+        {
+            float f;
+            sp -= (size_t)in->n;
+            if (!fill(p->strings[in->arg], &stack[sp], line, NAME_SZ))
+                return runtime_error(in, "parameter name too long", "");
+            if (!l->host.read(l->host.udata, line, wrote, &f))
+                return runtime_error(in, "could not read ", line);
+            wrote = false;
+            stack[sp++] = f;
+            break;
+        }
+        case INS_EXEC:
+        case INS_PRINT:
+            sp -= (size_t)in->n;
+            if (!fill(p->strings[in->arg], &stack[sp], line, LINE_SZ))
+                return runtime_error(in, "line too long", "");
+            if (in->op == INS_PRINT)
+            {
+                l->host.print(l->host.udata, line);
+                break;
+            }
+            l->host.exec(l->host.udata, line);
+            wrote = true;
+            break;
+        case INS_ADD:
+            stack[--sp - 1] = a + b;
+            break;
+        case INS_SUB:
+            stack[--sp - 1] = a - b;
+            break;
+        case INS_MUL:
+            stack[--sp - 1] = a * b;
+            break;
+        case INS_DIV:
+        case INS_MOD:
+            if (b == 0)
+                return runtime_error(in, "division by zero", "");
+            stack[--sp - 1] = in->op == INS_DIV ? a / b : fmod(a, b);
+            break;
+        case INS_NEG:
+            stack[sp - 1] = -b;
+            break;
+        case INS_EQ:
+            stack[--sp - 1] = a == b;
+            break;
+        case INS_NE:
+            stack[--sp - 1] = a != b;
+            break;
+        case INS_LT:
+            stack[--sp - 1] = a < b;
+            break;
+        case INS_LE:
+            stack[--sp - 1] = a <= b;
+            break;
+        case INS_GT:
+            stack[--sp - 1] = a > b;
+            break;
+        case INS_GE:
+            stack[--sp - 1] = a >= b;
+            break;
+        case INS_AND:
+            stack[--sp - 1] = a != 0 && b != 0;
+            break;
+        case INS_OR:
+            stack[--sp - 1] = a != 0 || b != 0;
+            break;
+        case INS_NOT:
+            stack[sp - 1] = b == 0;
+            break;
+        case INS_JMP:
+            pc = in->arg - 1;
+            break;
+        case INS_JZ:
+            if (stack[--sp] == 0)
+                pc = in->arg - 1;
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Compile the lines collected so far as one statement or block and run it
+ */
+static void compile_and_run(struct lang *l)
+{
+    struct program p = {0};
+    struct compiler c = {.l = l, .p = &p, .lines = l->block, .num_lines = l->block_len};
+
+    enum keyword kw = body(&c);
+    if (!c.failed && kw != KW_NONE)
+    {
+        c.line_no = l->block[c.i].line_no;
+        fail(&c, "elif, else or end without if or for");
+    }
+    if (!c.failed)
+    {
+        log_debug("Compiled %zu lines into %zu instructions", l->block_len, p.count);
+        run(l, &p);
+    }
+    program_free(&p);
+}
+
+static void clear_block(struct lang *l)
+{
+    for (size_t i = 0; i < l->block_len; i++)
+        free(l->block[i].text);
+    l->block_len = 0;
+    l->depth = 0;
+}
+
+/**
+ * @brief Initialize the language for a new input
+ *
+ * @param l Pointer to the language state
+ * @param host Callbacks and the shape of the running kind
+ */
+void lang_init(struct lang *l, const struct lang_host *host)
+{
+    *l = (struct lang){.host = *host};
+}
+
+/**
+ * @brief Check whether a line would be taken by the language, without any variables defined.
+ * A line with any $ is counted, its interpolation can only be known once it runs.
+ *
+ * @param line The line
+ * @return true The line begins with a keyword or interpolates
+ */
+bool lang_is_statement(const char *line)
+{
+    const char *rest;
+    return keyword(line, &rest) != KW_NONE || strchr(line, '$') != NULL;
+}
+
+/**
+ * @brief Feed the next line of input to the language.
+ * Statements run as soon as they are complete, an if or for block once its end arrives.
+ *
+ * @param l Pointer to the language state
+ * @param line The line
+ * @return enum lang_status Whether the line was taken, see lang.h
+ */
+enum lang_status lang_feed(struct lang *l, const char *line)
+{
+    const char *rest;
+    enum keyword kw = keyword(line, &rest);
+
+    l->line_no++;
+    if (l->depth == 0 && kw == KW_NONE && !has_interpolation(l, line))
+        return LANG_NOT_MINE;
+    if (l->depth > 0 && (is_comment((char *)line) || line[strspn(line, " \t\r\n")] == '\0'))
+        return LANG_PENDING;
+
+    if (l->block_len == l->block_cap)
+    {
+        size_t cap = l->block_cap ? l->block_cap * 2 : 32;
+        struct lang_line *block = realloc(l->block, cap * sizeof(struct lang_line));
+        if (block == NULL)
+        {
+            log_error("line %d: out of memory", l->line_no);
+            clear_block(l);
+            return LANG_DONE;
+        }
+        l->block = block;
+        l->block_cap = cap;
+    }
+    char *copy = malloc(strlen(line) + 1);
+    if (copy == NULL)
+    {
+        log_error("line %d: out of memory", l->line_no);
+        clear_block(l);
+        return LANG_DONE;
+    }
+    strcpy(copy, line);
+    l->block[l->block_len++] = (struct lang_line){.text = copy, .line_no = l->line_no};
+
+    if (kw == KW_IF || kw == KW_FOR)
+        l->depth++;
+    else if (kw == KW_END && l->depth > 0)
+        l->depth--;
+    if (l->depth > 0)
+        return LANG_PENDING;
+
+    compile_and_run(l);
+    clear_block(l);
+    return LANG_DONE;
+}
+
+/**
+ * @brief Is an if or for block waiting for its end
+ *
+ * @param l Pointer to the language state
+ */
+bool lang_pending(const struct lang *l)
+{
+    return l->depth > 0;
+}
+
+/**
+ * @brief Finish the input, a block still waiting for its end is reported and dropped
+ *
+ * @param l Pointer to the language state
+ */
+void lang_finish(struct lang *l)
+{
+    if (l->depth > 0)
+        log_error("line %d: block opened here has no end", l->block[0].line_no);
+    clear_block(l);
+    l->line_no = 0;
+}
+
+/**
+ * @brief Free the language state
+ *
+ * @param l Pointer to the language state
+ */
+void lang_free(struct lang *l)
+{
+    clear_block(l);
+    for (size_t i = 0; i < l->num_vars; i++)
+        free(l->vars[i].name);
+    free(l->vars);
+    free(l->block);
+    *l = (struct lang){0};
+}
@@ -0,0 +1,51 @@
+/**
+ * @file loader.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for loading a shared library and looking up its symbols.
+ * Thin wrappers over LoadLibrary and GetProcAddress, so a stub of the remote
+ * API can be loaded in place of the engine's library.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include "loader.h"
+
+/**
+ * @brief Load a shared library
+ *
+ * @param path Full path to the library
+ * @return void* Handle of the library, NULL if it could not be loaded
+ */
+void *loader_open(const char *path)
+{
+    return LoadLibraryA(path);
+}
+
+/**
+ * @brief Look up a symbol exported by a loaded library
+ *
+ * @param module Handle returned by loader_open
+ * @param name Name of the symbol
+ * @return loader_fn Address of the symbol, NULL if the library does not export it
+ */
+loader_fn loader_symbol(void *module, const char *name)
+{
+    /* void (*)(void) is exempt from -Wcast-function-type, no pragma needed */
+    return (loader_fn)GetProcAddress(module, name);
+}
+
+/**
+ * @brief Describe why the last loader call failed
+ *
+ * @param buf Buffer receiving the description
+ * @param n Size of the buffer
+ */
+void loader_error(char *buf, size_t n)
+{
+    snprintf(buf, n, "error %lu", GetLastError());
+}
@@ -0,0 +1,408 @@
+/**
+ * @file metrics.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for serving the engine's state as Prometheus metrics.
+ * Each snapshot gathered by the publisher is rendered into a complete HTTP
+ * response, headers included, in one of two reused pages. A listener thread
+ * answers every scrape by sending the latest page with a single write, so
+ * any number of scrapers cost the engine nothing beyond the publisher's own
+ * polling, and a slow scraper never holds up the scheduler.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include "net.h"
+#include <windows.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "metrics.h"
+#include "wrapper.h"
+#include "util.h"
+#include "log.h"
+
+#define HEADER_RESERVE 160   /* Bytes kept in front of the exposition for the response headers */
+#define PAGE_INITIAL_SZ 8192 /* Grown as needed, a Potato page is about 12kB */
+#define REQUEST_SZ 1024      /* Only the request line is looked at */
+#define REQUEST_TIMEOUT_MS 1000
+#define KIND_STR_LEN 32
+
+static const char not_found[] = "HTTP/1.1 404 Not Found\r\n"
+                                "Content-Type: text/plain\r\n"
+                                "Content-Length: 10\r\n"
+                                "Connection: close\r\n"
+                                "\r\n"
+                                "Not Found\n";
+
+static const char unavailable[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                  "Content-Type: text/plain\r\n"
+                                  "Content-Length: 12\r\n"
+                                  "Connection: close\r\n"
+                                  "\r\n"
+                                  "Unavailable\n";
+
+/**
+ * @brief Append formatted text to a page, growing it as needed
+ *
+ * @return false Memory could not be allocated
+ */
+static bool append(struct metrics_page *page, const char *fmt, ...)
+{
+    va_list args;
+
+    for (;;)
+    {
+        va_start(args, fmt);
+        int n = vsnprintf(page->text + page->len, page->cap - page->len, fmt, args);
+        va_end(args);
+        if (n < 0)
+            return false;
+        if ((size_t)n < page->cap - page->len)
+        {
+            page->len += (size_t)n;
+            return true;
+        }
+
+        size_t cap = page->cap * 2 > page->len + (size_t)n + 1 ? page->cap * 2 : page->len + (size_t)n + 1;
+        char *text = realloc(page->text, cap);
+        if (text == NULL)
+            return false;
+        page->text = text;
+        page->cap = cap;
+    }
+}
+
+/**
+ * @brief Write a label value escaped as the exposition format requires
+ */
+static void escape_label(const char *s, char *out, size_t n)
+{
+    size_t len = 0;
+
+    for (; *s != '\0' && len + 2 < n; s++)
+    {
+        if (*s == '\\' || *s == '"')
+        {
+            out[len++] = '\\';
+            out[len++] = *s;
+        }
+        else if (*s == '\n')
+        {
+            out[len++] = '\\';
+            out[len++] = 'n';
+        }
+        else
+        {
+            out[len++] = *s;
+        }
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief Append a level as dBFS, silence as -Inf
+ */
+static bool append_level(struct metrics_page *page, const char *what, uint32_t channel, float level)
+{
+    if (level <= 0)
+        return append(page, "vmrcli_%s_level_db{channel=\"%u\"} -Inf\n", what, channel);
+    return append(page, "vmrcli_%s_level_db{channel=\"%u\"} %.1f\n", what, channel, 20 * log10f(level));
+}
+
+/**
+ * @brief Render the exposition of a snapshot into a page, after the space reserved for the headers
+ *
+ * @return false Memory could not be allocated
+ */
+static bool render_exposition(struct metrics_page *page, const struct vmrcli_state *s, long long scrapes)
+{
+    char kind[KIND_STR_LEN] = "Unknown";
+    char label[VMRCLI_STATE_LABEL_SZ * 2];
+    bool ok = true;
+
+    if (s->kind >= BASIC && s->kind <= POTATOX64)
+        kind_as_string(kind, s->kind, sizeof(kind));
+
+    ok = ok && append(page, "# HELP vmrcli_info The kind of Voicemeeter running.\n"
+                            "# TYPE vmrcli_info gauge\n"
+                            "vmrcli_info{kind=\"%s\"} 1\n",
+                      kind);
+
+    ok = ok && append(page, "# HELP vmrcli_strip_label The label of each strip.\n"
+                            "# TYPE vmrcli_strip_label gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_strips; i++)
+    {
+        escape_label(s->strip_label[i], label, sizeof(label));
+        ok = append(page, "vmrcli_strip_label{strip=\"%u\",label=\"%s\"} 1\n", i, label);
+    }
+    ok = ok && append(page, "# HELP vmrcli_strip_gain_db The gain of each strip.\n"
+                            "# TYPE vmrcli_strip_gain_db gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_strips; i++)
+        ok = append(page, "vmrcli_strip_gain_db{strip=\"%u\"} %.1f\n", i, s->strip_gain[i]);
+    ok = ok && append(page, "# HELP vmrcli_strip_mute Whether each strip is muted.\n"
+                            "# TYPE vmrcli_strip_mute gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_strips; i++)
+        ok = append(page, "vmrcli_strip_mute{strip=\"%u\"} %u\n", i, (s->strip_mute >> i) & 1);
+
+    ok = ok && append(page, "# HELP vmrcli_bus_label The label of each bus.\n"
+                            "# TYPE vmrcli_bus_label gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_buses; i++)
+    {
+        escape_label(s->bus_label[i], label, sizeof(label));
+        ok = append(page, "vmrcli_bus_label{bus=\"%u\",label=\"%s\"} 1\n", i, label);
+    }
+    ok = ok && append(page, "# HELP vmrcli_bus_gain_db The gain of each bus.\n"
+                            "# TYPE vmrcli_bus_gain_db gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_buses; i++)
+        ok = append(page, "vmrcli_bus_gain_db{bus=\"%u\"} %.1f\n", i, s->bus_gain[i]);
+    ok = ok && append(page, "# HELP vmrcli_bus_mute Whether each bus is muted.\n"
+                            "# TYPE vmrcli_bus_mute gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_buses; i++)
+        ok = append(page, "vmrcli_bus_mute{bus=\"%u\"} %u\n", i, (s->bus_mute >> i) & 1);
+
+    ok = ok && append(page, "# HELP vmrcli_strip_level_db The peak level of each input channel, post fader.\n"
+                            "# TYPE vmrcli_strip_level_db gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_strip_channels; i++)
+        ok = append_level(page, "strip", i, s->strip_level[i]);
+    ok = ok && append(page, "# HELP vmrcli_bus_level_db The peak level of each output channel.\n"
+                            "# TYPE vmrcli_bus_level_db gauge\n");
+    for (uint32_t i = 0; ok && i < s->num_bus_channels; i++)
+        ok = append_level(page, "bus", i, s->bus_level[i]);
+
+    ok = ok && append(page, "# HELP vmrcli_api_call_duration_seconds Time spent in calls to the remote API.\n"
+                            "# TYPE vmrcli_api_call_duration_seconds summary\n");
+    for (int i = 0; ok && i < API_CALLS; i++)
+    {
+        ok = append(page, "vmrcli_api_call_duration_seconds_sum{call=\"%s\"} %.9f\n"
+                          "vmrcli_api_call_duration_seconds_count{call=\"%s\"} %lld\n",
+                    api_call_names[i], api_stats.total_ns[i] / 1e9, api_call_names[i], api_stats.calls[i]);
+    }
+    ok = ok && append(page, "# HELP vmrcli_api_call_max_seconds The longest call to the remote API.\n"
+                            "# TYPE vmrcli_api_call_max_seconds gauge\n");
+    for (int i = 0; ok && i < API_CALLS; i++)
+        ok = append(page, "vmrcli_api_call_max_seconds{call=\"%s\"} %.9f\n", api_call_names[i], api_stats.max_ns[i] / 1e9);
+
+    ok = ok && append(page, "# HELP vmrcli_snapshots_total Snapshots of the engine's state gathered.\n"
+                            "# TYPE vmrcli_snapshots_total counter\n"
+                            "vmrcli_snapshots_total %llu\n"
+                            "# HELP vmrcli_scrapes_total Scrapes served.\n"
+                            "# TYPE vmrcli_scrapes_total counter\n"
+                            "vmrcli_scrapes_total %lld\n",
+                      (unsigned long long)s->updates, scrapes);
+    return ok;
+}
+
+/**
+ * @brief Render a snapshot into the page not being served and make it the front page.
+ * Called with each snapshot, on the scheduler thread. The snapshot is skipped if
+ * the back page is still being sent, the next one will be rendered in its place.
+ *
+ * @param m Pointer to the metrics
+ * @param s The snapshot
+ */
+void metrics_render(struct metrics *m, const struct vmrcli_state *s)
+{
+    EnterCriticalSection(&m->lock);
+    int back = m->front == 0 ? 1 : 0;
+    bool busy = m->pages[back].readers > 0;
+    long long scrapes = m->scrapes;
+    LeaveCriticalSection(&m->lock);
+    if (busy)
+    {
+        m->skipped++;
+        return;
+    }
+
+    /* only the listener thread touches the front page, the back page is ours until it is swapped in */
+    struct metrics_page *page = &m->pages[back];
+    page->len = HEADER_RESERVE;
+    if (!render_exposition(page, s, scrapes))
+    {
+        log_error("malloc failed to allocate memory");
+        return;
+    }
+
+    char header[HEADER_RESERVE];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: close\r\n"
+                     "\r\n",
+                     page->len - HEADER_RESERVE);
+    page->start = HEADER_RESERVE - (size_t)n;
+    memcpy(page->text + page->start, header, (size_t)n);
+    page->len -= page->start;
+    m->renders++;
+
+    EnterCriticalSection(&m->lock);
+    m->front = back;
+    LeaveCriticalSection(&m->lock);
+}
+
+/**
+ * @brief Read a request and answer it with the front page
+ */
+static void respond(struct metrics *m, SOCKET client)
+{
+    char request[REQUEST_SZ];
+    size_t len = 0;
+
+    net_set_timeout(client, REQUEST_TIMEOUT_MS);
+
+    /* read up to the end of the headers, the request line is all that matters */
+    while (len < sizeof(request) - 1)
+    {
+        int n = recv(client, request + len, (int)(sizeof(request) - 1 - len), 0);
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL)
+            break;
+    }
+    request[len] = '\0';
+
+    if (strncmp(request, "GET /metrics", 12) != 0 || (request[12] != ' ' && request[12] != '?'))
+    {
+        send(client, not_found, sizeof(not_found) - 1, 0);
+        return;
+    }
+
+    EnterCriticalSection(&m->lock);
+    int front = m->front;
+    if (front >= 0)
+        m->pages[front].readers++;
+    LeaveCriticalSection(&m->lock);
+    if (front < 0)
+    {
+        send(client, unavailable, sizeof(unavailable) - 1, 0);
+        return;
+    }
+
+    const struct metrics_page *page = &m->pages[front];
+    size_t sent = 0;
+    while (sent < page->len)
+    {
+        int n = send(client, page->text + page->start + sent, (int)(page->len - sent), 0);
+        if (n <= 0)
+            break;
+        sent += (size_t)n;
+    }
+
+    EnterCriticalSection(&m->lock);
+    m->pages[front].readers--;
+    m->scrapes++;
+    LeaveCriticalSection(&m->lock);
+}
+
+/**
+ * @brief Answer scrapes one at a time until the listener is closed
+ */
+static DWORD WINAPI serve(LPVOID param)
+{
+    struct metrics *m = param;
+
+    for (;;)
+    {
+        SOCKET client = accept((SOCKET)m->listener, NULL, NULL);
+        if (client == INVALID_SOCKET)
+        {
+            if (m->stopping)
+                break;
+            continue;
+        }
+        respond(m, client);
+        closesocket(client);
+    }
+    return 0;
+}
+
+/**
+ * @brief Initialize metrics that are not served
+ *
+ * @param m Pointer to the metrics
+ */
+void metrics_init(struct metrics *m)
+{
+    *m = (struct metrics){.front = -1};
+}
+
+/**
+ * @brief Listen for scrapes on an address and serve them on a thread of their own.
+ * Nothing is served until the first snapshot has been rendered.
+ *
+ * @param m Pointer to the metrics
+ * @param address IPv4 address and port to listen on, for example 127.0.0.1:9100
+ * @return true Serving has started
+ * @return false The address is malformed or could not be listened on
+ */
+bool metrics_start(struct metrics *m, const char *address)
+{
+    if (!net_start())
+        return false;
+
+    SOCKET listener = net_bind(address, SOCK_STREAM);
+    if (listener == INVALID_SOCKET)
+        goto fail;
+
+    for (int i = 0; i < 2; i++)
+    {
+        m->pages[i].text = malloc(PAGE_INITIAL_SZ);
+        m->pages[i].cap = PAGE_INITIAL_SZ;
+        if (m->pages[i].text == NULL)
+        {
+            log_error("malloc failed to allocate memory");
+            closesocket(listener);
+            goto fail;
+        }
+    }
+
+    InitializeCriticalSection(&m->lock);
+    m->listener = (uintptr_t)listener;
+    m->thread = CreateThread(NULL, 0, serve, m, 0, NULL);
+    if (m->thread == NULL)
+    {
+        log_error("Unable to start the metrics listener");
+        closesocket(listener);
+        DeleteCriticalSection(&m->lock);
+        goto fail;
+    }
+    log_info("Serving metrics on http://%s/metrics", address);
+    return true;
+
+fail:
+    free(m->pages[0].text);
+    free(m->pages[1].text);
+    net_stop();
+    metrics_init(m);
+    return false;
+}
+
+/**
+ * @brief Stop serving, a scrape in progress is answered first
+ *
+ * @param m Pointer to the metrics
+ */
+void metrics_stop(struct metrics *m)
+{
+    if (m->thread == NULL)
+        return;
+
+    InterlockedExchange(&m->stopping, 1);
+    /* shutting the listener down wakes the thread blocked in accept */
+    shutdown((SOCKET)m->listener, 2);
+    closesocket((SOCKET)m->listener);
+    WaitForSingleObject(m->thread, INFINITE);
+    CloseHandle(m->thread);
+    DeleteCriticalSection(&m->lock);
+    free(m->pages[0].text);
+    free(m->pages[1].text);
+    net_stop();
+    metrics_init(m);
+}
@@ -0,0 +1,111 @@
+/**
+ * @file net.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for opening the Winsock sockets the metrics and OSC servers listen on.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include "net.h"
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+
+#define BACKLOG 8
+
+/**
+ * @brief Parse an IPv4 address and port, for example 127.0.0.1:9100.
+ * The address may be left out, :9100 listens on loopback.
+ */
+static bool parse_address(const char *address, struct sockaddr_in *addr)
+{
+    char host[64];
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || (size_t)(colon - address) >= sizeof(host))
+        return false;
+    memcpy(host, address, (size_t)(colon - address));
+    host[colon - address] = '\0';
+
+    char *end;
+    long port = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end != '\0' || port < 1 || port > 65535)
+        return false;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((unsigned short)port);
+    addr->sin_addr.s_addr = inet_addr(host[0] != '\0' ? host : "127.0.0.1");
+    return addr->sin_addr.s_addr != INADDR_NONE;
+}
+
+/**
+ * @brief Initialise the socket library, each call must be paired with net_stop
+ *
+ * @return true Sockets may be used
+ */
+bool net_start(void)
+{
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+    {
+        log_error("Unable to initialise Winsock");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Release the socket library
+ */
+void net_stop(void)
+{
+    WSACleanup();
+}
+
+/**
+ * @brief Open a socket bound to an address, stream sockets are also listened on
+ *
+ * @param address IPv4 address and port, for example 127.0.0.1:9100
+ * @param type SOCK_STREAM or SOCK_DGRAM
+ * @return SOCKET The socket, INVALID_SOCKET if the address is malformed or could not be bound
+ */
+SOCKET net_bind(const char *address, int type)
+{
+    struct sockaddr_in addr;
+
+    if (!parse_address(address, &addr))
+    {
+        log_error("'%s' is not an address and port, for example 127.0.0.1:9100", address);
+        return INVALID_SOCKET;
+    }
+
+    SOCKET s = socket(AF_INET, type, 0);
+    if (s == INVALID_SOCKET)
+    {
+        log_error("Unable to create a socket for '%s'", address);
+        return INVALID_SOCKET;
+    }
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        (type == SOCK_STREAM && listen(s, BACKLOG) != 0))
+    {
+        log_error("Unable to listen on '%s'", address);
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+/**
+ * @brief Make receives on a socket give up after a while
+ *
+ * @param s The socket
+ * @param timeout_ms Longest time a receive waits
+ */
+void net_set_timeout(SOCKET s, int timeout_ms)
+{
+    DWORD timeout = (DWORD)timeout_ms;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+}
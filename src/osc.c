@@ -0,0 +1,464 @@
+/**
+ * @file osc.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for serving Open Sound Control over UDP.
+ * Addresses map onto parameter names: /strip/0/gain is strip[0].gain and
+ * /bus/2/mute is bus[2].mute. A message with an argument sets the parameter,
+ * one without queries it and is answered with the current value on the same
+ * address. The sets of a packet, and so of a bundle however deeply nested,
+ * run as one batch and reach the engine as one script. Packets are decoded in
+ * place, nothing is allocated between the socket and the batch.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include "net.h"
+#include <windows.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "osc.h"
+#include "log.h"
+
+#define RECEIVE_TIMEOUT_MS 200 /* How often the server thread checks whether it should stop */
+#define QUERY_TIMEOUT_MS 1000
+#define MAX_DEPTH 8 /* Nesting of bundles */
+#define PARAM_SZ 128
+#define SCRIPT_SPECIALS ";,\"\r\n" /* Would end or unquote a value once the sets are joined into a script */
+
+static const char bundle_tag[8] = "#bundle";
+
+static uint32_t read_be32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] << 24 | (uint32_t)u[1] << 16 | (uint32_t)u[2] << 8 | (uint32_t)u[3];
+}
+
+static void write_be32(char *p, uint32_t v)
+{
+    unsigned char *u = (unsigned char *)p;
+    u[0] = (unsigned char)(v >> 24);
+    u[1] = (unsigned char)(v >> 16);
+    u[2] = (unsigned char)(v >> 8);
+    u[3] = (unsigned char)v;
+}
+
+/**
+ * @brief Read a padded string and move past it
+ *
+ * @return const char* The string, NULL if it is not terminated before end
+ */
+static const char *read_string(const char **p, const char *end)
+{
+    const char *s = *p;
+    const char *nul = memchr(s, '\0', (size_t)(end - s));
+    if (nul == NULL)
+        return NULL;
+    size_t padded = ((size_t)(nul - s) + 4) & ~(size_t)3;
+    if (padded > (size_t)(end - s))
+        return NULL;
+    *p = s + padded;
+    return s;
+}
+
+/**
+ * @brief Turn an address into a parameter name, /strip/0/gain into strip[0].gain.
+ * Segments of digits, or the selector characters *, - and ',', index the segment before them.
+ *
+ * @return false The address does not name a parameter
+ */
+static bool address_to_param(const char *address, char *param, size_t n)
+{
+    size_t len = 0;
+    const char *p = address;
+
+    while (*p == '/')
+    {
+        p++;
+        size_t seg = strcspn(p, "/");
+        bool index = strspn(p, "0123456789*-,") >= seg;
+        if (seg == 0 || (index && len == 0) || len + seg + 3 > n)
+            return false;
+
+        if (index)
+            param[len++] = '[';
+        else if (len > 0)
+            param[len++] = '.';
+        memcpy(param + len, p, seg);
+        len += seg;
+        if (index)
+            param[len++] = ']';
+        p += seg;
+    }
+    param[len] = '\0';
+    return *p == '\0' && len > 0;
+}
+
+/**
+ * @brief Copy a string into the packet's text
+ *
+ * @return const char* The copy, NULL if the text is full
+ */
+static const char *keep(struct osc_server *o, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(o->text + o->text_len, OSC_TEXT_SZ - o->text_len, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= OSC_TEXT_SZ - o->text_len)
+        return NULL;
+    const char *s = o->text + o->text_len;
+    o->text_len += (size_t)n + 1;
+    return s;
+}
+
+/**
+ * @brief Decode a message into a set or a query
+ *
+ * @return false The message is malformed or the packet holds too many commands
+ */
+static bool handle_message(struct osc_server *o, const char *data, const char *end)
+{
+    const char *p = data;
+    const char *address = read_string(&p, end);
+    if (address == NULL || address[0] != '/')
+        return false;
+    o->stats.messages++;
+
+    char param[PARAM_SZ];
+    if (!address_to_param(address, param, sizeof(param)))
+    {
+        log_warn("OSC address '%s' does not name a parameter", address);
+        return false;
+    }
+
+    /* very old senders leave the type tags out */
+    const char *tags = p < end ? read_string(&p, end) : ",";
+    if (tags == NULL || tags[0] != ',')
+        return false;
+
+    if (tags[1] == '\0')
+    {
+        if (o->num_queries == OSC_MAX_QUERIES || (o->gets[o->num_queries].param = keep(o, "%s", param)) == NULL)
+            return false;
+        o->reply_to[o->num_queries++] = address;
+        o->stats.queries++;
+        return true;
+    }
+
+    const char *command = NULL;
+    switch (tags[1])
+    {
+    case 'i':
+        if (end - p < 4)
+            return false;
+        command = keep(o, "%s=%d", param, (int32_t)read_be32(p));
+        break;
+    case 'f':
+    {
+        if (end - p < 4)
+            return false;
+        uint32_t bits = read_be32(p);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        command = keep(o, "%s=%.4f", param, f);
+        break;
+    }
+    case 'h':
+        if (end - p < 8)
+            return false;
+        command = keep(o, "%s=%lld", param, (long long)((uint64_t)read_be32(p) << 32 | read_be32(p + 4)));
+        break;
+    case 'd':
+    {
+        if (end - p < 8)
+            return false;
+        uint64_t bits = (uint64_t)read_be32(p) << 32 | read_be32(p + 4);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        command = keep(o, "%s=%.4f", param, d);
+        break;
+    }
+    case 's':
+    case 'S':
+    {
+        const char *s = read_string(&p, end);
+        if (s == NULL)
+            return false;
+        if (strpbrk(s, SCRIPT_SPECIALS) != NULL)
+        {
+            log_warn("OSC string for %s holds a separator or a quote, ignored", address);
+            return false;
+        }
+        command = keep(o, "%s=%s", param, s);
+        break;
+    }
+    case 'T':
+        command = keep(o, "%s=1", param);
+        break;
+    case 'F':
+        command = keep(o, "%s=0", param);
+        break;
+    default:
+        log_warn("OSC type '%c' of %s is not supported", tags[1], address);
+        return false;
+    }
+    if (command == NULL || o->num_commands == OSC_MAX_COMMANDS)
+        return false;
+    o->commands[o->num_commands++] = command;
+    return true;
+}
+
+/**
+ * @brief Decode a bundle or a message. The time tags of bundles are ignored, everything runs at once.
+ *
+ * @return false Part of the element was malformed, the rest is still decoded
+ */
+static bool handle_element(struct osc_server *o, const char *data, const char *end, int depth)
+{
+    if (end - data < 16 || memcmp(data, bundle_tag, sizeof(bundle_tag)) != 0)
+        return handle_message(o, data, end);
+    if (depth == MAX_DEPTH)
+        return false;
+    o->stats.bundles++;
+
+    bool ok = true;
+    const char *p = data + 16;
+    while (p < end)
+    {
+        if (end - p < 4)
+            return false;
+        uint32_t size = read_be32(p);
+        p += 4;
+        if (size > (uint32_t)(end - p) || size % 4 != 0)
+            return false;
+        if (!handle_element(o, p, p + size, depth + 1))
+            ok = false;
+        p += size;
+    }
+    return ok;
+}
+
+/**
+ * @brief Append a padded string to a reply
+ *
+ * @return false It would not fit
+ */
+static bool put_string(char *reply, size_t *len, const char *s)
+{
+    size_t n = strlen(s);
+    size_t padded = (n + 4) & ~(size_t)3;
+    if (padded > OSC_PACKET_SZ - *len)
+        return false;
+    memcpy(reply + *len, s, n);
+    memset(reply + *len + n, 0, padded - n);
+    *len += padded;
+    return true;
+}
+
+/**
+ * @brief Append the answer to a query as a message
+ *
+ * @return false It would not fit
+ */
+static bool put_answer(char *reply, size_t *len, const char *address, const struct vmrcli_get *g)
+{
+    if (!put_string(reply, len, address))
+        return false;
+    if (g->type == VMRCLI_STRING)
+        return put_string(reply, len, ",s") && put_string(reply, len, g->s);
+
+    if (!put_string(reply, len, ",f") || OSC_PACKET_SZ - *len < 4)
+        return false;
+    uint32_t bits;
+    memcpy(&bits, &g->f, sizeof(bits));
+    write_be32(reply + *len, bits);
+    *len += 4;
+    return true;
+}
+
+/**
+ * @brief Answer the queries of a packet to its sender.
+ * A lone answer is sent as a message, several are gathered into bundles as large as a packet.
+ */
+static void send_replies(struct osc_server *o, const struct sockaddr_in *to)
+{
+    const size_t header = sizeof(bundle_tag) + 8;
+    size_t len = 0;
+
+    for (size_t i = 0; i < o->num_queries; i++)
+    {
+        const struct vmrcli_get *g = &o->gets[i];
+        if (g->status != VMRCLI_OK)
+        {
+            log_warn("OSC query of %s failed", g->param);
+            o->stats.errors++;
+            continue;
+        }
+
+        if (o->num_queries == 1)
+        {
+            if (put_answer(o->reply, &len, o->reply_to[i], g))
+            {
+                sendto((SOCKET)o->sock, o->reply, (int)len, 0, (const struct sockaddr *)to, sizeof(*to));
+                o->stats.replies++;
+            }
+            return;
+        }
+
+        for (int attempt = 0; attempt < 2; attempt++)
+        {
+            if (len == 0)
+            {
+                memcpy(o->reply, bundle_tag, sizeof(bundle_tag));
+                write_be32(o->reply + 8, 0);
+                write_be32(o->reply + 12, 1); /* immediately */
+                len = header;
+            }
+
+            /* each element is preceded by its size */
+            size_t next = len + 4;
+            if (next < OSC_PACKET_SZ && put_answer(o->reply, &next, o->reply_to[i], g))
+            {
+                write_be32(o->reply + len, (uint32_t)(next - len - 4));
+                len = next;
+                o->stats.replies++;
+                break;
+            }
+            if (len == header)
+            {
+                log_warn("OSC answer to %s is too long", g->param);
+                break;
+            }
+            /* the bundle is full, send it and start another */
+            sendto((SOCKET)o->sock, o->reply, (int)len, 0, (const struct sockaddr *)to, sizeof(*to));
+            len = 0;
+        }
+    }
+    if (len > header)
+        sendto((SOCKET)o->sock, o->reply, (int)len, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+/**
+ * @brief Run the sets of a packet as one batch, then answer its queries
+ */
+static void handle_packet(struct osc_server *o, size_t size, const struct sockaddr_in *from)
+{
+    o->stats.packets++;
+    o->text_len = 0;
+    o->num_commands = 0;
+    o->num_queries = 0;
+    if (size % 4 != 0 || !handle_element(o, o->packet, o->packet + size, 0))
+    {
+        log_warn("Malformed OSC packet of %zu bytes from %s", size, inet_ntoa(from->sin_addr));
+        o->stats.errors++;
+    }
+
+    if (o->num_commands > 0)
+        vmrcli_submit_batch(o->session, o->commands, o->num_commands);
+    if (o->num_queries > 0)
+    {
+        for (size_t i = 0; i < o->num_queries; i++)
+            o->gets[i].status = VMRCLI_ERR_PARAM;
+        if (vmrcli_get_async(o->session, &o->request, o->gets, o->num_queries, NULL, NULL) != VMRCLI_OK ||
+            vmrcli_wait(&o->request, QUERY_TIMEOUT_MS) != VMRCLI_OK)
+        {
+            log_error("OSC queries timed out");
+            /* the request may still be filled later, wait for it before the buffers are reused */
+            vmrcli_wait(&o->request, -1);
+            return;
+        }
+        send_replies(o, from);
+    }
+}
+
+/**
+ * @brief Handle packets one at a time until the server is stopped
+ */
+static DWORD WINAPI serve(LPVOID param)
+{
+    struct osc_server *o = param;
+
+    while (!o->stopping)
+    {
+        struct sockaddr_in from;
+        int from_len = sizeof(from);
+        int n = recvfrom((SOCKET)o->sock, o->packet, sizeof(o->packet), 0, (struct sockaddr *)&from, &from_len);
+        /* timeouts, and on Windows the echo of a reply sent to a closed port, are not errors */
+        if (n > 0)
+            handle_packet(o, (size_t)n, &from);
+    }
+    return 0;
+}
+
+/**
+ * @brief Initialize a server that is not serving
+ *
+ * @param o Pointer to the server
+ */
+void osc_init(struct osc_server *o)
+{
+    o->session = NULL;
+    o->thread = NULL;
+    o->stopping = 0;
+    o->stats = (struct osc_stats){0};
+}
+
+/**
+ * @brief Bind a UDP socket and serve OSC on a thread of its own
+ *
+ * @param o Pointer to the server
+ * @param session The session the packets drive
+ * @param address IPv4 address and port to bind, for example 127.0.0.1:9000
+ * @return true Serving has started
+ * @return false The address is malformed or could not be bound
+ */
+bool osc_start(struct osc_server *o, struct vmrcli_session *session, const char *address)
+{
+    if (!net_start())
+        return false;
+
+    SOCKET sock = net_bind(address, SOCK_DGRAM);
+    if (sock == INVALID_SOCKET)
+    {
+        net_stop();
+        return false;
+    }
+    net_set_timeout(sock, RECEIVE_TIMEOUT_MS);
+
+    o->session = session;
+    o->sock = (uintptr_t)sock;
+    o->thread = CreateThread(NULL, 0, serve, o, 0, NULL);
+    if (o->thread == NULL)
+    {
+        log_error("Unable to start the OSC server");
+        closesocket(sock);
+        net_stop();
+        osc_init(o);
+        return false;
+    }
+    log_info("Serving OSC on udp://%s", address);
+    return true;
+}
+
+/**
+ * @brief Stop serving, a packet being handled is finished first
+ *
+ * @param o Pointer to the server
+ */
+void osc_stop(struct osc_server *o)
+{
+    if (o->thread == NULL)
+        return;
+
+    InterlockedExchange(&o->stopping, 1);
+    WaitForSingleObject(o->thread, INFINITE);
+    CloseHandle(o->thread);
+    closesocket((SOCKET)o->sock);
+    net_stop();
+    o->thread = NULL;
+}
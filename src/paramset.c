@@ -0,0 +1,225 @@
+/**
+ * @file paramset.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief A set of parameter values, the in-memory form of profiles and scenes.
+ * Once finished the set is sorted by name, later duplicates win, and every
+ * parameter and the set as a whole are hashed so sets can be compared cheaply.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "paramset.h"
+#include "util.h"
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+
+/* The parameters of each strip and bus held by profiles and scenes.
+ * Scene files refer to these by position, only ever append to them. */
+const char *const strip_param_names[] = {
+    "Mute", "Solo", "Mono", "MC", "Karaoke", "Gain", "Limit", "Comp", "Gate", "Audibility",
+    "Pan_x", "Pan_y", "Color_x", "Color_y", "fx_x", "fx_y", "EQGain1", "EQGain2", "EQGain3",
+    "A1", "A2", "A3", "A4", "A5", "B1", "B2", "B3",
+    "Reverb", "Delay", "Fx1", "Fx2", "PostReverb", "PostDelay", "PostFx1", "PostFx2", "Label"};
+const size_t num_strip_param_names = COUNT_OF(strip_param_names);
+
+const char *const bus_param_names[] = {
+    "Mute", "Mono", "Gain", "Sel", "EQ.on", "Label",
+    "ReturnReverb", "ReturnDelay", "ReturnFx1", "ReturnFx2"};
+const size_t num_bus_param_names = COUNT_OF(bus_param_names);
+
+/* Parameters that take a range of values and may be faded, the rest are switches */
+static const char *continuous_param_names[] = {
+    "Gain", "Limit", "Comp", "Gate", "Audibility", "Pan_x", "Pan_y", "Color_x", "Color_y",
+    "fx_x", "fx_y", "EQGain1", "EQGain2", "EQGain3", "Reverb", "Delay", "Fx1", "Fx2",
+    "ReturnReverb", "ReturnDelay", "ReturnFx1", "ReturnFx2"};
+
+/* Parameters that always hold text, a label such as "007" must not be taken for a number */
+static const char *string_param_names[] = {"Label"};
+
+static uint64_t hash_bytes(uint64_t h, const char *s, bool fold_case)
+{
+    while (*s)
+    {
+        unsigned char c = (unsigned char)*s++;
+        h = (h ^ (fold_case ? (unsigned char)tolower(c) : c)) * FNV_PRIME;
+    }
+    return h;
+}
+
+/**
+ * @brief Initialize an empty set
+ *
+ * @param ps Pointer to the set
+ */
+void paramset_init(struct paramset *ps)
+{
+    *ps = (struct paramset){0};
+}
+
+/**
+ * @brief Free the set and every parameter it holds
+ *
+ * @param ps Pointer to the set
+ */
+void paramset_free(struct paramset *ps)
+{
+    for (size_t i = 0; i < ps->count; i++)
+    {
+        free(ps->params[i].name);
+        free(ps->params[i].value);
+    }
+    free(ps->params);
+    *ps = (struct paramset){0};
+}
+
+/**
+ * @brief Add a parameter, values that parse as a float are held as numbers
+ * unless the parameter always holds text, see param_is_string()
+ *
+ * @param ps Pointer to the set
+ * @param name The parameter name
+ * @param value The value
+ * @return true The parameter was added
+ * @return false Memory could not be allocated
+ */
+bool paramset_add(struct paramset *ps, const char *name, const char *value)
+{
+    if (ps->count == ps->cap)
+    {
+        size_t cap = ps->cap ? ps->cap * 2 : 64;
+        struct param *params = realloc(ps->params, cap * sizeof(struct param));
+        if (params == NULL)
+            return false;
+        ps->params = params;
+        ps->cap = cap;
+    }
+
+    struct param *p = &ps->params[ps->count];
+    *p = (struct param){.name = malloc(strlen(name) + 1), .value = malloc(strlen(value) + 1)};
+    if (p->name == NULL || p->value == NULL)
+    {
+        free(p->name);
+        free(p->value);
+        return false;
+    }
+    strcpy(p->name, name);
+    strcpy(p->value, value);
+    p->is_string = param_is_string(name) || !parse_float(value, &p->f);
+    p->hash = ps->count++; /* insertion order until the set is finished */
+    return true;
+}
+
+static int compare_params(const void *a, const void *b)
+{
+    const struct param *x = a, *y = b;
+    int c = strcasecmp(x->name, y->name);
+    /* equal names keep insertion order so the last one added can win */
+    return c != 0 ? c : (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+/**
+ * @brief Sort the set by name, drop all but the last value given for each name and hash it
+ *
+ * @param ps Pointer to the set
+ */
+void paramset_finish(struct paramset *ps)
+{
+    if (ps->count > 1)
+        qsort(ps->params, ps->count, sizeof(struct param), compare_params);
+
+    size_t count = 0;
+    for (size_t i = 0; i < ps->count; i++)
+    {
+        if (i + 1 < ps->count && strcasecmp(ps->params[i].name, ps->params[i + 1].name) == 0)
+        {
+            free(ps->params[i].name);
+            free(ps->params[i].value);
+            continue;
+        }
+        ps->params[count++] = ps->params[i];
+    }
+    ps->count = count;
+
+    ps->hash = FNV_OFFSET;
+    for (size_t i = 0; i < ps->count; i++)
+    {
+        struct param *p = &ps->params[i];
+        p->hash = hash_bytes(hash_bytes(FNV_OFFSET, p->name, true), p->value, false);
+        ps->hash = (ps->hash ^ p->hash) * FNV_PRIME;
+    }
+}
+
+/**
+ * @brief Find a parameter in a finished set
+ *
+ * @param ps Pointer to the set
+ * @param name The parameter name, any case
+ * @return const struct param* May return NULL if the set does not hold the parameter
+ */
+const struct param *paramset_find(const struct paramset *ps, const char *name)
+{
+    size_t lo = 0, hi = ps->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcasecmp(ps->params[mid].name, name);
+        if (c == 0)
+            return &ps->params[mid];
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Is the parameter one that may be faded, such as a gain, send or pan position
+ *
+ * @param name A strip or bus parameter name such as Strip[0].Gain
+ * @return true The parameter takes a continuous range of values
+ */
+bool param_is_continuous(const char *name)
+{
+    const char *attr = strstr(name, "].");
+    if (attr == NULL)
+        return false;
+
+    for (size_t i = 0; i < COUNT_OF(continuous_param_names); i++)
+    {
+        if (strcasecmp(attr + 2, continuous_param_names[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Check whether a parameter always holds text, whatever its value looks like
+ *
+ * @param name The full parameter name, for example Strip[0].Label
+ * @return true The parameter is a label or a device name
+ */
+bool param_is_string(const char *name)
+{
+    const char *attr = strstr(name, "].");
+    if (attr == NULL)
+        return false;
+
+    if (strncasecmp(attr + 2, "device.", 7) == 0)
+        return true;
+    for (size_t i = 0; i < COUNT_OF(string_param_names); i++)
+    {
+        if (strcasecmp(attr + 2, string_param_names[i]) == 0)
+            return true;
+    }
+    return false;
+}
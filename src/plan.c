@@ -0,0 +1,273 @@
+/**
+ * @file plan.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for collecting the commands of an input line into a batch
+ * and splitting the batch into phases.
+ *
+ * A phase is a run of commands whose reads may all be made behind a single
+ * dirty synchronisation, ahead of the phase's writes. A read may only be
+ * moved ahead of the writes that precede it when none of them could change
+ * the value read, so every read still observes what it would have observed
+ * had the line been executed one command at a time.
+ *
+ * Before a batch is planned it may be optimised: writes overwritten before
+ * anything reads them are dropped and toggle pairs cancel out. Relative writes
+ * are never folded, the engine clamps each write so their sum may differ.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "plan.h"
+#include "log.h"
+
+/**
+ * @brief Initialize an empty batch
+ *
+ * @param b Pointer to the batch
+ */
+void batch_init(struct batch *b)
+{
+    *b = (struct batch){0};
+}
+
+/**
+ * @brief Append a command to the batch
+ *
+ * @param b Pointer to the batch
+ * @param cmd The command, copied into the batch
+ * @return true The command was appended
+ * @return false Memory could not be allocated
+ */
+bool batch_push(struct batch *b, const struct command *cmd)
+{
+    if (b->count == b->cap)
+    {
+        size_t cap = b->cap ? b->cap * 2 : 16;
+        struct command *cmds = realloc(b->cmds, cap * sizeof(struct command));
+        if (cmds == NULL)
+            return false;
+        b->cmds = cmds;
+        b->cap = cap;
+    }
+    b->cmds[b->count++] = *cmd;
+    return true;
+}
+
+/**
+ * @brief Hand a heap buffer that commands point into over to the batch
+ *
+ * @param b Pointer to the batch
+ * @param buf The buffer, freed by batch_clear() or immediately on failure
+ * @return true The batch now owns the buffer
+ * @return false Memory could not be allocated, buf has been freed
+ */
+bool batch_own(struct batch *b, char *buf)
+{
+    if (b->num_owned == b->owned_cap)
+    {
+        size_t cap = b->owned_cap ? b->owned_cap * 2 : 4;
+        char **owned = realloc(b->owned, cap * sizeof(char *));
+        if (owned == NULL)
+        {
+            free(buf);
+            return false;
+        }
+        b->owned = owned;
+        b->owned_cap = cap;
+    }
+    b->owned[b->num_owned++] = buf;
+    return true;
+}
+
+/**
+ * @brief Empty the batch, keeping its storage for the next line
+ *
+ * @param b Pointer to the batch
+ */
+void batch_clear(struct batch *b)
+{
+    for (size_t i = 0; i < b->num_owned; i++)
+        free(b->owned[i]);
+    b->num_owned = 0;
+    b->count = 0;
+}
+
+/**
+ * @brief Free the batch and everything it owns
+ *
+ * @param b Pointer to the batch
+ */
+void batch_free(struct batch *b)
+{
+    batch_clear(b);
+    free(b->cmds);
+    free(b->owned);
+    *b = (struct batch){0};
+}
+
+/**
+ * @brief Does the command depend on the current value, a ramp starts from it
+ */
+static bool is_read(const struct command *cmd)
+{
+    return cmd->op == OP_GET || cmd->op == OP_TOGGLE || cmd->op == OP_RAMP;
+}
+
+/**
+ * @brief Could the write change state beyond its own parameter (profile loads, restarts and so on)
+ */
+static bool is_barrier(const struct command *cmd)
+{
+    return cmd->op == OP_QUICK || strncasecmp(cmd->param, "command.", 8) == 0;
+}
+
+/**
+ * @brief Could a write made earlier in the phase change the value of param
+ */
+static bool conflicts(const struct command *cmds, size_t n, const char *param)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (cmds[i].op == OP_GET)
+            continue;
+        if (is_barrier(&cmds[i]) || strcasecmp(cmds[i].param, param) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Find the end of the phase beginning at the first command.
+ * Writes never end a phase, a read ends it only when an earlier write of the phase
+ * could change the value read.
+ *
+ * @param cmds The remaining commands of a batch
+ * @param n Number of remaining commands
+ * @return size_t Number of commands in the phase, at least 1 when n > 0
+ */
+size_t plan_phase_length(const struct command *cmds, size_t n)
+{
+    size_t len = 0;
+    bool has_writes = false;
+
+    while (len < n)
+    {
+        const struct command *cmd = &cmds[len];
+        if (is_read(cmd) && has_writes && conflicts(cmds, len, cmd->param))
+            break;
+        if (cmd->op != OP_GET)
+            has_writes = true;
+        len++;
+    }
+    return len;
+}
+
+static bool is_write(const struct command *cmd)
+{
+    return cmd->op == OP_SET || cmd->op == OP_INC || cmd->op == OP_DEC || cmd->op == OP_TOGGLE ||
+           cmd->op == OP_RAMP;
+}
+
+/**
+ * @brief Do two quick commands write the same key, for example lock and unlock
+ */
+static bool same_quick_key(const struct command *a, const struct command *b)
+{
+    size_t len = strcspn(a->param, "=");
+    return strncasecmp(a->param, b->param, len) == 0 && b->param[len] == '=';
+}
+
+/**
+ * @brief Try to merge an earlier write to a parameter into the next command that touches it.
+ *
+ * @param first The earlier write
+ * @param next The next command naming the same parameter
+ * @param dead Receives true for next as well when the pair cancels out
+ * @return true first may be dropped
+ */
+static bool merge(const struct command *first, const struct command *next, bool *dead)
+{
+    if (first->op == OP_TOGGLE && next->op == OP_TOGGLE)
+    {
+        *dead = true;
+        return true;
+    }
+    if (next->op == OP_SET)
+        return true;
+    if (first->op == OP_RAMP && next->op == OP_RAMP)
+        return true; /* the second would retarget the first before it moved */
+    return false;
+}
+
+/**
+ * @brief Remove redundant commands from a batch, in place.
+ * - A write is dropped when a later set overwrites it before anything reads it
+ * - Two toggles of one parameter with nothing between reading it cancel out
+ * - Of two ramps of one parameter only the last is kept
+ * - Of a run of quick commands writing one key (lock unlock lock) only the last is kept
+ * Nothing is moved across a command.* write.
+ *
+ * @param b Pointer to the batch
+ * @return size_t Number of commands removed
+ */
+size_t plan_optimise(struct batch *b)
+{
+    struct command *cmds = b->cmds;
+    size_t n = b->count;
+    bool *dead = calloc(n, sizeof(bool));
+    if (dead == NULL)
+        return 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (dead[i])
+            continue;
+
+        if (cmds[i].op == OP_QUICK)
+        {
+            for (size_t j = i + 1; j < n && cmds[j].op == OP_QUICK; j++)
+            {
+                if (same_quick_key(&cmds[i], &cmds[j]))
+                {
+                    dead[i] = true;
+                    break;
+                }
+            }
+            continue;
+        }
+        if (!is_write(&cmds[i]) || is_barrier(&cmds[i]))
+            continue;
+
+        for (size_t j = i + 1; j < n; j++)
+        {
+            if (dead[j])
+                continue;
+            if (is_barrier(&cmds[j]))
+                break;
+            if (strcasecmp(cmds[j].param, cmds[i].param) != 0)
+                continue;
+
+            dead[i] = merge(&cmds[i], &cmds[j], &dead[j]);
+            break;
+        }
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!dead[i])
+            cmds[count++] = cmds[i];
+    }
+    free(dead);
+    b->count = count;
+
+    if (count < n)
+        log_debug("Optimised away %zu of %zu commands", n - count, n);
+    return n - count;
+}
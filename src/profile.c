@@ -0,0 +1,359 @@
+/**
+ * @file profile.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for reading Voicemeeter XML settings files into a parameter set.
+ *
+ * The file is streamed line by line through a small tag scanner, only the
+ * attributes of <Strip> and <Bus> elements that map onto API parameters are
+ * kept. For example <Strip index="1" Mute="1" Gain="-6.0"> becomes
+ * Strip[0].Mute=1 and Strip[0].Gain=-6.0. Everything else in the file,
+ * devices and settings that only a full command.load can apply, is ignored.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "profile.h"
+#include "reader.h"
+#include "log.h"
+
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#define XML_INDEX_BASE 1 /* Strips and buses are numbered from 1 in the settings file */
+#define MAX_ATTRS 128
+#define NAME_SZ 64
+
+/**
+ * @struct State held while scanning a settings file
+ */
+struct scanner
+{
+    struct paramset *ps;
+    char *tag; /* The tag being collected, without its angle brackets */
+    size_t len;
+    size_t cap;
+    bool in_tag;
+    char quote;
+    bool failed;
+};
+
+static bool append(struct scanner *s, char c)
+{
+    if (s->len + 1 >= s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        char *tag = realloc(s->tag, cap);
+        if (tag == NULL)
+            return !(s->failed = true);
+        s->tag = tag;
+        s->cap = cap;
+    }
+    s->tag[s->len++] = c;
+    s->tag[s->len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Replace the predefined XML entities of a value in place.
+ */
+static void decode_entities(char *value)
+{
+    static const struct
+    {
+        const char *entity;
+        char c;
+    } entities[] = {{"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}, {"&apos;", '\''}};
+
+    char *write = value;
+    for (char *read = value; *read != '\0';)
+    {
+        size_t i;
+        for (i = 0; i < COUNT_OF(entities); i++)
+        {
+            size_t n = strlen(entities[i].entity);
+            if (strncmp(read, entities[i].entity, n) == 0)
+            {
+                *write++ = entities[i].c;
+                read += n;
+                break;
+            }
+        }
+        if (i == COUNT_OF(entities))
+            *write++ = *read++;
+    }
+    *write = '\0';
+}
+
+/**
+ * @brief Split the next name="value" pair of a tag in place.
+ *
+ * @param p Cursor into the tag, advanced past the attribute
+ * @param name Receives the attribute name
+ * @param value Receives the decoded value
+ * @return true An attribute was found
+ */
+static bool next_attribute(char **p, char **name, char **value)
+{
+    char *s = *p + strspn(*p, " \t\r\n/");
+    if (*s == '\0')
+        return false;
+
+    *name = s;
+    s += strcspn(s, " \t\r\n=");
+    char *name_end = s;
+    s += strspn(s, " \t\r\n");
+    if (*s != '=')
+        return false;
+    s += 1 + strspn(s + 1, " \t\r\n");
+    if (*s != '"' && *s != '\'')
+        return false;
+
+    char quote = *s++;
+    char *end = strchr(s, quote);
+    if (end == NULL)
+        return false;
+
+    *name_end = '\0';
+    *end = '\0';
+    *value = s;
+    decode_entities(s);
+    *p = end + 1;
+    return true;
+}
+
+static const char *canonical_attr(const char *attr, const char *const *attrs, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (strcasecmp(attr, attrs[i]) == 0)
+            return attrs[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Add the parameters held by a complete tag.
+ */
+static void handle_tag(struct scanner *s)
+{
+    char *p = s->tag;
+    const char *const *attrs;
+    size_t num_attrs;
+    const char *kind;
+
+    size_t name_len = strcspn(p, " \t\r\n/");
+    if (name_len == 5 && strncasecmp(p, "Strip", 5) == 0)
+    {
+        kind = "Strip";
+        attrs = strip_param_names;
+        num_attrs = num_strip_param_names;
+    }
+    else if (name_len == 3 && strncasecmp(p, "Bus", 3) == 0)
+    {
+        kind = "Bus";
+        attrs = bus_param_names;
+        num_attrs = num_bus_param_names;
+    }
+    else
+    {
+        return;
+    }
+    p += name_len;
+
+    char *names[MAX_ATTRS], *values[MAX_ATTRS];
+    int n = 0, index = -1;
+    while (n < MAX_ATTRS && next_attribute(&p, &names[n], &values[n]))
+    {
+        if (strcasecmp(names[n], "index") == 0)
+            index = atoi(values[n]) - XML_INDEX_BASE;
+        else
+            n++;
+    }
+    if (index < 0)
+    {
+        log_warn("Skipping <%s> with no index", kind);
+        return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const char *attr = canonical_attr(names[i], attrs, num_attrs);
+        if (attr == NULL)
+            continue;
+
+        char name[NAME_SZ];
+        snprintf(name, NAME_SZ, "%s[%d].%s", kind, index, attr);
+        if (!paramset_add(s->ps, name, values[i]))
+            s->failed = true;
+    }
+}
+
+/**
+ * @brief Feed one line of the file to the scanner, tags may span lines.
+ */
+static void scan_line(struct scanner *s, const char *line)
+{
+    for (const char *c = line; *c != '\0' && !s->failed; c++)
+    {
+        if (!s->in_tag)
+        {
+            if (*c == '<')
+            {
+                s->in_tag = true;
+                s->len = 0;
+            }
+            continue;
+        }
+
+        if (s->quote != '\0')
+        {
+            if (*c == s->quote)
+                s->quote = '\0';
+        }
+        else if (*c == '"' || *c == '\'')
+        {
+            s->quote = *c;
+        }
+        else if (*c == '>')
+        {
+            /* a comment only ends at --> */
+            bool in_comment = s->len >= 3 && strncmp(s->tag, "!--", 3) == 0 &&
+                              (s->len < 5 || strcmp(s->tag + s->len - 2, "--") != 0);
+            if (!in_comment)
+            {
+                s->in_tag = false;
+                if (s->tag != NULL && strchr("?!/", s->tag[0]) == NULL)
+                    handle_tag(s);
+                continue;
+            }
+        }
+        append(s, *c);
+    }
+
+    if (s->in_tag)
+        append(s, ' ');
+}
+
+/**
+ * @brief Parse a Voicemeeter XML settings file into a finished parameter set.
+ *
+ * @param path Path to the settings file
+ * @param ps Pointer to the set to be filled, initialized by this function
+ * @return true The file was parsed
+ * @return false The file could not be read, or memory could not be allocated
+ */
+bool profile_parse(const char *path, struct paramset *ps)
+{
+    struct scanner s = {.ps = ps};
+    struct reader r;
+    char *line;
+
+    paramset_init(ps);
+    if (!reader_open(&r, path))
+        return false;
+
+    while (!s.failed && (line = reader_next_line(&r, NULL)) != NULL)
+        scan_line(&s, line);
+    reader_close(&r);
+    free(s.tag);
+
+    if (s.failed)
+    {
+        log_error("Out of memory parsing profile '%s'", path);
+        paramset_free(ps);
+        return false;
+    }
+
+    paramset_finish(ps);
+    log_debug("Parsed %zu parameters from %s (hash %016llx)", ps->count, path, (unsigned long long)ps->hash);
+    return true;
+}
+
+/**
+ * @brief Initialize an empty profile store
+ *
+ * @param store Pointer to the store
+ */
+void profiles_init(struct profiles *store)
+{
+    *store = (struct profiles){0};
+}
+
+/**
+ * @brief Get the parameters of a profile, parsing it only the first time it is asked for.
+ *
+ * @param store Pointer to the store
+ * @param path Path to the settings file
+ * @param reload Parse the file again even if it was parsed before
+ * @return const struct paramset* May return NULL if the profile could not be parsed
+ */
+const struct paramset *profiles_get(struct profiles *store, const char *path, bool reload)
+{
+    struct profile *prof = NULL;
+    for (size_t i = 0; i < store->count; i++)
+    {
+        if (strcmp(store->items[i].path, path) == 0)
+        {
+            prof = &store->items[i];
+            break;
+        }
+    }
+    if (prof != NULL && !reload)
+        return &prof->params;
+
+    struct paramset ps;
+    if (!profile_parse(path, &ps))
+        return NULL;
+
+    if (prof == NULL)
+    {
+        if (store->count == store->cap)
+        {
+            size_t cap = store->cap ? store->cap * 2 : 4;
+            struct profile *items = realloc(store->items, cap * sizeof(struct profile));
+            if (items == NULL)
+            {
+                paramset_free(&ps);
+                return NULL;
+            }
+            store->items = items;
+            store->cap = cap;
+        }
+        prof = &store->items[store->count];
+        if ((prof->path = malloc(strlen(path) + 1)) == NULL)
+        {
+            paramset_free(&ps);
+            return NULL;
+        }
+        strcpy(prof->path, path);
+        store->count++;
+    }
+    else
+    {
+        paramset_free(&prof->params);
+    }
+
+    prof->params = ps;
+    return &prof->params;
+}
+
+/**
+ * @brief Free every profile held by the store
+ *
+ * @param store Pointer to the store
+ */
+void profiles_free(struct profiles *store)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        free(store->items[i].path);
+        paramset_free(&store->items[i].params);
+    }
+    free(store->items);
+    *store = (struct profiles){0};
+}
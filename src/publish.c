@@ -0,0 +1,325 @@
+/**
+ * @file publish.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for publishing the engine's state to shared memory.
+ * A scheduler timer gathers gains, mutes, labels and levels into a fixed layout
+ * snapshot (see state.h) and copies it into a named shared memory section under
+ * a seqlock. Any number of local readers take consistent copies without a
+ * system call and without logging into the engine themselves, so an overlay,
+ * a dashboard and a bot cost the engine one poller between them. The same
+ * snapshots may be handed to a callback, the metrics endpoint renders them.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "publish.h"
+#include "channels.h"
+#include "vmrcli.h"
+#include "interface.h"
+#include "wrapper.h"
+#include "util.h"
+#include "utf.h"
+#include "log.h"
+
+#define PUBLISH_TICK_US 20000 /* Snapshots are published 50 times a second */
+#define READ_ATTEMPTS 1000    /* Attempts at a consistent copy before a reader gives up */
+
+/**
+ * @brief Read the parameters of every strip and bus into the next snapshot.
+ * Values are stored in the cache as they are read.
+ */
+static void read_parameters(struct publisher *p)
+{
+    struct vmrcli_state *s = &p->next;
+    char name[64];
+    float f;
+
+    s->strip_mute = s->bus_mute = 0;
+    for (uint32_t i = 0; i < s->num_strips + s->num_buses; i++)
+    {
+        bool strip = i < s->num_strips;
+        uint32_t index = strip ? i : i - s->num_strips;
+        const char *what = strip ? "strip" : "bus";
+
+        snprintf(name, sizeof(name), "%s[%u].gain", what, index);
+        if (get_parameter_float(p->vmr, name, &f) == 0)
+        {
+            (strip ? s->strip_gain : s->bus_gain)[index] = f;
+            cache_store_float(p->cache, name, f);
+        }
+
+        snprintf(name, sizeof(name), "%s[%u].mute", what, index);
+        if (get_parameter_float(p->vmr, name, &f) == 0)
+        {
+            if (f != 0)
+                *(strip ? &s->strip_mute : &s->bus_mute) |= 1u << index;
+            cache_store_float(p->cache, name, f);
+        }
+
+        char label[PARAM_STRING_UTF8_SZ];
+        snprintf(name, sizeof(name), "%s[%u].label", what, index);
+        if (get_parameter_string(p->vmr, name, label, sizeof(label)) == 0)
+        {
+            utf8_copy(label, (strip ? s->strip_label : s->bus_label)[index], VMRCLI_STATE_LABEL_SZ);
+            cache_store_string(p->cache, name, label);
+        }
+    }
+}
+
+/**
+ * @brief Read every level channel into the next snapshot
+ *
+ * @return false The library does not export levels
+ */
+static bool read_levels(struct publisher *p)
+{
+    struct vmrcli_state *s = &p->next;
+
+    for (uint32_t i = 0; i < s->num_strip_channels; i++)
+    {
+        long rep = get_level(p->vmr, LEVEL_POST_FADER, (long)i, &s->strip_level[i]);
+        if (rep == SYMBOL_MISSING)
+            return false;
+        if (rep != 0)
+            s->strip_level[i] = 0;
+    }
+    for (uint32_t i = 0; i < s->num_bus_channels; i++)
+    {
+        if (get_level(p->vmr, LEVEL_OUTPUT, (long)i, &s->bus_level[i]) != 0)
+            s->bus_level[i] = 0;
+    }
+    return true;
+}
+
+/**
+ * @brief Copy the next snapshot into shared memory under the seqlock, then hand it to the callback
+ */
+static void publish(struct publisher *p)
+{
+    struct vmrcli_state *shared = p->shared;
+
+    p->next.updates++;
+    p->next.updated_us = now_us();
+
+    if (shared != NULL)
+    {
+        /* odd while writing, the interlocked increments are full barriers on either side of the copy */
+        InterlockedIncrement((volatile LONG *)&shared->seq);
+        size_t offset = offsetof(struct vmrcli_state, kind);
+        memcpy((char *)shared + offset, (const char *)&p->next + offset, sizeof(struct vmrcli_state) - offset);
+        InterlockedIncrement((volatile LONG *)&shared->seq);
+    }
+    if (p->on_snapshot != NULL)
+        p->on_snapshot(p->udata, &p->next);
+}
+
+/**
+ * @brief Gather and publish a snapshot, runs on the scheduler thread.
+ * Parameters are read again only when the engine reports a change, or when
+ * the session has synchronised and so consumed the engine's dirty flag itself.
+ * A change seen here begins a new cache generation, which is how the session
+ * learns of it, the flag is cleared by whoever reads it first.
+ * Levels change continuously and are read on every tick.
+ */
+static void tick(void *udata, long long deadline_us)
+{
+    (void)deadline_us;
+    struct publisher *p = udata;
+
+    if (is_pdirty(p->vmr))
+        cache_new_generation(p->cache);
+    if (!p->have_parameters || p->generation != p->cache->generation)
+    {
+        read_parameters(p);
+        p->generation = p->cache->generation;
+        p->have_parameters = true;
+    }
+
+    if (p->levels)
+        p->levels = read_levels(p);
+    publish(p);
+}
+
+/**
+ * @brief Initialize an idle publisher
+ *
+ * @param p Pointer to the publisher
+ * @param vmr Pointer to the iVMR interface
+ * @param sched The scheduler that gathers the snapshots, its lock guards the publisher
+ * @param cache Parameters read for a snapshot are stored in it
+ * @param kind The kind of Voicemeeter running
+ */
+void publisher_init(struct publisher *p, PT_VMR vmr, struct sched *sched, struct cache *cache, int kind)
+{
+    *p = (struct publisher){.vmr = vmr, .sched = sched, .cache = cache, .levels = true};
+
+    struct vmrcli_state *s = &p->next;
+    s->kind = kind;
+    s->num_strips = (uint32_t)kind_num_strips(kind);
+    s->num_buses = (uint32_t)kind_num_buses(kind);
+    const struct channel_map *map = channel_map(kind);
+    if (map != NULL)
+    {
+        s->num_strip_channels = map->strip_channels;
+        s->num_bus_channels = map->bus_channels;
+    }
+}
+
+/**
+ * @brief Create a named shared memory section for the snapshots, before the publisher is started
+ *
+ * @param p Pointer to the publisher
+ * @param name Name of the section, for example "Local\\vmrcli"
+ * @return true The section was created
+ * @return false The section could not be created
+ */
+bool publisher_share(struct publisher *p, const char *name)
+{
+    p->mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(struct vmrcli_state), name);
+    if (p->mapping != NULL)
+        p->shared = MapViewOfFile(p->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(struct vmrcli_state));
+    if (p->shared == NULL)
+    {
+        log_error("Unable to create the shared memory section '%s'", name);
+        if (p->mapping != NULL)
+            CloseHandle(p->mapping);
+        p->mapping = NULL;
+        return false;
+    }
+
+    /* readers check the header before trusting anything else, it is written once with the section idle */
+    memset(p->shared, 0, sizeof(struct vmrcli_state));
+    p->shared->size = sizeof(struct vmrcli_state);
+    p->shared->version = VMRCLI_STATE_VERSION;
+    MemoryBarrier();
+    p->shared->magic = VMRCLI_STATE_MAGIC;
+
+    log_info("Publishing the engine's state to '%s' (%zu bytes)", name, sizeof(struct vmrcli_state));
+    return true;
+}
+
+/**
+ * @brief Hand every snapshot to a callback as well, before the publisher is started
+ *
+ * @param p Pointer to the publisher
+ * @param fn Called with each snapshot
+ * @param udata Passed to fn
+ */
+void publisher_watch(struct publisher *p, snapshot_fn fn, void *udata)
+{
+    p->on_snapshot = fn;
+    p->udata = udata;
+}
+
+/**
+ * @brief Gather a first snapshot, then keep gathering them on the scheduler
+ *
+ * @param p Pointer to the publisher
+ * @return true Publishing has started
+ * @return false The timer could not be added
+ */
+bool publisher_start(struct publisher *p)
+{
+    sched_lock(p->sched);
+    tick(p, now_us());
+    p->timer = sched_add(p->sched, PUBLISH_TICK_US, PUBLISH_TICK_US, tick, p);
+    sched_unlock(p->sched);
+    if (p->timer == 0)
+    {
+        log_error("Failed scheduling the publisher");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop publishing and close the section, readers keep their own views of it
+ *
+ * @param p Pointer to the publisher
+ */
+void publisher_stop(struct publisher *p)
+{
+    if (p->timer != 0)
+    {
+        sched_lock(p->sched);
+        sched_cancel(p->sched, p->timer);
+        sched_unlock(p->sched);
+    }
+    if (p->shared != NULL)
+        UnmapViewOfFile(p->shared);
+    if (p->mapping != NULL)
+        CloseHandle(p->mapping);
+    *p = (struct publisher){0};
+}
+
+/**
+ * @brief Open a section published by another process, for reading
+ *
+ * @param name Name the section was published under
+ * @return const struct vmrcli_state* The section, NULL if it does not exist or is not a vmrcli state
+ */
+const struct vmrcli_state *vmrcli_state_open(const char *name)
+{
+    HANDLE mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+    if (mapping == NULL)
+        return NULL;
+
+    const struct vmrcli_state *state = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(struct vmrcli_state));
+    /* the view keeps the section alive */
+    CloseHandle(mapping);
+    if (state == NULL)
+        return NULL;
+    if (state->magic != VMRCLI_STATE_MAGIC || state->version != VMRCLI_STATE_VERSION ||
+        state->size != sizeof(struct vmrcli_state))
+    {
+        UnmapViewOfFile(state);
+        return NULL;
+    }
+    return state;
+}
+
+/**
+ * @brief Take a consistent copy of a published state, without a system call
+ *
+ * @param state The section returned by vmrcli_state_open
+ * @param snapshot Receives the copy
+ * @return int VMRCLI_OK, VMRCLI_ERR_TIMEOUT if the publisher never paused long enough for a copy
+ */
+int vmrcli_state_read(const struct vmrcli_state *state, struct vmrcli_state *snapshot)
+{
+    for (int i = 0; i < READ_ATTEMPTS; i++)
+    {
+        int32_t seq = state->seq;
+        if (seq & 1)
+        {
+            YieldProcessor();
+            continue;
+        }
+        MemoryBarrier();
+        memcpy(snapshot, (const void *)state, sizeof(struct vmrcli_state));
+        MemoryBarrier();
+        if (state->seq == seq)
+        {
+            snapshot->seq = seq;
+            return VMRCLI_OK;
+        }
+    }
+    return VMRCLI_ERR_TIMEOUT;
+}
+
+/**
+ * @brief Close a section opened by vmrcli_state_open
+ *
+ * @param state The section
+ */
+void vmrcli_state_close(const struct vmrcli_state *state)
+{
+    UnmapViewOfFile(state);
+}
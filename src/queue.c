@@ -0,0 +1,567 @@
+/**
+ * @file queue.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief A priority queue of input lines, so a mute typed or piped in runs
+ * ahead of a backlog of label, device and EQ writes from a generator.
+ * Each line is classified when it arrives by the parameters it touches.
+ * Lines of one priority run in arrival order, and when a line would overtake
+ * an earlier one touching the same parameter the earlier one is promoted too,
+ * so the writes to each parameter are always made in the order they were given.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "queue.h"
+#include "command.h"
+#include "util.h"
+#include "log.h"
+
+#define INITIAL_KEYS 256 /* Must be a power of two */
+#define MAX_PARAM_LEN 128 /* Longer names are not parameters, the line is made a barrier */
+
+/**
+ * @struct The classification of a line being pushed
+ */
+struct classify
+{
+    struct line_queue *q;
+    enum priority priority;
+    bool barrier;
+    bool first;
+    char *keys; /* Lower cased, each NUL terminated */
+    size_t keys_len;
+    size_t keys_cap;
+    size_t num_keys;
+};
+
+static size_t hash_name(const char *name)
+{
+    size_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
+
+static struct queue_key *find_slot(struct queue_key *keys, size_t cap, const char *name)
+{
+    size_t i = hash_name(name) & (cap - 1);
+    while (keys[i].name != NULL && strcmp(keys[i].name, name) != 0)
+        i = (i + 1) & (cap - 1);
+    return &keys[i];
+}
+
+static bool grow(struct line_queue *q)
+{
+    size_t cap = q->keys_cap ? q->keys_cap * 2 : INITIAL_KEYS;
+    struct queue_key *keys = calloc(cap, sizeof(struct queue_key));
+    if (keys == NULL)
+        return false;
+
+    for (size_t i = 0; i < q->keys_cap; i++)
+    {
+        if (q->keys[i].name != NULL)
+            *find_slot(keys, cap, q->keys[i].name) = q->keys[i];
+    }
+
+    free(q->keys);
+    q->keys = keys;
+    q->keys_cap = cap;
+    return true;
+}
+
+/**
+ * @brief Find the entry of a parameter, NULL if no line has touched it
+ */
+static struct queue_key *lookup(struct line_queue *q, const char *name)
+{
+    if (q->keys_cap == 0)
+        return NULL;
+
+    struct queue_key *k = find_slot(q->keys, q->keys_cap, name);
+    return k->name != NULL ? k : NULL;
+}
+
+/**
+ * @brief Find or create the entry of a parameter.
+ * Entries are kept once created, the parameters of a session are few.
+ */
+static struct queue_key *upsert(struct line_queue *q, const char *name)
+{
+    if ((q->num_keys + 1) * 2 > q->keys_cap && !grow(q))
+        return NULL;
+
+    struct queue_key *k = find_slot(q->keys, q->keys_cap, name);
+    if (k->name == NULL)
+    {
+        if ((k->name = strdup(name)) == NULL)
+            return NULL;
+        q->num_keys++;
+    }
+    return k;
+}
+
+static bool ends_with(const char *s, size_t len, const char *suffix)
+{
+    size_t n = strlen(suffix);
+    return len >= n && memcmp(s + len - n, suffix, n) == 0;
+}
+
+/**
+ * @brief The priority of a write to a parameter, the name is lower cased
+ */
+static enum priority param_priority(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (ends_with(name, len, ".mute") || strcmp(name, "command.lock") == 0)
+        return PRIORITY_URGENT;
+    if (ends_with(name, len, ".label") || ends_with(name, len, ".eq") ||
+        strstr(name, ".device.") != NULL || strstr(name, ".eq.") != NULL)
+        return PRIORITY_BULK;
+    return PRIORITY_NORMAL;
+}
+
+/**
+ * @brief Add a parameter the line touches, lower cased
+ */
+static bool add_key(struct classify *c, const char *name, size_t len)
+{
+    if (c->keys_len + len + 1 > c->keys_cap)
+    {
+        size_t cap = c->keys_cap ? c->keys_cap * 2 : 256;
+        while (cap < c->keys_len + len + 1)
+            cap *= 2;
+        char *keys = realloc(c->keys, cap);
+        if (keys == NULL)
+            return false;
+        c->keys = keys;
+        c->keys_cap = cap;
+    }
+
+    char *key = c->keys + c->keys_len;
+    for (size_t i = 0; i < len; i++)
+        key[i] = (char)tolower((unsigned char)name[i]);
+    key[len] = '\0';
+    c->keys_len += len + 1;
+    c->num_keys++;
+
+    enum priority p = param_priority(key);
+    if (p < c->priority)
+        c->priority = p;
+    return true;
+}
+
+/**
+ * @brief Classify a single command of a line being pushed.
+ * A token that is not a parameter command, as in a directive, a line of the language
+ * or a command with an interpolated name, makes the whole line a barrier.
+ */
+static void classify_token(char *token, void *udata)
+{
+    struct classify *c = udata;
+    struct command cmd;
+
+    if (c->barrier)
+        return;
+    c->first = false;
+
+    if (!command_parse(token, &cmd))
+    {
+        c->barrier = true;
+        return;
+    }
+
+    if (cmd.op == OP_QUICK)
+    {
+        /* lock and unlock go first as command.lock does, restart, show and hide are
+           barriers like any other command.* write */
+        size_t len = strcspn(cmd.param, "=");
+        if (len != strlen("command.lock") || strncasecmp(cmd.param, "command.lock", len) != 0 ||
+            !add_key(c, cmd.param, len))
+            c->barrier = true;
+        return;
+    }
+
+    size_t len = strlen(cmd.param);
+    if (len > MAX_PARAM_LEN || strchr(cmd.param, '.') == NULL || strpbrk(cmd.param, "{}$") != NULL ||
+        (strncasecmp(cmd.param, "command.", 8) == 0 && strcasecmp(cmd.param, "command.lock") != 0))
+    {
+        c->barrier = true;
+        return;
+    }
+
+    char buf[MAX_EXPANSION * (MAX_PARAM_LEN + 3)];
+    char *tokens[MAX_EXPANSION];
+    int n = command_expand(cmd.param, c->q->num_strips, c->q->num_buses, buf, tokens);
+    if (n <= 0)
+    {
+        /* a single parameter, or a selector the session will report as invalid */
+        if (!add_key(c, cmd.param, len))
+            c->barrier = true;
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (!add_key(c, tokens[i], strlen(tokens[i])))
+            c->barrier = true;
+    }
+}
+
+/**
+ * @brief Unlink a line from its level and its keys' pending counts
+ */
+static void unlink_line(struct line_queue *q, struct queued_line *l)
+{
+    struct queue_level *lv = &q->levels[l->priority];
+
+    if (l->prev)
+        l->prev->next = l->next;
+    else
+        lv->head = l->next;
+    if (l->next)
+        l->next->prev = l->prev;
+    else
+        lv->tail = l->prev;
+    lv->count--;
+    if (l->barrier)
+        lv->barriers--;
+
+    const char *key = l->keys;
+    for (size_t i = 0; i < l->num_keys; i++, key += strlen(key) + 1)
+    {
+        struct queue_key *k = lookup(q, key);
+        if (k != NULL)
+            k->pending[l->priority]--;
+    }
+}
+
+/**
+ * @brief Link a line into the level of its priority, in arrival order
+ *
+ * @return false A key could not be recorded, the line has not been linked
+ */
+static bool link_line(struct line_queue *q, struct queued_line *l)
+{
+    struct queue_level *lv = &q->levels[l->priority];
+
+    const char *key = l->keys;
+    for (size_t i = 0; i < l->num_keys; i++, key += strlen(key) + 1)
+    {
+        struct queue_key *k = upsert(q, key);
+        if (k == NULL)
+        {
+            /* undo the keys already counted */
+            const char *undo = l->keys;
+            for (size_t j = 0; j < i; j++, undo += strlen(undo) + 1)
+                lookup(q, undo)->pending[l->priority]--;
+            return false;
+        }
+        k->pending[l->priority]++;
+    }
+
+    struct queued_line *after = lv->tail;
+    while (after != NULL && after->seq > l->seq)
+        after = after->prev;
+
+    l->prev = after;
+    l->next = after ? after->next : lv->head;
+    if (l->prev)
+        l->prev->next = l;
+    else
+        lv->head = l;
+    if (l->next)
+        l->next->prev = l;
+    else
+        lv->tail = l;
+    lv->count++;
+    if (l->barrier)
+        lv->barriers++;
+    return true;
+}
+
+/**
+ * @brief Check whether a line conflicts with any held at a lower priority
+ */
+static bool has_conflict(struct line_queue *q, const struct queued_line *l)
+{
+    for (int p = l->priority + 1; p < PRIORITIES; p++)
+    {
+        if (q->levels[p].count == 0)
+            continue;
+        if (l->barrier || q->levels[p].barriers > 0)
+            return true;
+
+        const char *key = l->keys;
+        for (size_t i = 0; i < l->num_keys; i++, key += strlen(key) + 1)
+        {
+            struct queue_key *k = lookup(q, key);
+            if (k != NULL && k->pending[p] > 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+static void mark_keys(struct line_queue *q, const struct queued_line *l)
+{
+    const char *key = l->keys;
+    for (size_t i = 0; i < l->num_keys; i++, key += strlen(key) + 1)
+        lookup(q, key)->mark = q->mark;
+}
+
+static bool touches_marked(struct line_queue *q, const struct queued_line *l)
+{
+    const char *key = l->keys;
+    for (size_t i = 0; i < l->num_keys; i++, key += strlen(key) + 1)
+    {
+        if (lookup(q, key)->mark == q->mark)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Move up the earlier lines a newly linked line must not overtake.
+ * Lower priority lines are visited newest first, a line touching a marked parameter
+ * is moved up to the new line's priority and its own parameters are marked in turn,
+ * so anything it must not overtake follows it. A barrier moves up everything before it.
+ *
+ * @param q Pointer to the queue
+ * @param l The line just linked
+ */
+static void promote(struct line_queue *q, struct queued_line *l)
+{
+    if (!has_conflict(q, l))
+        return;
+
+    if (++q->mark == 0)
+    {
+        for (size_t i = 0; i < q->keys_cap; i++)
+            q->keys[i].mark = 0;
+        q->mark = 1;
+    }
+    mark_keys(q, l);
+
+    bool everything = l->barrier;
+    struct queued_line *cur[PRIORITIES] = {0};
+    for (int p = l->priority + 1; p < PRIORITIES; p++)
+        cur[p] = q->levels[p].tail;
+
+    for (;;)
+    {
+        int newest = -1;
+        for (int p = l->priority + 1; p < PRIORITIES; p++)
+        {
+            if (cur[p] != NULL && (newest < 0 || cur[p]->seq > cur[newest]->seq))
+                newest = p;
+        }
+        if (newest < 0)
+            break;
+
+        struct queued_line *e = cur[newest];
+        cur[newest] = e->prev;
+        if (!everything && !e->barrier && !touches_marked(q, e))
+            continue;
+
+        unlink_line(q, e);
+        e->priority = l->priority;
+        link_line(q, e); /* cannot fail, its keys are all recorded */
+        mark_keys(q, e);
+        everything |= e->barrier;
+        q->stats.promoted++;
+    }
+}
+
+/**
+ * @brief Initialize an empty queue
+ *
+ * @param q Pointer to the queue
+ * @param delimiters Characters lines are split on, as the session splits them
+ * @param num_strips Strips of the running kind, for expanding index selectors
+ * @param num_buses Buses of the running kind
+ */
+void queue_init(struct line_queue *q, const char *delimiters, int num_strips, int num_buses)
+{
+    *q = (struct line_queue){.delimiters = delimiters, .num_strips = num_strips, .num_buses = num_buses};
+    InitializeCriticalSection(&q->lock);
+    InitializeConditionVariable(&q->ready);
+    InitializeConditionVariable(&q->space);
+}
+
+/**
+ * @brief Classify a line and hold it until it is popped.
+ * Waits while QUEUE_MAX_LINES lines are held.
+ *
+ * @param q Pointer to the queue
+ * @param line The input line, copied
+ * @return true The line is queued
+ * @return false The queue is closed or memory could not be allocated
+ */
+bool queue_push(struct line_queue *q, const char *line)
+{
+    size_t len = strlen(line);
+    char *copy = strdup(line);
+    if (copy == NULL)
+    {
+        log_error("Unable to queue '%s'", line);
+        return false;
+    }
+
+    struct classify c = {.q = q, .priority = PRIORITY_BULK, .first = true};
+    if (!is_comment(copy))
+        command_tokenize(copy, q->delimiters, classify_token, &c);
+    free(copy);
+    if (c.first || c.barrier)
+    {
+        /* an empty line or a comment, a directive or a line of the language */
+        c.priority = PRIORITY_NORMAL;
+        c.barrier = !c.first;
+        c.num_keys = 0;
+        c.keys_len = 0;
+    }
+
+    struct queued_line *l = malloc(sizeof(struct queued_line) + c.keys_len + len + 1);
+    if (l == NULL)
+    {
+        free(c.keys);
+        log_error("Unable to queue '%s'", line);
+        return false;
+    }
+    *l = (struct queued_line){.priority = c.priority, .barrier = c.barrier, .num_keys = c.num_keys};
+    l->keys = (char *)(l + 1);
+    l->line = l->keys + c.keys_len;
+    if (c.keys_len > 0)
+        memcpy(l->keys, c.keys, c.keys_len);
+    memcpy(l->line, line, len + 1);
+    free(c.keys);
+
+    EnterCriticalSection(&q->lock);
+    while (q->depth >= QUEUE_MAX_LINES && !q->closed)
+        SleepConditionVariableCS(&q->space, &q->lock, INFINITE);
+
+    bool queued = !q->closed;
+    if (queued)
+    {
+        l->seq = q->next_seq++;
+        l->queued_us = now_us();
+        queued = link_line(q, l);
+        if (!queued)
+            log_error("Unable to queue '%s'", line);
+    }
+    if (queued)
+    {
+        promote(q, l);
+        q->depth++;
+        q->stats.queued++;
+        if (q->depth > q->stats.max_depth)
+            q->stats.max_depth = q->depth;
+        WakeConditionVariable(&q->ready);
+    }
+    LeaveCriticalSection(&q->lock);
+
+    if (!queued)
+        free(l);
+    return queued;
+}
+
+/**
+ * @brief Take the most urgent line, waiting until one is pushed
+ *
+ * @param q Pointer to the queue
+ * @return struct queued_line* The line, pass it to queue_done() once run. NULL once closed and empty
+ */
+struct queued_line *queue_pop(struct line_queue *q)
+{
+    struct queued_line *l = NULL;
+
+    EnterCriticalSection(&q->lock);
+    while (q->depth == 0 && !q->closed)
+        SleepConditionVariableCS(&q->ready, &q->lock, INFINITE);
+
+    for (int p = 0; p < PRIORITIES && l == NULL; p++)
+        l = q->levels[p].head;
+
+    if (l != NULL)
+    {
+        unlink_line(q, l);
+        q->depth--;
+
+        long long wait_us = now_us() - l->queued_us;
+        q->stats.run[l->priority]++;
+        q->stats.total_wait_us[l->priority] += wait_us;
+        if (wait_us > q->stats.max_wait_us[l->priority])
+            q->stats.max_wait_us[l->priority] = wait_us;
+        WakeConditionVariable(&q->space);
+    }
+    LeaveCriticalSection(&q->lock);
+    return l;
+}
+
+/**
+ * @brief Free a line once it has run
+ *
+ * @param l The line returned by queue_pop()
+ */
+void queue_done(struct queued_line *l)
+{
+    free(l);
+}
+
+/**
+ * @brief The number of lines waiting to run
+ *
+ * @param q Pointer to the queue
+ * @return size_t
+ */
+size_t queue_depth(struct line_queue *q)
+{
+    EnterCriticalSection(&q->lock);
+    size_t depth = q->depth;
+    LeaveCriticalSection(&q->lock);
+    return depth;
+}
+
+/**
+ * @brief Accept no more lines, those held are still popped
+ *
+ * @param q Pointer to the queue
+ */
+void queue_close(struct line_queue *q)
+{
+    EnterCriticalSection(&q->lock);
+    q->closed = true;
+    WakeAllConditionVariable(&q->ready);
+    WakeAllConditionVariable(&q->space);
+    LeaveCriticalSection(&q->lock);
+}
+
+/**
+ * @brief Free the queue and any lines still held
+ *
+ * @param q Pointer to the queue
+ */
+void queue_free(struct line_queue *q)
+{
+    for (int p = 0; p < PRIORITIES; p++)
+    {
+        struct queued_line *l = q->levels[p].head;
+        while (l != NULL)
+        {
+            struct queued_line *next = l->next;
+            free(l);
+            l = next;
+        }
+    }
+    for (size_t i = 0; i < q->keys_cap; i++)
+        free(q->keys[i].name);
+    free(q->keys);
+    DeleteCriticalSection(&q->lock);
+    *q = (struct line_queue){0};
+}
@@ -0,0 +1,274 @@
+/**
+ * @file ramp.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for ramping parameters towards a target over time.
+ * Every ramp in progress is advanced by a single scheduler timer, so each tick
+ * writes all of them with one script however many there are. Values are
+ * computed for the tick's deadline rather than the time it ran, so a late tick
+ * never stretches a ramp. Starting a ramp on a parameter that is already
+ * ramping retargets it from wherever it has got to.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "ramp.h"
+#include "wrapper.h"
+#include "util.h"
+#include "log.h"
+
+#define RAMP_TICK_US 10000 /* Ramps are written 100 times a second */
+#define MAX_SCRIPT 48000   /* SetParameters accepts scripts of up to 48kB */
+#define ENTRY_SZ 128
+
+/**
+ * @brief Map the elapsed fraction of a ramp onto the fraction of the distance covered
+ */
+static float shape(enum ramp_curve curve, float t)
+{
+    switch (curve)
+    {
+    case CURVE_EXP:
+        return (powf(2, 10 * t) - 1) / 1023;
+    case CURVE_LOG:
+        return (1 - powf(2, -10 * t)) / (1 - 1.0f / 1024);
+    default:
+        return t;
+    }
+}
+
+static struct ramp *find(const struct ramps *r, const char *name)
+{
+    for (size_t i = 0; i < r->count; i++)
+    {
+        if (strcasecmp(r->items[i].name, name) == 0)
+            return &r->items[i];
+    }
+    return NULL;
+}
+
+static void remove_at(struct ramps *r, size_t i)
+{
+    free(r->items[i].name);
+    r->items[i] = r->items[--r->count];
+    if (r->count == 0 && r->timer != 0)
+    {
+        sched_cancel(r->sched, r->timer);
+        r->timer = 0;
+    }
+}
+
+/**
+ * @brief Append name=value to the tick's script, writing the script out first if it is full.
+ */
+static void append_entry(struct ramps *r, size_t *len, const char *name, float value)
+{
+    char entry[ENTRY_SZ];
+    int n = snprintf(entry, sizeof(entry), "%s=%.3f", name, value);
+    if (n < 0 || (size_t)n >= sizeof(entry))
+        return;
+
+    if (*len > 0 && *len + (size_t)n + 2 > MAX_SCRIPT)
+    {
+        set_parameters(r->vmr, r->script);
+        *len = 0;
+    }
+    if (*len > 0)
+        r->script[(*len)++] = ';';
+    memcpy(r->script + *len, entry, (size_t)n + 1);
+    *len += (size_t)n;
+}
+
+/**
+ * @brief Advance every ramp to the tick's deadline, runs on the scheduler thread.
+ */
+static void tick(void *udata, long long deadline_us)
+{
+    struct ramps *r = udata;
+    size_t len = 0;
+
+    long long late = now_us() - deadline_us;
+    if (late > r->stats.max_late_us)
+        r->stats.max_late_us = late;
+    r->stats.ticks++;
+
+    for (size_t i = 0; i < r->count;)
+    {
+        struct ramp *rp = &r->items[i];
+        float t = rp->duration_us > 0 ? (float)(deadline_us - rp->start_us) / (float)rp->duration_us : 1;
+        if (t < 0)
+            t = 0;
+
+        if (t >= 1)
+        {
+            append_entry(r, &len, rp->name, rp->to);
+            cache_store_float(r->cache, rp->name, rp->to);
+            log_debug("Ramp of %s reached %.3f", rp->name, rp->to);
+            remove_at(r, i);
+            continue;
+        }
+
+        rp->current = rp->from + (rp->to - rp->from) * shape(rp->curve, t);
+        append_entry(r, &len, rp->name, rp->current);
+        i++;
+    }
+
+    if (len > 0)
+    {
+        set_parameters(r->vmr, r->script);
+        r->cache->applied_hash = 0;
+    }
+}
+
+/**
+ * @brief Initialize an empty set of ramps
+ *
+ * @param r Pointer to the ramps
+ * @param vmr Pointer to the iVMR interface
+ * @param sched The scheduler that advances the ramps, its lock guards them
+ * @param cache Ramped parameters are invalidated while they move and stored once they arrive
+ */
+void ramps_init(struct ramps *r, PT_VMR vmr, struct sched *sched, struct cache *cache)
+{
+    *r = (struct ramps){.vmr = vmr, .sched = sched, .cache = cache};
+}
+
+/**
+ * @brief Get the value a ramping parameter was last written with
+ *
+ * @param r Pointer to the ramps
+ * @param name The parameter name
+ * @param f Receives the value
+ * @return true The parameter is ramping
+ * @return false The parameter is not ramping
+ */
+bool ramp_current(const struct ramps *r, const char *name, float *f)
+{
+    const struct ramp *rp = find(r, name);
+    if (rp == NULL)
+        return false;
+
+    *f = rp->current;
+    return true;
+}
+
+/**
+ * @brief Start ramping a parameter, or retarget the ramp already in progress.
+ * The caller must hold the scheduler lock.
+ *
+ * @param r Pointer to the ramps
+ * @param name The parameter name
+ * @param from The value to start from, ignored when the parameter is already ramping
+ * @param to The value to ramp to
+ * @param duration_us Length of the ramp
+ * @param curve Shape of the ramp
+ * @return true The ramp was started
+ * @return false Memory could not be allocated or the timer could not be added
+ */
+bool ramp_start(struct ramps *r, const char *name, float from, float to, long long duration_us, enum ramp_curve curve)
+{
+    struct ramp *rp = find(r, name);
+    if (rp != NULL)
+    {
+        log_debug("Retargeting ramp of %s from %.3f", name, rp->current);
+        from = rp->current;
+    }
+    else
+    {
+        if (r->script == NULL && (r->script = malloc(MAX_SCRIPT)) == NULL)
+            return false;
+        if (r->count == r->cap)
+        {
+            size_t cap = r->cap ? r->cap * 2 : 16;
+            struct ramp *items = realloc(r->items, cap * sizeof(struct ramp));
+            if (items == NULL)
+                return false;
+            r->items = items;
+            r->cap = cap;
+        }
+
+        char *copy = malloc(strlen(name) + 1);
+        if (copy == NULL)
+            return false;
+        strcpy(copy, name);
+        rp = &r->items[r->count++];
+        rp->name = copy;
+    }
+
+    rp->from = rp->current = from;
+    rp->to = to;
+    rp->start_us = now_us();
+    rp->duration_us = duration_us;
+    rp->curve = curve;
+    cache_invalidate(r->cache, name);
+    r->stats.started++;
+
+    if (r->timer == 0 && (r->timer = sched_add(r->sched, RAMP_TICK_US, RAMP_TICK_US, tick, r)) == 0)
+    {
+        remove_at(r, (size_t)(rp - r->items));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop a ramp where it is, for example because the parameter was set directly.
+ * The caller must hold the scheduler lock.
+ *
+ * @param r Pointer to the ramps
+ * @param name The parameter name
+ * @return true A ramp was cancelled
+ * @return false The parameter was not ramping
+ */
+bool ramp_cancel(struct ramps *r, const char *name)
+{
+    struct ramp *rp = find(r, name);
+    if (rp == NULL)
+        return false;
+
+    log_debug("Cancelled ramp of %s at %.3f", name, rp->current);
+    remove_at(r, (size_t)(rp - r->items));
+    cache_invalidate(r->cache, name);
+    return true;
+}
+
+/**
+ * @brief Block until every ramp has reached its target.
+ * Must be called without holding the scheduler lock.
+ *
+ * @param r Pointer to the ramps
+ */
+void ramps_wait(struct ramps *r)
+{
+    for (;;)
+    {
+        sched_lock(r->sched);
+        size_t count = r->count;
+        sched_unlock(r->sched);
+        if (count == 0)
+            break;
+        Sleep(RAMP_TICK_US / 1000);
+    }
+}
+
+/**
+ * @brief Free the ramps, the scheduler must have been stopped first
+ *
+ * @param r Pointer to the ramps
+ */
+void ramps_free(struct ramps *r)
+{
+    for (size_t i = 0; i < r->count; i++)
+        free(r->items[i].name);
+    free(r->items);
+    free(r->script);
+    *r = (struct ramps){0};
+}
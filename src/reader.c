@@ -0,0 +1,241 @@
+/**
+ * @file reader.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for reading script input line by line without copying.
+ * Regular files are mapped copy-on-write and each line is terminated in place,
+ * pipes and consoles are streamed through a growable buffer in large chunks.
+ * Neither path places a limit on the length of a line.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reader.h"
+#include "log.h"
+
+#define CHUNK_SZ (64 * 1024) /* Size of each read from a stream */
+
+static bool reader_stream(struct reader *r)
+{
+    r->buf = malloc(CHUNK_SZ);
+    if (r->buf == NULL)
+    {
+        log_error("malloc failed to allocate memory");
+        return false;
+    }
+    r->cap = CHUNK_SZ;
+    return true;
+}
+
+/**
+ * @brief Open a script for reading.
+ * Regular files are memory mapped, anything else (pipes, devices) is streamed.
+ *
+ * @param r Pointer to the reader to be initialized
+ * @param path Path to the script, or "-" for stdin
+ * @return true The reader is ready
+ * @return false The script could not be opened
+ */
+bool reader_open(struct reader *r, const char *path)
+{
+    LARGE_INTEGER size;
+
+    if (strcmp(path, "-") == 0)
+        return reader_open_stdin(r);
+
+    *r = (struct reader){0};
+    r->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (r->file == INVALID_HANDLE_VALUE)
+    {
+        r->file = NULL;
+        log_error("Unable to open script '%s'", path);
+        return false;
+    }
+    r->owns_file = true;
+
+    if (GetFileType(r->file) != FILE_TYPE_DISK)
+    {
+        log_debug("Streaming script %s", path);
+        return reader_stream(r);
+    }
+
+    if (!GetFileSizeEx(r->file, &size))
+    {
+        log_error("Unable to size script '%s'", path);
+        reader_close(r);
+        return false;
+    }
+    if (size.QuadPart == 0)
+    {
+        r->mapped = true;
+        return true;
+    }
+
+    r->mapping = CreateFileMapping(r->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if (r->mapping != NULL)
+        r->buf = MapViewOfFile(r->mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (r->buf == NULL)
+    {
+        log_error("Unable to map script '%s'", path);
+        reader_close(r);
+        return false;
+    }
+    r->mapped = true;
+    r->size = (size_t)size.QuadPart;
+
+    log_debug("Mapped script %s (%zu bytes)", path, r->size);
+    return true;
+}
+
+/**
+ * @brief Open stdin for streaming.
+ *
+ * @param r Pointer to the reader to be initialized
+ * @return true The reader is ready
+ * @return false The stream buffer could not be allocated
+ */
+bool reader_open_stdin(struct reader *r)
+{
+    *r = (struct reader){0};
+    r->file = GetStdHandle(STD_INPUT_HANDLE);
+    return reader_stream(r);
+}
+
+/**
+ * @brief Terminate the line starting at r->pos whose newline is at nl.
+ * A preceding carriage return is dropped.
+ */
+static char *terminate_line(struct reader *r, char *nl, size_t *len)
+{
+    char *line = r->buf + r->pos;
+    size_t n = (size_t)(nl - line);
+
+    r->pos += n + 1;
+    r->scan = 0;
+    if (n > 0 && line[n - 1] == '\r')
+        n--;
+    line[n] = '\0';
+    if (len != NULL)
+        *len = n;
+    return line;
+}
+
+/**
+ * @brief Read more of the stream into the buffer, compacting and growing it as required.
+ *
+ * @return false The end of the stream has been reached
+ */
+static bool fill(struct reader *r)
+{
+    if (r->pos > 0)
+    {
+        memmove(r->buf, r->buf + r->pos, r->size - r->pos);
+        r->size -= r->pos;
+        r->pos = 0;
+    }
+
+    if (r->cap - r->size < CHUNK_SZ / 2)
+    {
+        char *buf = realloc(r->buf, r->cap * 2);
+        if (buf == NULL)
+        {
+            log_error("Input line too long to buffer");
+            return false;
+        }
+        r->buf = buf;
+        r->cap *= 2;
+    }
+
+    DWORD n = 0;
+    /* keep a spare byte for terminating a final unterminated line */
+    if (!ReadFile(r->file, r->buf + r->size, (DWORD)(r->cap - r->size - 1), &n, NULL) || n == 0)
+        return false;
+    r->size += n;
+    return true;
+}
+
+/**
+ * @brief Get the next line from the reader.
+ * The returned line is NUL terminated in place and remains valid (and writable)
+ * until the next call.
+ *
+ * @param r Pointer to an open reader
+ * @param len Receives the length of the line, may be NULL
+ * @return char* The next line, NULL once the input is exhausted
+ */
+char *reader_next_line(struct reader *r, size_t *len)
+{
+    for (;;)
+    {
+        if (r->pos < r->size)
+        {
+            char *nl = memchr(r->buf + r->pos + r->scan, '\n', r->size - r->pos - r->scan);
+            if (nl != NULL)
+                return terminate_line(r, nl, len);
+        }
+
+        if (r->pos >= r->size && (r->mapped || r->eof))
+            return NULL;
+
+        if (r->mapped)
+        {
+            /* the view cannot be written past its end, so the final line is copied */
+            size_t n = r->size - r->pos;
+            free(r->tail);
+            if ((r->tail = malloc(n + 1)) == NULL)
+            {
+                log_error("malloc failed to allocate memory");
+                return NULL;
+            }
+            memcpy(r->tail, r->buf + r->pos, n);
+            r->tail[n] = '\0';
+            if (n > 0 && r->tail[n - 1] == '\r')
+                r->tail[--n] = '\0';
+            r->pos = r->size;
+            if (len != NULL)
+                *len = n;
+            return r->tail;
+        }
+
+        if (r->eof)
+        {
+            char *line = terminate_line(r, r->buf + r->size, len);
+            r->pos = r->size;
+            return line;
+        }
+
+        r->scan = r->size - r->pos;
+        if (!fill(r))
+            r->eof = true;
+    }
+}
+
+/**
+ * @brief Release the reader's buffers and handles.
+ *
+ * @param r Pointer to the reader
+ */
+void reader_close(struct reader *r)
+{
+    if (r->mapped)
+    {
+        if (r->buf != NULL)
+            UnmapViewOfFile(r->buf);
+    }
+    else
+    {
+        free(r->buf);
+    }
+    if (r->mapping != NULL)
+        CloseHandle(r->mapping);
+    if (r->owns_file && r->file != NULL)
+        CloseHandle(r->file);
+    free(r->tail);
+    *r = (struct reader){0};
+}
@@ -0,0 +1,681 @@
+/**
+ * @file scene.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for capturing named scenes of strip and bus parameters,
+ * saving them to compact binary files and holding them in memory.
+ *
+ * File layout:
+ * | header | entry | [string bytes] | entry | ... |
+ * Each entry names its parameter by positions in the strip and bus parameter
+ * tables (see paramset.c) and holds either a float or the length of a string
+ * that follows it. The header holds the hash of the set so a damaged file is
+ * caught when it is read back.
+ *
+ * Morphs fade every continuous parameter between two scenes on a scheduler timer,
+ * like ramps, so the engine stays free between ticks. Each tick's values are
+ * computed for its deadline, so a late tick never shifts the ones after it.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "scene.h"
+#include "wrapper.h"
+#include "util.h"
+#include "log.h"
+
+#define SCENE_MAGIC "VMRS"
+#define SCENE_VERSION 1
+#define NAME_SZ 64
+#define VALUE_SZ 32
+#define PATH_SZ 1024
+#define MORPH_TICK_US 20000 /* Morphs are written 50 times a second */
+#define MAX_SCRIPT 48000    /* SetParameters accepts scripts of up to 48kB */
+
+enum scene_group : int
+{
+    GROUP_STRIP,
+    GROUP_BUS,
+};
+
+/**
+ * @struct The scene file header
+ */
+struct scene_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t hash;
+};
+
+/**
+ * @struct A single parameter of a scene file
+ */
+struct scene_entry
+{
+    uint8_t group;
+    uint8_t index;
+    uint8_t attr; /* Position in the strip or bus parameter table */
+    uint8_t is_string;
+    union
+    {
+        float f;
+        uint32_t len; /* Bytes of string following the entry */
+    } v;
+};
+
+static const char *const *group_names(int group, size_t *n)
+{
+    *n = group == GROUP_STRIP ? num_strip_param_names : num_bus_param_names;
+    return group == GROUP_STRIP ? strip_param_names : bus_param_names;
+}
+
+static void format_name(char *buf, int group, int index, const char *attr)
+{
+    snprintf(buf, NAME_SZ, "%s[%d].%s", group == GROUP_STRIP ? "Strip" : "Bus", index, attr);
+}
+
+/**
+ * @brief Find the table positions of a parameter name such as Strip[3].Gain
+ */
+static bool encode_name(const char *name, struct scene_entry *e)
+{
+    const char *p;
+    if (strncasecmp(name, "Strip[", 6) == 0)
+    {
+        e->group = GROUP_STRIP;
+        p = name + 6;
+    }
+    else if (strncasecmp(name, "Bus[", 4) == 0)
+    {
+        e->group = GROUP_BUS;
+        p = name + 4;
+    }
+    else
+    {
+        return false;
+    }
+
+    char *end;
+    long index = strtol(p, &end, 10);
+    if (end == p || end[0] != ']' || end[1] != '.' || index < 0 || index > UINT8_MAX)
+        return false;
+    e->index = (uint8_t)index;
+
+    size_t n;
+    const char *const *names = group_names(e->group, &n);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (strcasecmp(end + 2, names[i]) == 0)
+        {
+            e->attr = (uint8_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Read every strip and bus parameter of the running kind into a finished set.
+ * Parameters the running kind does not have are skipped.
+ *
+ * @param vmr Pointer to the iVMR interface
+ * @param num_strips Number of strips of the running kind
+ * @param num_buses Number of buses of the running kind
+ * @param ps Pointer to the set to be filled, initialized by this function
+ * @return true The scene was captured
+ * @return false Memory could not be allocated
+ */
+bool scene_capture(PT_VMR vmr, int num_strips, int num_buses, struct paramset *ps)
+{
+    char name[NAME_SZ], value[PARAM_STRING_UTF8_SZ];
+    float f;
+
+    paramset_init(ps);
+    clear(vmr, is_pdirty);
+
+    for (int group = GROUP_STRIP; group <= GROUP_BUS; group++)
+    {
+        size_t n;
+        const char *const *names = group_names(group, &n);
+        int count = group == GROUP_STRIP ? num_strips : num_buses;
+
+        for (int index = 0; index < count; index++)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                format_name(name, group, index, names[i]);
+                if (strcmp(names[i], "Label") == 0)
+                {
+                    if (get_parameter_string(vmr, name, value, sizeof(value)) != 0)
+                        continue;
+                }
+                else
+                {
+                    if (get_parameter_float(vmr, name, &f) != 0)
+                        continue;
+                    snprintf(value, VALUE_SZ, "%g", f);
+                }
+
+                if (!paramset_add(ps, name, value))
+                {
+                    paramset_free(ps);
+                    return false;
+                }
+            }
+        }
+    }
+
+    paramset_finish(ps);
+    return true;
+}
+
+/**
+ * @brief Write a set to a scene file.
+ *
+ * @param path Path the scene is written to
+ * @param ps A finished set of strip and bus parameters
+ * @return true The file was written
+ * @return false The file could not be written
+ */
+bool scene_write(const char *path, const struct paramset *ps)
+{
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        log_error("Unable to open '%s' for writing", path);
+        return false;
+    }
+
+    struct scene_header header = {
+        .magic = SCENE_MAGIC,
+        .version = SCENE_VERSION,
+        .count = 0,
+        .hash = ps->hash,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+
+    for (size_t i = 0; ok && i < ps->count; i++)
+    {
+        const struct param *p = &ps->params[i];
+        struct scene_entry e = {.is_string = p->is_string};
+        if (!encode_name(p->name, &e))
+        {
+            log_error("%s is not a strip or bus parameter", p->name);
+            ok = false;
+            break;
+        }
+
+        if (p->is_string)
+            e.v.len = (uint32_t)strlen(p->value);
+        else
+            e.v.f = p->f;
+        ok = fwrite(&e, sizeof(e), 1, out) == 1 &&
+             (!p->is_string || fwrite(p->value, 1, e.v.len, out) == e.v.len);
+        header.count++;
+    }
+
+    /* the count is only known once every entry is written */
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+        log_error("Failed writing scene '%s'", path);
+    return ok;
+}
+
+/**
+ * @brief Read a scene file into a finished set.
+ *
+ * @param path Path to the scene
+ * @param ps Pointer to the set to be filled, initialized by this function
+ * @return true The scene was read and its hash verified
+ * @return false The file could not be read or is damaged
+ */
+bool scene_read(const char *path, struct paramset *ps)
+{
+    struct scene_header header;
+    char name[NAME_SZ], value[VALUE_SZ];
+    bool ok = true;
+
+    paramset_init(ps);
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        log_error("Unable to open scene '%s'", path);
+        return false;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, SCENE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SCENE_VERSION)
+    {
+        log_error("'%s' is not a vmrcli scene (version %d)", path, SCENE_VERSION);
+        fclose(in);
+        return false;
+    }
+
+    for (uint32_t i = 0; ok && i < header.count; i++)
+    {
+        struct scene_entry e;
+        size_t n;
+        const char *const *names;
+
+        ok = fread(&e, sizeof(e), 1, in) == 1 && e.group <= GROUP_BUS;
+        if (ok)
+        {
+            names = group_names(e.group, &n);
+            ok = e.attr < n;
+        }
+        if (!ok)
+            break;
+        format_name(name, e.group, e.index, names[e.attr]);
+
+        if (!e.is_string)
+        {
+            snprintf(value, VALUE_SZ, "%g", e.v.f);
+            ok = paramset_add(ps, name, value);
+            continue;
+        }
+
+        char *s = malloc(e.v.len + 1);
+        ok = s != NULL && fread(s, 1, e.v.len, in) == e.v.len;
+        if (ok)
+        {
+            s[e.v.len] = '\0';
+            ok = paramset_add(ps, name, s);
+        }
+        free(s);
+    }
+    fclose(in);
+
+    if (ok)
+        paramset_finish(ps);
+    if (!ok || ps->hash != header.hash)
+    {
+        log_error("Scene '%s' is damaged", path);
+        paramset_free(ps);
+        return false;
+    }
+
+    log_debug("Read %zu parameters from %s (hash %016llx)", ps->count, path, (unsigned long long)ps->hash);
+    return true;
+}
+
+/**
+ * @brief Append name=value to the tick's script, writing the script out first if it is full.
+ */
+static void append_entry(struct morph *m, size_t *len, const char *name, const char *value)
+{
+    char entry[NAME_SZ + PARAM_STRING_UTF8_SZ];
+    int n = snprintf(entry, sizeof(entry), strpbrk(value, " \t") ? "%s=\"%s\"" : "%s=%s", name, value);
+    if (n < 0 || (size_t)n >= sizeof(entry))
+        return;
+
+    if (*len > 0 && *len + (size_t)n + 2 > MAX_SCRIPT)
+    {
+        set_parameters(m->vmr, m->script);
+        *len = 0;
+    }
+    if (*len > 0)
+        m->script[(*len)++] = ';';
+    memcpy(m->script + *len, entry, (size_t)n + 1);
+    *len += (size_t)n;
+}
+
+/**
+ * @brief Drop the morph in progress, leaving every parameter where it is
+ */
+static void morph_clear(struct morph *m)
+{
+    if (m->timer != 0)
+    {
+        sched_cancel(m->sched, m->timer);
+        m->timer = 0;
+    }
+    for (size_t i = 0; i < m->num_fades; i++)
+        free(m->fades[i].name);
+    for (size_t i = 0; i < m->num_switches; i++)
+    {
+        free(m->switches[i].name);
+        free(m->switches[i].value);
+    }
+    free(m->fades);
+    free(m->switches);
+    free(m->from_name);
+    free(m->to_name);
+    m->fades = NULL;
+    m->switches = NULL;
+    m->from_name = m->to_name = NULL;
+    m->num_fades = m->num_switches = 0;
+}
+
+/**
+ * @brief Record the to scene in the cache and report how the morph kept time
+ */
+static void morph_finish(struct morph *m)
+{
+    for (size_t i = 0; i < m->num_fades; i++)
+        cache_store_float(m->cache, m->fades[i].name, m->fades[i].to);
+    for (size_t i = 0; i < m->num_switches; i++)
+    {
+        if (m->switches[i].is_string)
+            cache_store_string(m->cache, m->switches[i].name, m->switches[i].value);
+        else
+            cache_store_float(m->cache, m->switches[i].name, m->switches[i].f);
+    }
+    cache_set_applied(m->cache, m->to_hash);
+
+    log_info("Morphed %s to %s in %.1f ms, %lld ticks, worst tick %lld us late, fell behind %lld times",
+             m->from_name, m->to_name, (now_us() - m->start_us) / 1000.0, m->stats.ticks, m->stats.max_late_us,
+             m->stats.late);
+    morph_clear(m);
+}
+
+/**
+ * @brief Advance the morph to the tick's deadline, runs on the scheduler thread.
+ */
+static void morph_tick(void *udata, long long deadline_us)
+{
+    struct morph *m = udata;
+    size_t len = 0;
+    char value[VALUE_SZ];
+
+    long long late = now_us() - deadline_us;
+    if (late > m->stats.max_late_us)
+        m->stats.max_late_us = late;
+    if (late > MORPH_TICK_US)
+        m->stats.late++;
+    m->stats.ticks++;
+
+    float t = m->duration_us > 0 ? (float)(deadline_us - m->start_us) / (float)m->duration_us : 1;
+    if (t > 1)
+        t = 1;
+
+    for (size_t i = 0; i < m->num_fades; i++)
+    {
+        snprintf(value, VALUE_SZ, "%.3f", m->fades[i].from + (m->fades[i].to - m->fades[i].from) * t);
+        append_entry(m, &len, m->fades[i].name, value);
+    }
+    if (!m->switched && t >= m->switch_at)
+    {
+        for (size_t i = 0; i < m->num_switches; i++)
+            append_entry(m, &len, m->switches[i].name, m->switches[i].value);
+        m->switched = true;
+    }
+    if (len > 0)
+    {
+        set_parameters(m->vmr, m->script);
+        m->cache->stats.writes++;
+        m->cache->applied_hash = 0;
+    }
+
+    if (t >= 1)
+        morph_finish(m);
+}
+
+/**
+ * @brief Initialize an idle morph
+ *
+ * @param m Pointer to the morph
+ * @param vmr Pointer to the iVMR interface
+ * @param sched The scheduler that advances the morph, its lock guards it
+ * @param cache Morphed parameters are invalidated while they move and stored once they arrive
+ */
+void morph_init(struct morph *m, PT_VMR vmr, struct sched *sched, struct cache *cache)
+{
+    *m = (struct morph){.vmr = vmr, .sched = sched, .cache = cache};
+}
+
+/**
+ * @brief Start fading from one scene to another, replacing any morph in progress.
+ * Continuous parameters are interpolated on every tick, all other parameters that differ
+ * switch together once the morph reaches switch_at. Each tick is written as one script.
+ * The engine is expected to hold the from scene already, the scenes are copied so
+ * they may be moved or freed while the morph runs. The caller must hold the scheduler lock.
+ *
+ * @param m Pointer to the morph
+ * @param from_name Name of the scene to fade from
+ * @param from The scene to fade from
+ * @param to_name Name of the scene to fade to
+ * @param to The scene to fade to
+ * @param duration_us Length of the morph
+ * @param switch_at Fraction of the morph, 0 to 1, at which the switches are made
+ * @return true The morph was started
+ * @return false Memory could not be allocated or the timer could not be added
+ */
+bool morph_start(struct morph *m, const char *from_name, const struct paramset *from, const char *to_name,
+                 const struct paramset *to, long long duration_us, float switch_at)
+{
+    morph_clear(m);
+    m->stats = (struct morph_stats){0};
+
+    if (m->script == NULL && (m->script = malloc(MAX_SCRIPT)) == NULL)
+        return false;
+    m->fades = malloc((to->count + 1) * sizeof(struct fade));
+    m->switches = malloc((to->count + 1) * sizeof(struct morph_switch));
+    m->from_name = strdup(from_name);
+    m->to_name = strdup(to_name);
+    if (m->fades == NULL || m->switches == NULL || m->from_name == NULL || m->to_name == NULL)
+    {
+        morph_clear(m);
+        return false;
+    }
+
+    for (size_t i = 0; i < to->count; i++)
+    {
+        const struct param *p = &to->params[i];
+        const struct param *q = paramset_find(from, p->name);
+        bool fade = q != NULL && !p->is_string && !q->is_string && param_is_continuous(p->name);
+        if (fade ? q->f == p->f : q != NULL && strcmp(q->value, p->value) == 0)
+            continue;
+
+        if (fade)
+        {
+            struct fade *f = &m->fades[m->num_fades++];
+            *f = (struct fade){.name = strdup(p->name), .from = q->f, .to = p->f};
+            if (f->name == NULL)
+            {
+                m->num_fades--;
+                morph_clear(m);
+                return false;
+            }
+        }
+        else
+        {
+            struct morph_switch *sw = &m->switches[m->num_switches++];
+            *sw = (struct morph_switch){.name = strdup(p->name), .value = strdup(p->value),
+                                        .is_string = p->is_string, .f = p->f};
+            if (sw->name == NULL || sw->value == NULL)
+            {
+                morph_clear(m);
+                return false;
+            }
+        }
+        cache_invalidate(m->cache, p->name);
+    }
+    log_debug("Morphing %zu continuous parameters, switching %zu", m->num_fades, m->num_switches);
+
+    m->to_hash = to->hash;
+    m->start_us = now_us();
+    m->duration_us = duration_us;
+    m->switch_at = switch_at;
+    m->switched = false;
+    if ((m->timer = sched_add(m->sched, MORPH_TICK_US, MORPH_TICK_US, morph_tick, m)) == 0)
+    {
+        morph_clear(m);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop morphing a parameter, for example because it was set directly.
+ * The caller must hold the scheduler lock.
+ *
+ * @param m Pointer to the morph
+ * @param name The parameter name
+ */
+void morph_release(struct morph *m, const char *name)
+{
+    for (size_t i = 0; i < m->num_fades; i++)
+    {
+        if (strcasecmp(m->fades[i].name, name) == 0)
+        {
+            free(m->fades[i].name);
+            m->fades[i] = m->fades[--m->num_fades];
+            return;
+        }
+    }
+    for (size_t i = 0; i < m->num_switches; i++)
+    {
+        if (strcasecmp(m->switches[i].name, name) == 0)
+        {
+            free(m->switches[i].name);
+            free(m->switches[i].value);
+            m->switches[i] = m->switches[--m->num_switches];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Block until the morph in progress has finished.
+ * Must be called without holding the scheduler lock.
+ *
+ * @param m Pointer to the morph
+ */
+void morph_wait(struct morph *m)
+{
+    for (;;)
+    {
+        sched_lock(m->sched);
+        bool running = m->timer != 0;
+        sched_unlock(m->sched);
+        if (!running)
+            break;
+        Sleep(MORPH_TICK_US / 1000);
+    }
+}
+
+/**
+ * @brief Free the morph, the scheduler must have been stopped first
+ *
+ * @param m Pointer to the morph
+ */
+void morph_free(struct morph *m)
+{
+    m->timer = 0; /* the scheduler has gone, there is nothing to cancel */
+    morph_clear(m);
+    free(m->script);
+    *m = (struct morph){0};
+}
+
+/**
+ * @brief Initialize an empty scene store
+ *
+ * @param store Pointer to the store
+ */
+void scenes_init(struct scenes *store)
+{
+    *store = (struct scenes){0};
+}
+
+static struct scene *find(struct scenes *store, const char *name)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        if (strcasecmp(store->items[i].name, name) == 0)
+            return &store->items[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Hold a set in the store under a name, replacing any scene of that name.
+ *
+ * @param store Pointer to the store
+ * @param name The scene name
+ * @param ps A finished set, the store takes ownership of its contents
+ * @return const struct paramset* May return NULL if memory could not be allocated, ps is then freed
+ */
+const struct paramset *scenes_put(struct scenes *store, const char *name, struct paramset *ps)
+{
+    struct scene *sc = find(store, name);
+    if (sc != NULL)
+    {
+        paramset_free(&sc->params);
+        sc->params = *ps;
+        return &sc->params;
+    }
+
+    if (store->count == store->cap)
+    {
+        size_t cap = store->cap ? store->cap * 2 : 8;
+        struct scene *items = realloc(store->items, cap * sizeof(struct scene));
+        if (items == NULL)
+        {
+            paramset_free(ps);
+            return NULL;
+        }
+        store->items = items;
+        store->cap = cap;
+    }
+
+    sc = &store->items[store->count];
+    if ((sc->name = malloc(strlen(name) + 1)) == NULL)
+    {
+        paramset_free(ps);
+        return NULL;
+    }
+    strcpy(sc->name, name);
+    sc->params = *ps;
+    store->count++;
+    return &sc->params;
+}
+
+/**
+ * @brief Get a scene, reading it from <name>.vmrs only if it is not already held.
+ *
+ * @param store Pointer to the store
+ * @param name The scene name
+ * @param reload Read the file again even if the scene is held
+ * @return const struct paramset* May return NULL if the scene could not be read
+ */
+const struct paramset *scenes_get(struct scenes *store, const char *name, bool reload)
+{
+    struct scene *sc = find(store, name);
+    if (sc != NULL && !reload)
+        return &sc->params;
+
+    char path[PATH_SZ];
+    struct paramset ps;
+    snprintf(path, PATH_SZ, "%s%s", name, SCENE_EXT);
+    if (!scene_read(path, &ps))
+        return NULL;
+    return scenes_put(store, name, &ps);
+}
+
+/**
+ * @brief Free every scene held by the store
+ *
+ * @param store Pointer to the store
+ */
+void scenes_free(struct scenes *store)
+{
+    for (size_t i = 0; i < store->count; i++)
+    {
+        free(store->items[i].name);
+        paramset_free(&store->items[i].params);
+    }
+    free(store->items);
+    *store = (struct scenes){0};
+}
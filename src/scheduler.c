@@ -0,0 +1,403 @@
+/**
+ * @file scheduler.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief A scheduler thread driving a hierarchical timer wheel.
+ *
+ * The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots. Level 0 holds timers
+ * due within the next WHEEL_SLOTS ticks, one slot per tick, each level above
+ * covers WHEEL_SLOTS times the span of the one below. Whenever a level wraps
+ * the matching slot of the level above is cascaded down, so adding, cancelling
+ * and expiring a timer never costs more than a few list operations.
+ *
+ * The thread sleeps on a high resolution waitable timer until the next tick
+ * that has work to do, so an idle wheel costs no CPU and a busy one wakes only
+ * when a timer is due.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdlib.h>
+#include "scheduler.h"
+#include "util.h"
+#include "log.h"
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define MAX_CATCHUP 1000 /* Ticks processed per wakeup before the lock is given up */
+
+/**
+ * @brief Place a timer in the slot it belongs to, relative to the current tick.
+ */
+static void insert(struct sched *s, struct timer *t)
+{
+    long long delta = t->expires - s->tick;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1LL << ((level + 1) * WHEEL_BITS))
+        level++;
+
+    int slot = (t->expires >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    t->next = s->slots[level][slot];
+    s->slots[level][slot] = t;
+}
+
+/**
+ * @brief Process the next tick, cascading the levels that wrap and running the timers due.
+ */
+static void advance(struct sched *s)
+{
+    long long tick = ++s->tick;
+
+    for (int level = 1; level < WHEEL_LEVELS; level++)
+    {
+        if ((tick & ((1LL << (level * WHEEL_BITS)) - 1)) != 0)
+            break;
+
+        int slot = (tick >> (level * WHEEL_BITS)) & WHEEL_MASK;
+        struct timer *list = s->slots[level][slot];
+        s->slots[level][slot] = NULL;
+        while (list)
+        {
+            struct timer *next = list->next;
+            insert(s, list);
+            list = next;
+        }
+    }
+
+    struct timer *list = s->slots[0][tick & WHEEL_MASK];
+    s->slots[0][tick & WHEEL_MASK] = NULL;
+    while (list)
+    {
+        struct timer *t = list;
+        list = t->next;
+        if (t->expires > tick)
+        {
+            /* beyond the range of the top level, place it again */
+            insert(s, t);
+            continue;
+        }
+
+        long long deadline = s->start_us + t->expires * WHEEL_TICK_US;
+        if (t->period > 0)
+        {
+            /* drop any repeats that were missed rather than running them back to back */
+            do
+                t->expires += t->period;
+            while (t->expires <= tick);
+            insert(s, t);
+            t->fn(t->udata, deadline);
+        }
+        else
+        {
+            s->count--;
+            timer_fn fn = t->fn;
+            void *udata = t->udata;
+            free(t);
+            fn(udata, deadline);
+        }
+    }
+}
+
+/**
+ * @brief The next tick that has timers to run or a level to cascade, -1 if the wheel is empty.
+ */
+static long long next_expiry(const struct sched *s)
+{
+    if (s->count == 0)
+        return -1;
+
+    for (long long tick = s->tick + 1;; tick++)
+    {
+        if ((tick & WHEEL_MASK) == 0 || s->slots[0][tick & WHEEL_MASK] != NULL)
+            return tick;
+    }
+}
+
+/**
+ * @brief Run the timers posted since the last wakeup, these belong to the caller and are not freed.
+ */
+static void run_posted(struct sched *s)
+{
+    while (s->posted != NULL)
+    {
+        struct timer *t = s->posted;
+        s->posted = t->next;
+        if (s->posted == NULL)
+            s->posted_tail = NULL;
+        t->fn(t->udata, t->expires);
+    }
+}
+
+static DWORD WINAPI run(LPVOID param)
+{
+    struct sched *s = param;
+
+    for (;;)
+    {
+        EnterCriticalSection(&s->lock);
+        run_posted(s);
+        if (s->stopping)
+        {
+            LeaveCriticalSection(&s->lock);
+            break;
+        }
+        long long due = (now_us() - s->start_us) / WHEEL_TICK_US;
+        for (int n = 0; s->tick < due && n < MAX_CATCHUP; n++)
+            advance(s);
+        long long next = next_expiry(s);
+        LeaveCriticalSection(&s->lock);
+
+        if (next < 0)
+        {
+            WaitForSingleObject(s->wake, INFINITE);
+            continue;
+        }
+
+        long long wait_us = s->start_us + next * WHEEL_TICK_US - now_us();
+        if (wait_us <= 0)
+            continue;
+
+        LARGE_INTEGER when = {.QuadPart = -wait_us * 10}; /* relative, in 100ns units */
+        if (s->timer != NULL && SetWaitableTimer(s->timer, &when, 0, NULL, NULL, FALSE))
+        {
+            HANDLE handles[] = {s->wake, s->timer};
+            WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+        }
+        else
+        {
+            WaitForSingleObject(s->wake, (DWORD)((wait_us + 999) / 1000));
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Initialize a scheduler.
+ * The thread is only started once the first timer is added.
+ *
+ * @param s Pointer to the scheduler
+ */
+void sched_init(struct sched *s)
+{
+    *s = (struct sched){0};
+    InitializeCriticalSection(&s->lock);
+}
+
+/**
+ * @brief Take the scheduler lock, timers do not run while it is held.
+ * The lock is recursive so timers may be added or cancelled while holding it.
+ *
+ * @param s Pointer to the scheduler
+ */
+void sched_lock(struct sched *s)
+{
+    EnterCriticalSection(&s->lock);
+}
+
+/**
+ * @brief Give up the scheduler lock
+ *
+ * @param s Pointer to the scheduler
+ */
+void sched_unlock(struct sched *s)
+{
+    LeaveCriticalSection(&s->lock);
+}
+
+static bool start(struct sched *s)
+{
+    s->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (s->wake == NULL)
+    {
+        log_error("Failed to create the scheduler wake event");
+        return false;
+    }
+    s->timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (s->timer == NULL)
+    {
+        log_debug("High resolution timers unavailable, falling back to a standard timer");
+        s->timer = CreateWaitableTimer(NULL, FALSE, NULL);
+    }
+
+    s->start_us = now_us();
+    s->tick = 0;
+    s->thread = CreateThread(NULL, 0, run, s, 0, NULL);
+    if (s->thread == NULL)
+    {
+        log_error("Failed to start the scheduler thread");
+        CloseHandle(s->wake);
+        if (s->timer != NULL)
+            CloseHandle(s->timer);
+        s->wake = s->timer = NULL;
+        return false;
+    }
+    SetThreadPriority(s->thread, THREAD_PRIORITY_TIME_CRITICAL);
+    return true;
+}
+
+/**
+ * @brief Add a timer, starting the scheduler thread if it is not already running
+ *
+ * @param s Pointer to the scheduler
+ * @param delay_us Time until the timer first runs, rounded up to a whole tick
+ * @param period_us Time between repeats, 0 for a timer that runs once
+ * @param fn Called on the scheduler thread when the timer expires
+ * @param udata Passed to fn
+ * @return uint32_t The id of the timer, 0 if it could not be added
+ */
+uint32_t sched_add(struct sched *s, long long delay_us, long long period_us, timer_fn fn, void *udata)
+{
+    uint32_t id = 0;
+
+    EnterCriticalSection(&s->lock);
+    if (s->thread == NULL && !start(s))
+        goto out;
+
+    struct timer *t = malloc(sizeof(struct timer));
+    if (t == NULL)
+    {
+        log_error("Failed to allocate a timer");
+        goto out;
+    }
+
+    long long delay = (delay_us + WHEEL_TICK_US - 1) / WHEEL_TICK_US;
+    long long period = (period_us + WHEEL_TICK_US - 1) / WHEEL_TICK_US;
+    /* the thread may be behind the clock, count from now rather than the last tick processed */
+    long long due = (now_us() - s->start_us) / WHEEL_TICK_US;
+    if (due < s->tick)
+        due = s->tick;
+    if (s->count == 0)
+        s->tick = due; /* nothing to run in between, skip the idle ticks */
+    if (delay < 1)
+        delay = 1;
+
+    if (++s->next_id == 0)
+        s->next_id = 1;
+    *t = (struct timer){
+        .id = s->next_id,
+        .expires = due + delay,
+        .period = period_us > 0 && period < 1 ? 1 : period,
+        .fn = fn,
+        .udata = udata,
+    };
+    insert(s, t);
+    s->count++;
+    id = t->id;
+    SetEvent(s->wake);
+
+out:
+    LeaveCriticalSection(&s->lock);
+    return id;
+}
+
+/**
+ * @brief Run a function on the scheduler thread as soon as it wakes, ahead of the timers due.
+ * The timer is owned by the caller, nothing is allocated, and must stay valid until fn has run.
+ * Posted timers cannot be cancelled, those posted before sched_stop() all run.
+ *
+ * @param s Pointer to the scheduler
+ * @param t Storage for the posted call
+ * @param fn Called on the scheduler thread, deadline_us is the time it was posted
+ * @param udata Passed to fn
+ * @return true The call was posted
+ * @return false The scheduler thread could not be started
+ */
+bool sched_post(struct sched *s, struct timer *t, timer_fn fn, void *udata)
+{
+    bool ok = false;
+
+    EnterCriticalSection(&s->lock);
+    if (s->thread == NULL && !start(s))
+        goto out;
+
+    *t = (struct timer){.expires = now_us(), .fn = fn, .udata = udata};
+    if (s->posted_tail != NULL)
+        s->posted_tail->next = t;
+    else
+        s->posted = t;
+    s->posted_tail = t;
+    SetEvent(s->wake);
+    ok = true;
+
+out:
+    LeaveCriticalSection(&s->lock);
+    return ok;
+}
+
+/**
+ * @brief Cancel a pending timer
+ *
+ * @param s Pointer to the scheduler
+ * @param id The id returned by sched_add
+ * @return true The timer was cancelled
+ * @return false No timer with that id is pending
+ */
+bool sched_cancel(struct sched *s, uint32_t id)
+{
+    bool found = false;
+
+    EnterCriticalSection(&s->lock);
+    for (int level = 0; level < WHEEL_LEVELS && !found; level++)
+    {
+        for (int slot = 0; slot < WHEEL_SLOTS && !found; slot++)
+        {
+            for (struct timer **p = &s->slots[level][slot]; *p != NULL; p = &(*p)->next)
+            {
+                if ((*p)->id == id)
+                {
+                    struct timer *t = *p;
+                    *p = t->next;
+                    free(t);
+                    s->count--;
+                    found = true;
+                    break;
+                }
+            }
+        }
+    }
+    LeaveCriticalSection(&s->lock);
+    return found;
+}
+
+/**
+ * @brief Stop the scheduler thread and free any timers still pending.
+ * Must be called without holding the lock.
+ *
+ * @param s Pointer to the scheduler
+ */
+void sched_stop(struct sched *s)
+{
+    if (s->thread != NULL)
+    {
+        EnterCriticalSection(&s->lock);
+        s->stopping = true;
+        SetEvent(s->wake);
+        LeaveCriticalSection(&s->lock);
+
+        WaitForSingleObject(s->thread, INFINITE);
+        CloseHandle(s->thread);
+        CloseHandle(s->wake);
+        if (s->timer != NULL)
+            CloseHandle(s->timer);
+    }
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++)
+        {
+            while (s->slots[level][slot] != NULL)
+            {
+                struct timer *t = s->slots[level][slot];
+                s->slots[level][slot] = t->next;
+                free(t);
+            }
+        }
+    }
+    DeleteCriticalSection(&s->lock);
+    *s = (struct sched){0};
+}
@@ -0,0 +1,1756 @@
+/**
+ * @file session.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief The vmrcli engine as a library.
+ * A session holds the connection to the Voicemeeter Remote API and everything kept
+ * between lines: the cache, profiles, scenes, devices, ramps, jobs and the variables of the
+ * language. Lines and batches of commands are submitted to it, reads can be made
+ * asynchronously into buffers the caller owns. vmrcli.c is one front end to it.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <strings.h>
+#include <windows.h>
+#include "session.h"
+#include "interface.h"
+#include "wrapper.h"
+#include "log.h"
+#include "util.h"
+#include "command.h"
+#include "compile.h"
+#include "channels.h"
+
+#define MAX_LINE 4096 /* Size of a scene path or script entry */
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#define DELIMITERS " \t;,"
+#define MAX_SCRIPT 48000 /* SetParameters accepts scripts of up to 48kB */
+#define OUTPUT_SZ 2048   /* Longest line of output */
+#define DEFAULT_KIND BANANAX64
+
+/**
+ * @enum The kind of values a get call may return.
+ */
+enum restype : int
+{
+    FLOAT_T,
+    STRING_T,
+};
+
+/**
+ * @struct A struct used for:
+ * - tracking the type of value stored
+ * - storing the result of a get call
+ */
+struct result
+{
+    enum restype type;
+    union val
+    {
+        float f;
+        char s[PARAM_STRING_UTF8_SZ]; /* UTF-8 */
+    } val;
+};
+
+/**
+ * @struct The state of one command while its phase executes
+ */
+struct step
+{
+    bool toggle;    /* A toggle, rewritten as a set of the inverted value */
+    bool skipped;   /* Nothing was written for this command */
+    bool coalesced; /* Held by the coalescer, it is written when the frame ends */
+    struct result res;
+};
+
+static bool read_variable(void *udata, const char *name, bool sync, float *f);
+static void exec_line(void *udata, char *line);
+static void print_line(void *udata, const char *text);
+static void render_metrics(void *udata, const struct vmrcli_state *s);
+static void complete_request(void *udata, long long deadline_us);
+static void parse_input(struct vmrcli_session *session, char *input);
+static bool run_directive(struct vmrcli_session *session, char *input);
+static void profile_directive(struct vmrcli_session *session, char *args);
+static void scene_directive(struct vmrcli_session *session, char *args);
+static void devices_directive(struct vmrcli_session *session, char *args);
+static void level_directive(struct vmrcli_session *session, char *args);
+static void apply_profile(struct vmrcli_session *session, const char *path, bool reload);
+static void apply_if_changed(struct vmrcli_session *session, const struct paramset *ps, const char *what);
+static void morph_scenes(struct vmrcli_session *session, char *args);
+static void at_directive(struct vmrcli_session *session, char *args);
+static void every_directive(struct vmrcli_session *session, char *args);
+static void schedule_line(struct vmrcli_session *session, char *args, bool repeat);
+static void cancel_directive(struct vmrcli_session *session, char *args);
+static void run_job(void *udata, char *line);
+static size_t apply_paramset(struct vmrcli_session *session, const struct paramset *ps);
+static bool param_matches(struct vmrcli_session *session, const struct param *p);
+static void parse_command(char *command, void *udata);
+static bool resolve_device(struct vmrcli_session *session, struct command *cmd);
+static void execute_batch(struct vmrcli_session *session);
+static void execute_phase(struct vmrcli_session *session, struct command *cmds, size_t n);
+static void start_ramp(struct vmrcli_session *session, const struct command *cmd, struct step *step, bool *synced);
+static bool is_write_step(const struct command *cmd, const struct step *step);
+static bool write_phase(struct vmrcli_session *session, struct command *cmds, struct step *steps, size_t n);
+static void print_result(struct vmrcli_session *session, const char *param, const struct result *res);
+static bool read_parameter(struct vmrcli_session *session, char *param, struct result *res);
+static long set(PT_VMR vmr, const struct command *cmd);
+static bool is_redundant_write(struct vmrcli_session *session, const struct command *cmd);
+static const char *set_error_string(long rep);
+
+/**
+ * @brief Load the Voicemeeter Remote API, log in and open a session on it.
+ * Voicemeeter is launched if it is not already running.
+ *
+ * @param session Receives the new session
+ * @param opts How the session behaves, NULL for the defaults
+ * @return int VMRCLI_OK or a negative vmrcli_status
+ */
+int vmrcli_open(struct vmrcli_session **session, const struct vmrcli_options *opts)
+{
+    struct vmrcli_options defaults = {0};
+    if (opts == NULL)
+        opts = &defaults;
+
+    *session = NULL;
+    PT_VMR vmr = create_interface(opts->dll_path);
+    if (vmr == NULL)
+        return VMRCLI_ERR_INTERFACE;
+
+    long rep = login(vmr, opts->kind ? opts->kind : DEFAULT_KIND);
+    if (rep != 0)
+    {
+        free(vmr);
+        return rep == -2 ? VMRCLI_ERR_TIMEOUT : VMRCLI_ERR_LOGIN;
+    }
+
+    struct vmrcli_session *s = malloc(sizeof(struct vmrcli_session));
+    if (s == NULL)
+    {
+        logout(vmr);
+        free(vmr);
+        return VMRCLI_ERR_MEMORY;
+    }
+    session_init(s, vmr, opts);
+    *session = s;
+    return VMRCLI_OK;
+}
+
+/**
+ * @brief Close a session and log out.
+ * Pending jobs are cancelled, ramps in progress are left to finish.
+ *
+ * @param session The session returned by vmrcli_open
+ * @return int VMRCLI_OK, VMRCLI_ERR_LOGIN if logging out failed
+ */
+int vmrcli_close(struct vmrcli_session *session)
+{
+    PT_VMR vmr = session->vmr;
+    session_free(session);
+    free(session);
+
+    long rep = logout(vmr);
+    free(vmr);
+    return rep == 0 ? VMRCLI_OK : VMRCLI_ERR_LOGIN;
+}
+
+/**
+ * @brief Run a line exactly as if it had been entered at the interactive prompt
+ *
+ * @param session Pointer to the session
+ * @param line The line, it is copied and left unmodified
+ */
+void vmrcli_submit(struct vmrcli_session *session, const char *line)
+{
+    char *copy = malloc(strlen(line) + 1);
+    if (copy == NULL)
+    {
+        log_error("malloc failed to allocate memory");
+        return;
+    }
+    strcpy(copy, line);
+    session_feed(session, copy);
+    free(copy);
+}
+
+/**
+ * @brief Run several commands as one batch, optimised and written together as if they
+ * had been entered on one line. No command is split, so values need no quoting.
+ *
+ * @param session Pointer to the session
+ * @param commands The commands, each copied and left unmodified
+ * @param n Number of commands
+ * @return int VMRCLI_OK or VMRCLI_ERR_MEMORY
+ */
+int vmrcli_submit_batch(struct vmrcli_session *session, const char *const *commands, size_t n)
+{
+    int rep = VMRCLI_OK;
+
+    sched_lock(&session->sched);
+    batch_clear(&session->batch);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (is_comment((char *)commands[i]))
+            continue;
+
+        char *copy = malloc(strlen(commands[i]) + 1);
+        if (copy == NULL || !batch_own(&session->batch, copy))
+        {
+            log_error("malloc failed to allocate memory");
+            rep = VMRCLI_ERR_MEMORY;
+            break;
+        }
+        strcpy(copy, commands[i]);
+        parse_command(copy, session);
+    }
+    plan_optimise(&session->batch);
+    execute_batch(session);
+    sched_unlock(&session->sched);
+    return rep;
+}
+
+/**
+ * @brief Read parameters on the scheduler thread, behind one dirty synchronisation.
+ * Nothing is allocated, the results are written into the gets the caller passed.
+ *
+ * @param session Pointer to the session
+ * @param req Storage for the request, it must stay valid until the request is done
+ * @param gets The parameters to read, each receives its value and status
+ * @param n Number of gets
+ * @param callback Called once every get is filled, may be NULL
+ * @param udata Passed to callback
+ * @return int VMRCLI_OK, VMRCLI_ERR_MEMORY if the scheduler thread could not be started
+ */
+int vmrcli_get_async(struct vmrcli_session *session, struct vmrcli_request *req,
+                     struct vmrcli_get *gets, size_t n, vmrcli_done_fn callback, void *udata)
+{
+    *req = (struct vmrcli_request){
+        .session = session,
+        .gets = gets,
+        .n = n,
+        .callback = callback,
+        .udata = udata,
+    };
+    if (!sched_post(&session->sched, &req->timer, complete_request, req))
+        return VMRCLI_ERR_MEMORY;
+    return VMRCLI_OK;
+}
+
+/**
+ * @brief Check whether a request is done, without blocking
+ *
+ * @param req The request passed to vmrcli_get_async
+ * @return true Its gets are filled
+ */
+bool vmrcli_poll(struct vmrcli_request *req)
+{
+    sched_lock(&req->session->sched);
+    bool done = req->done;
+    sched_unlock(&req->session->sched);
+    return done;
+}
+
+/**
+ * @brief Block until a request is done.
+ * Must not be called from a callback of the session, its lock would never be released.
+ *
+ * @param req The request passed to vmrcli_get_async
+ * @param timeout_ms Longest time to wait, negative to wait for as long as it takes
+ * @return int VMRCLI_OK, VMRCLI_ERR_TIMEOUT if the request is still pending
+ */
+int vmrcli_wait(struct vmrcli_request *req, long timeout_ms)
+{
+    struct vmrcli_session *session = req->session;
+    long long deadline = now_us() + timeout_ms * 1000LL;
+
+    sched_lock(&session->sched);
+    while (!req->done)
+    {
+        DWORD wait_ms = INFINITE;
+        if (timeout_ms >= 0)
+        {
+            long long remaining_us = deadline - now_us();
+            if (remaining_us <= 0)
+                break;
+            wait_ms = (DWORD)((remaining_us + 999) / 1000);
+        }
+        SleepConditionVariableCS(&session->done, &session->sched.lock, wait_ms);
+    }
+    bool done = req->done;
+    sched_unlock(&session->sched);
+    return done ? VMRCLI_OK : VMRCLI_ERR_TIMEOUT;
+}
+
+/**
+ * @brief Check whether an if or for block is waiting for more lines
+ *
+ * @param session Pointer to the session
+ * @return true The next line continues a block
+ */
+bool vmrcli_pending(struct vmrcli_session *session)
+{
+    sched_lock(&session->sched);
+    bool pending = lang_pending(&session->lang);
+    sched_unlock(&session->sched);
+    return pending;
+}
+
+/**
+ * @brief Mark the end of the input, reporting any block left open
+ *
+ * @param session Pointer to the session
+ */
+void vmrcli_end_input(struct vmrcli_session *session)
+{
+    sched_lock(&session->sched);
+    lang_finish(&session->lang);
+    sched_unlock(&session->sched);
+}
+
+/**
+ * @brief Write any coalesced sets, then block until every job that runs once has run and every ramp and morph has finished
+ *
+ * @param session Pointer to the session
+ */
+void vmrcli_flush(struct vmrcli_session *session)
+{
+    sched_lock(&session->sched);
+    coalesce_flush(&session->coalescer);
+    sched_unlock(&session->sched);
+    jobs_wait(&session->jobs);
+    ramps_wait(&session->ramps);
+    morph_wait(&session->morph);
+}
+
+/**
+ * @brief Bring the engine into line with a settings file
+ *
+ * @param session Pointer to the session
+ * @param path Path to the settings file
+ * @param full_load Load the whole file with command.load rather than writing the parameters that differ
+ * @return int VMRCLI_OK, VMRCLI_ERR_FILE if the file could not be loaded
+ */
+int vmrcli_load_profile(struct vmrcli_session *session, const char *path, bool full_load)
+{
+    int rep = VMRCLI_OK;
+
+    sched_lock(&session->sched);
+    if (!full_load)
+    {
+        apply_profile(session, path, false);
+    }
+    else
+    {
+        long long elapsed_us;
+        long loaded = load_profile(session->vmr, (char *)path, &elapsed_us);
+        if (loaded == -1)
+        {
+            log_error("Failed loading profile %s", path);
+            rep = VMRCLI_ERR_FILE;
+        }
+        else if (loaded == -2)
+            log_warn("Profile %s not confirmed as loaded after %.1f ms", path, elapsed_us / 1000.0);
+        else
+            log_info("Profile %s loaded in %.1f ms", path, elapsed_us / 1000.0);
+        session->cache.applied_hash = 0;
+        cache_new_generation(&session->cache);
+    }
+    sched_unlock(&session->sched);
+    return rep;
+}
+
+/**
+ * @brief Initialize a session on an interface that is already logged in
+ *
+ * @param session Pointer to the session
+ * @param vmr Pointer to the iVMR interface, it remains owned by the caller
+ * @param opts How the session behaves
+ */
+void session_init(struct vmrcli_session *session, PT_VMR vmr, const struct vmrcli_options *opts)
+{
+    *session = (struct vmrcli_session){
+        .options = *opts,
+        .delimiters = opts->full_line ? DELIMITERS + 1 : DELIMITERS, /* skip space delimiter */
+        .vmr = vmr,
+    };
+
+    long running_kind;
+    session->kind = type(vmr, &running_kind) == 0 ? (enum kind)running_kind : opts->kind ? opts->kind : DEFAULT_KIND;
+
+    cache_init(&session->cache);
+    batch_init(&session->batch);
+    profiles_init(&session->profiles);
+    scenes_init(&session->scenes);
+    devices_init(&session->devices);
+    sched_init(&session->sched);
+    ramps_init(&session->ramps, vmr, &session->sched, &session->cache);
+    morph_init(&session->morph, vmr, &session->sched, &session->cache);
+    coalesce_init(&session->coalescer, vmr, &session->sched, &session->cache, opts->coalesce_us);
+    metrics_init(&session->metrics);
+    osc_init(&session->osc);
+    jobs_init(&session->jobs, &session->sched, run_job, session);
+    lang_init(&session->lang, &(struct lang_host){
+                                  .udata = session,
+                                  .read = read_variable,
+                                  .exec = exec_line,
+                                  .print = print_line,
+                                  .num_strips = kind_num_strips(session->kind),
+                                  .num_buses = kind_num_buses(session->kind),
+                              });
+    InitializeConditionVariable(&session->done);
+
+    /* one publisher gathers the snapshots for the shared section and the metrics alike */
+    publisher_init(&session->publisher, vmr, &session->sched, &session->cache, session->kind);
+    bool shared = opts->publish != NULL && publisher_share(&session->publisher, opts->publish);
+    bool served = opts->metrics_listen != NULL && metrics_start(&session->metrics, opts->metrics_listen);
+    if (served)
+        publisher_watch(&session->publisher, render_metrics, session);
+    if (shared || served)
+        publisher_start(&session->publisher);
+
+    if (opts->osc_listen != NULL)
+        osc_start(&session->osc, session, opts->osc_listen);
+}
+
+/**
+ * @brief Free a session, the interface is left logged in.
+ * Pending jobs are cancelled, ramps in progress are left to finish.
+ *
+ * @param session Pointer to the session
+ */
+void session_free(struct vmrcli_session *session)
+{
+    /* the OSC server drives the session like any other caller, it goes first */
+    osc_stop(&session->osc);
+    struct osc_stats *os = &session->osc.stats;
+    if (os->packets > 0)
+        log_info("Handled %lld OSC messages in %lld packets (%lld bundles), answered %lld of %lld queries, %lld errors",
+                 os->messages, os->packets, os->bundles, os->replies, os->queries, os->errors);
+
+    sched_lock(&session->sched);
+    size_t cancelled = jobs_cancel_all(&session->jobs);
+    coalesce_flush(&session->coalescer);
+    sched_unlock(&session->sched);
+    if (cancelled > 0)
+        log_info("Cancelled %zu pending jobs", cancelled);
+    publisher_stop(&session->publisher);
+    if (session->metrics.thread != NULL)
+        log_info("Served %lld scrapes from %lld pages", session->metrics.scrapes, session->metrics.renders);
+    metrics_stop(&session->metrics);
+    ramps_wait(&session->ramps);
+    morph_wait(&session->morph);
+    sched_stop(&session->sched);
+    jobs_free(&session->jobs);
+    lang_free(&session->lang);
+
+    struct ramp_stats *rs = &session->ramps.stats;
+    if (rs->started > 0)
+        log_info("Ran %lld ramps in %lld ticks, worst tick %.1f ms late",
+                 rs->started, rs->ticks, rs->max_late_us / 1000.0);
+    ramps_free(&session->ramps);
+    morph_free(&session->morph);
+
+    struct coalesce_stats *ks = &session->coalescer.stats;
+    if (ks->in > 0)
+    {
+        double secs = (ks->last_us - ks->first_us) / 1e6;
+        if (secs < 1e-3)
+            secs = 1e-3;
+        log_info("Coalesced %lld sets into %lld writes in %lld scripts, %.0f sets/s in, %.0f writes/s out",
+                 ks->in, ks->out, ks->flushes, ks->in / secs, ks->out / secs);
+    }
+    coalesce_free(&session->coalescer);
+
+    struct cache_stats *cs = &session->cache.stats;
+    log_info("Suppressed %lld of %lld writes (%lld cache refreshes)",
+             cs->suppressed, cs->writes + cs->suppressed, cs->refreshes);
+    cache_free(&session->cache);
+    batch_free(&session->batch);
+    profiles_free(&session->profiles);
+    scenes_free(&session->scenes);
+    devices_free(&session->devices);
+}
+
+/**
+ * @brief Output a line through the session's output function, or to stdout
+ *
+ * @param session Pointer to the session
+ * @param fmt printf style format of the line, without its newline
+ */
+void session_print(struct vmrcli_session *session, const char *fmt, ...)
+{
+    char text[OUTPUT_SZ];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    if (session->options.output != NULL)
+        session->options.output(session->options.udata, text);
+    else
+        puts(text);
+}
+
+/**
+ * @brief Pass a line of input to the language, see lang.c.
+ * Lines that are not statements of the language are run as they are.
+ * The scheduler lock is held throughout so the line runs as one unit.
+ *
+ * @param session Pointer to the session
+ * @param input Each input line, from stdin, a script or CLI args. It is tokenised in place.
+ */
+void session_feed(struct vmrcli_session *session, char *input)
+{
+    sched_lock(&session->sched);
+    if (lang_feed(&session->lang, input) == LANG_NOT_MINE)
+        parse_input(session, input);
+    sched_unlock(&session->sched);
+}
+
+/**
+ * @brief Read a parameter into a variable of the language.
+ * The cache answers when it holds a value confirmed since the engine last changed.
+ *
+ * @param udata Pointer to the session
+ * @param name The parameter to be read
+ * @param sync Wait for the engine first, the program has written since its last read
+ * @param f Receives the value
+ * @return true The parameter was read
+ * @return false The parameter is unknown or does not hold a number
+ */
+static bool read_variable(void *udata, const char *name, bool sync, float *f)
+{
+    struct vmrcli_session *session = udata;
+
+    coalesce_flush(&session->coalescer);
+    if (sync)
+    {
+        clear(session->vmr, is_pdirty);
+        cache_new_generation(&session->cache);
+    }
+
+    struct cache_entry *e = cache_lookup(&session->cache, name);
+    if (e != NULL && e->type == CACHE_FLOAT && cache_entry_is_current(&session->cache, e))
+    {
+        *f = e->f;
+        return true;
+    }
+
+    struct result res;
+    read_parameter(session, (char *)name, &res);
+    if (res.type != FLOAT_T)
+        return false;
+    *f = res.val.f;
+    return true;
+}
+
+/**
+ * @brief Run a line produced by the language
+ *
+ * @param udata Pointer to the session
+ * @param line The line, with its variables filled in
+ */
+static void exec_line(void *udata, char *line)
+{
+    struct vmrcli_session *session = udata;
+    parse_input(session, line);
+}
+
+/**
+ * @brief Output the text of a print statement
+ *
+ * @param udata Pointer to the session
+ * @param text The text, with its variables filled in
+ */
+static void print_line(void *udata, const char *text)
+{
+    session_print(udata, "%s", text);
+}
+
+/**
+ * @brief Render the metrics page from a snapshot, runs on the scheduler thread
+ *
+ * @param udata Pointer to the session
+ * @param s The snapshot
+ */
+static void render_metrics(void *udata, const struct vmrcli_state *s)
+{
+    struct vmrcli_session *session = udata;
+    metrics_render(&session->metrics, s);
+}
+
+/**
+ * @brief Fill the gets of an asynchronous request, runs on the scheduler thread.
+ * The engine is synchronised once for the whole request.
+ *
+ * @param udata Pointer to the request
+ * @param deadline_us The time the request was made
+ */
+static void complete_request(void *udata, long long deadline_us)
+{
+    struct vmrcli_request *req = udata;
+    struct vmrcli_session *session = req->session;
+    struct result res;
+
+    coalesce_flush(&session->coalescer);
+    clear(session->vmr, is_pdirty);
+    cache_new_generation(&session->cache);
+    for (size_t i = 0; i < req->n; i++)
+    {
+        struct vmrcli_get *get = &req->gets[i];
+        if (!read_parameter(session, (char *)get->param, &res))
+        {
+            get->status = VMRCLI_ERR_PARAM;
+            continue;
+        }
+
+        get->status = VMRCLI_OK;
+        if (res.type == FLOAT_T)
+        {
+            get->type = VMRCLI_FLOAT;
+            get->f = res.val.f;
+        }
+        else
+        {
+            get->type = VMRCLI_STRING;
+            snprintf(get->s, VMRCLI_STRING_SZ, "%s", res.val.s);
+        }
+    }
+    log_trace("Request of %zu gets completed in %.1f ms", req->n, (now_us() - deadline_us) / 1000.0);
+
+    req->done = true;
+    WakeAllConditionVariable(&session->done);
+    if (req->callback != NULL)
+        req->callback(req, req->udata);
+}
+
+/**
+ * @brief Parse each input line into separate commands, optimise them and execute them as one batch.
+ * Commands are split on the delimiters of the session, but quoted strings are preserved as single commands.
+ * The scheduler lock is held throughout so no timer touches the engine mid line.
+ * See the test cases for examples of how input lines are parsed:
+ * https://github.com/onyx-and-iris/vmrcli?tab=readme-ov-file#api-commands
+ * @param session Pointer to the session
+ * @param input Each input line, from stdin or CLI args
+ */
+static void parse_input(struct vmrcli_session *session, char *input)
+{
+    if (is_comment(input))
+        return;
+
+    sched_lock(&session->sched);
+    if (!run_directive(session, input))
+    {
+        batch_clear(&session->batch);
+        command_tokenize(input, session->delimiters, parse_command, session);
+        plan_optimise(&session->batch);
+        execute_batch(session);
+    }
+    sched_unlock(&session->sched);
+}
+
+static const struct
+{
+    const char *name;
+    void (*fn)(struct vmrcli_session *session, char *args);
+} directives[] = {
+    {.name = "profile", .fn = profile_directive},
+    {.name = "scene", .fn = scene_directive},
+    {.name = "devices", .fn = devices_directive},
+    {.name = "level", .fn = level_directive},
+    {.name = "at", .fn = at_directive},
+    {.name = "every", .fn = every_directive},
+    {.name = "cancel", .fn = cancel_directive},
+};
+
+/**
+ * @brief Find the directive a line begins with
+ *
+ * @param input The input line
+ * @return int Index into directives, -1 if the line is not a directive
+ */
+static int find_directive(const char *input)
+{
+    input += strspn(input, " \t");
+    for (size_t i = 0; i < COUNT_OF(directives); i++)
+    {
+        size_t n = strlen(directives[i].name);
+        if (strncasecmp(input, directives[i].name, n) == 0 && (input[n] == ' ' || input[n] == '\t' || input[n] == '\0'))
+            return (int)i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Check whether a line begins with the name of a directive
+ *
+ * @param input The input line
+ * @return true The line would run as a directive
+ */
+bool session_is_directive(const char *input)
+{
+    return find_directive(input) >= 0;
+}
+
+/**
+ * @brief Run the line as a directive if it begins with the name of one.
+ * Directives act on the whole line rather than on each token.
+ *
+ * @param session Pointer to the session
+ * @param input The input line
+ * @return true The line was a directive
+ */
+static bool run_directive(struct vmrcli_session *session, char *input)
+{
+    int i = find_directive(input);
+    if (i < 0)
+        return false;
+
+    input += strspn(input, " \t");
+    size_t n = strlen(directives[i].name);
+    char *args = input + n + strspn(input + n, " \t");
+    size_t len = strlen(args);
+    while (len > 0 && isspace((unsigned char)args[len - 1]))
+        args[--len] = '\0';
+    coalesce_flush(&session->coalescer);
+    directives[i].fn(session, args);
+    return true;
+}
+
+/**
+ * @brief profile [preload|reload] <path>
+ * Apply a settings file, or parse it ahead of time so applying it later costs no parsing.
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void profile_directive(struct vmrcli_session *session, char *args)
+{
+    bool preload = false, reload = false;
+    if (strncasecmp(args, "preload ", 8) == 0)
+        preload = true;
+    else if (strncasecmp(args, "reload ", 7) == 0)
+        reload = true;
+    if (preload || reload)
+        args += strcspn(args, " ") + strspn(args + strcspn(args, " "), " \t");
+
+    /* the path may be quoted */
+    size_t len = strlen(args);
+    if (len >= 2 && (args[0] == '"' || args[0] == '\'') && args[len - 1] == args[0])
+    {
+        args[len - 1] = '\0';
+        args++;
+    }
+    if (args[0] == '\0')
+    {
+        log_error("Usage: profile [preload|reload] <path>");
+        return;
+    }
+
+    if (preload)
+    {
+        const struct paramset *ps = profiles_get(&session->profiles, args, true);
+        if (ps != NULL)
+            log_info("Preloaded %zu parameters from %s", ps->count, args);
+        return;
+    }
+    apply_profile(session, args, reload);
+}
+
+/**
+ * @brief Apply the strip and bus parameters of a settings file.
+ * Only the parameters that differ from the engine are written. If the file cannot
+ * be parsed it is loaded in full with command.load instead.
+ *
+ * @param session Pointer to the session
+ * @param path Path to the settings file
+ * @param reload Parse the file again even if it was parsed before
+ */
+static void apply_profile(struct vmrcli_session *session, const char *path, bool reload)
+{
+    long long start = now_us();
+    const struct paramset *ps = profiles_get(&session->profiles, path, reload);
+    if (ps == NULL || ps->count == 0)
+    {
+        long long elapsed_us;
+        log_warn("No parameters parsed from %s, loading it with command.load", path);
+        if (load_profile(session->vmr, (char *)path, &elapsed_us) != 0)
+            log_error("Failed loading profile %s", path);
+        session->cache.applied_hash = 0;
+        cache_new_generation(&session->cache);
+        return;
+    }
+
+    apply_if_changed(session, ps, path);
+    log_debug("Profile %s took %.1f ms", path, (now_us() - start) / 1000.0);
+}
+
+/**
+ * @brief scene save|apply|preload <name> ...
+ *        scene morph <from> <to> <duration> [switch point]
+ * Scenes are snapshots of every strip and bus parameter, kept in <name>.vmrs files
+ * and held in memory once saved or read.
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void scene_directive(struct vmrcli_session *session, char *args)
+{
+    char *action = strtok(args, " \t");
+    if (action != NULL && strcasecmp(action, "morph") == 0)
+    {
+        morph_scenes(session, strtok(NULL, ""));
+        return;
+    }
+
+    char *name = strtok(NULL, " \t");
+    if (action == NULL || name == NULL)
+    {
+        log_error("Usage: scene save|apply|preload <name> ...");
+        return;
+    }
+
+    for (; name != NULL; name = strtok(NULL, " \t"))
+    {
+        if (strcasecmp(action, "save") == 0)
+        {
+            struct paramset ps;
+            char path[MAX_LINE];
+            snprintf(path, MAX_LINE, "%s%s", name, SCENE_EXT);
+            if (!scene_capture(session->vmr, kind_num_strips(session->kind), kind_num_buses(session->kind), &ps))
+            {
+                log_error("Failed capturing scene %s", name);
+                return;
+            }
+            /* the capture consumed the engine's dirty flag */
+            cache_new_generation(&session->cache);
+            const struct paramset *saved = scenes_put(&session->scenes, name, &ps);
+            if (saved != NULL && scene_write(path, saved))
+            {
+                cache_set_applied(&session->cache, saved->hash);
+                log_info("Saved %zu parameters to %s", saved->count, path);
+            }
+        }
+        else if (strcasecmp(action, "apply") == 0)
+        {
+            const struct paramset *ps = scenes_get(&session->scenes, name, false);
+            if (ps != NULL)
+                apply_if_changed(session, ps, name);
+        }
+        else if (strcasecmp(action, "preload") == 0)
+        {
+            const struct paramset *ps = scenes_get(&session->scenes, name, true);
+            if (ps != NULL)
+                log_info("Preloaded scene %s (%zu parameters)", name, ps->count);
+        }
+        else
+        {
+            log_error("Unknown scene action '%s', expected save, apply or preload", action);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief scene morph <from> <to> <duration> [switch point]
+ * Apply the from scene, then fade every continuous parameter to the to scene over the
+ * duration. Switches such as mutes and routing flip together at the switch point,
+ * given as a fraction (0.5) or a percentage (50%) of the morph, halfway by default.
+ * The morph runs on the scheduler, the directive returns as soon as it has started.
+ *
+ * @param session Pointer to the session
+ * @param args The arguments following 'morph'
+ */
+static void morph_scenes(struct vmrcli_session *session, char *args)
+{
+    char *from_name = args ? strtok(args, " \t") : NULL;
+    char *to_name = strtok(NULL, " \t");
+    char *duration = strtok(NULL, " \t");
+    char *switch_point = strtok(NULL, " \t");
+    long long duration_us;
+    float switch_at = 0.5f;
+
+    if (from_name == NULL || to_name == NULL || duration == NULL || !parse_duration(duration, &duration_us))
+    {
+        log_error("Usage: scene morph <from> <to> <duration> [switch point], for example scene morph intro main 2s 50%%");
+        return;
+    }
+    if (switch_point != NULL)
+    {
+        size_t len = strlen(switch_point);
+        bool percent = len > 0 && switch_point[len - 1] == '%';
+        if (percent)
+            switch_point[len - 1] = '\0';
+        if (!parse_float(switch_point, &switch_at) || (switch_at /= percent ? 100 : 1) < 0 || switch_at > 1)
+        {
+            log_error("Switch point '%s' must lie between 0 and 1, or 0%% and 100%%", switch_point);
+            return;
+        }
+    }
+
+    /* look both up before taking pointers, reading a scene may move the others */
+    if (scenes_get(&session->scenes, from_name, false) == NULL || scenes_get(&session->scenes, to_name, false) == NULL)
+        return;
+    const struct paramset *from = scenes_get(&session->scenes, from_name, false);
+    const struct paramset *to = scenes_get(&session->scenes, to_name, false);
+
+    apply_if_changed(session, from, from_name);
+
+    if (!morph_start(&session->morph, from_name, from, to_name, to, duration_us, switch_at))
+        log_error("Unable to start morphing %s to %s", from_name, to_name);
+}
+
+/**
+ * @brief devices [refresh] [in|out] [pattern]
+ * List the audio devices, optionally those of one direction whose names match a pattern.
+ * The devices are enumerated once and again only when their number changes, or on refresh.
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void devices_directive(struct vmrcli_session *session, char *args)
+{
+    bool force = false;
+    int direction = -1; /* -1 either, 0 input, 1 output */
+    const char *pattern = "*";
+
+    for (char *arg = strtok(args, " \t"); arg != NULL; arg = strtok(NULL, " \t"))
+    {
+        if (strcasecmp(arg, "refresh") == 0)
+            force = true;
+        else if (strcasecmp(arg, "in") == 0)
+            direction = 0;
+        else if (strcasecmp(arg, "out") == 0)
+            direction = 1;
+        else
+            pattern = arg;
+    }
+
+    devices_refresh(&session->devices, session->vmr, force);
+    for (size_t i = 0; i < session->devices.count; i++)
+    {
+        const struct device *dev = &session->devices.items[i];
+        if ((direction == -1 || dev->output == (direction == 1)) && devices_glob(pattern, dev->name))
+            session_print(session, "%-3s %-4s %s (%s)", dev->output ? "out" : "in",
+                          device_type_string(dev->type), dev->name, dev->hwid);
+    }
+}
+
+/**
+ * @brief level strip[i]|bus[i] [pre|post|mute]
+ * Print the peak level of each channel of one strip or bus in dB. Strips report
+ * pre fader, post fader (the default) or post mute, buses their output. A bus may
+ * be given by its name on the mixer, for example bus[A1] or bus[B2].
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void level_directive(struct vmrcli_session *session, char *args)
+{
+    char *target = strtok(args, " \t");
+    char *mode = strtok(NULL, " \t");
+    const struct channel_map *map = channel_map(session->kind);
+    char *open = target != NULL ? strchr(target, '[') : NULL;
+    char *close = open != NULL ? strchr(open, ']') : NULL;
+    if (close == NULL || close[1] != '\0' || map == NULL)
+    {
+        log_error("Usage: level strip[i]|bus[i] [pre|post|mute]");
+        return;
+    }
+
+    bool strip = (size_t)(open - target) == 5 && strncasecmp(target, "strip", 5) == 0;
+    bool bus = (size_t)(open - target) == 3 && strncasecmp(target, "bus", 3) == 0;
+    *close = '\0';
+    char *end;
+    long index = strtol(open + 1, &end, 10);
+    if (bus && (end == open + 1 || *end != '\0'))
+        index = channel_bus_index(map, open + 1);
+    else if (end == open + 1 || *end != '\0')
+        index = -1;
+    *close = ']';
+
+    if ((!strip && !bus) || index < 0 || index >= (strip ? map->num_strips : map->num_buses))
+    {
+        log_error("No %s on this kind of Voicemeeter", target);
+        return;
+    }
+
+    long type = -1;
+    if (strip && (mode == NULL || strcasecmp(mode, "post") == 0))
+        type = LEVEL_POST_FADER;
+    else if (strip && strcasecmp(mode, "pre") == 0)
+        type = LEVEL_PRE_FADER;
+    else if (strip && strcasecmp(mode, "mute") == 0)
+        type = LEVEL_POST_MUTE;
+    else if (bus && (mode == NULL || strcasecmp(mode, "post") == 0))
+        type = LEVEL_OUTPUT;
+    if (type < 0)
+    {
+        log_error("Unknown level '%s', strips report pre, post or mute and buses post", mode);
+        return;
+    }
+
+    /* exactly the channels of the strip or bus, in one loop */
+    struct channel_span span = strip ? map->strips[index] : map->buses[index];
+    float levels[CHANNELS_PER_BUS];
+    for (uint32_t i = 0; i < span.count; i++)
+    {
+        long rep = get_level(session->vmr, type, (long)(span.first + i), &levels[i]);
+        if (rep != 0)
+        {
+            log_error("Failed reading the levels of %s (%ld)", target, rep);
+            return;
+        }
+    }
+
+    char line[CHANNELS_PER_BUS * 8 + 64];
+    int len = snprintf(line, sizeof(line), "%s %s:", target, mode != NULL ? mode : "post");
+    for (uint32_t i = 0; i < span.count; i++)
+    {
+        if (levels[i] > 0)
+            len += snprintf(line + len, sizeof(line) - (size_t)len, " %.1f", 20 * log10f(levels[i]));
+        else
+            len += snprintf(line + len, sizeof(line) - (size_t)len, " -inf");
+    }
+    session_print(session, "%s", line);
+}
+
+/**
+ * @brief at [+]<delay> <line>
+ * Run a line once after the delay.
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void at_directive(struct vmrcli_session *session, char *args)
+{
+    schedule_line(session, args, false);
+}
+
+/**
+ * @brief every <period> <line>
+ * Run a line every period until the job is cancelled.
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void every_directive(struct vmrcli_session *session, char *args)
+{
+    schedule_line(session, args, true);
+}
+
+/**
+ * @brief Schedule the line following a delay, printing the id of the job.
+ * The line runs on the scheduler thread exactly as if it had been entered then.
+ *
+ * @param session Pointer to the session
+ * @param args The delay followed by the line
+ * @param repeat Run the line every delay rather than once
+ */
+static void schedule_line(struct vmrcli_session *session, char *args, bool repeat)
+{
+    const char *name = repeat ? "every" : "at";
+    char *delay = args + (!repeat && args[0] == '+');
+    char *line = delay + strcspn(delay, " \t");
+    long long delay_us;
+
+    if (*line != '\0')
+        *line++ = '\0';
+    line += strspn(line, " \t");
+    if (!parse_duration(delay, &delay_us) || *line == '\0' || (repeat && delay_us == 0))
+    {
+        log_error("Usage: %s %s<duration> <commands>", name, repeat ? "" : "[+]");
+        return;
+    }
+
+    uint32_t id = jobs_add(&session->jobs, delay_us, repeat, line);
+    if (id == 0)
+    {
+        log_error("Failed scheduling '%s'", line);
+        return;
+    }
+    session_print(session, "Job %u scheduled", id);
+}
+
+/**
+ * @brief cancel <id> ...|all
+ * Cancel jobs scheduled with at or every.
+ *
+ * @param session Pointer to the session
+ * @param args The rest of the line
+ */
+static void cancel_directive(struct vmrcli_session *session, char *args)
+{
+    if (strcasecmp(args, "all") == 0)
+    {
+        log_info("Cancelled %zu jobs", jobs_cancel_all(&session->jobs));
+        return;
+    }
+
+    for (char *id = strtok(args, " \t"); id != NULL; id = strtok(NULL, " \t"))
+    {
+        char *end;
+        unsigned long n = strtoul(id, &end, 10);
+        if (*end != '\0' || !jobs_cancel(&session->jobs, (uint32_t)n))
+            log_error("No pending job '%s'", id);
+    }
+}
+
+/**
+ * @brief Run the line of a scheduled job, called on the scheduler thread.
+ *
+ * @param udata Pointer to the session
+ * @param line A copy of the job's line
+ */
+static void run_job(void *udata, char *line)
+{
+    struct vmrcli_session *session = udata;
+    parse_input(session, line);
+}
+
+/**
+ * @brief Apply a profile or scene unless it is known to be applied already.
+ *
+ * @param session Pointer to the session
+ * @param ps The values to apply
+ * @param what The name of the profile or scene, for logging
+ */
+static void apply_if_changed(struct vmrcli_session *session, const struct paramset *ps, const char *what)
+{
+    long long start = now_us();
+
+    /* nothing has changed since this set was last applied */
+    if (is_pdirty(session->vmr))
+        cache_new_generation(&session->cache);
+    if (cache_is_applied(&session->cache, ps->hash))
+    {
+        log_info("%s already applied", what);
+        return;
+    }
+
+    size_t changed = apply_paramset(session, ps);
+    cache_set_applied(&session->cache, ps->hash);
+    log_info("%s applied, %zu of %zu parameters changed in %.1f ms",
+             what, changed, ps->count, (now_us() - start) / 1000.0);
+}
+
+/**
+ * @brief Bring the engine into line with a set of parameter values.
+ * Current values are read behind one dirty synchronisation, the parameters that differ
+ * are written as one script (or as few as the script size limit allows).
+ *
+ * @param session Pointer to the session
+ * @param ps The values to apply
+ * @return size_t Number of parameters written
+ */
+static size_t apply_paramset(struct vmrcli_session *session, const struct paramset *ps)
+{
+    char *script = malloc(MAX_SCRIPT);
+    if (script == NULL)
+    {
+        log_error("malloc failed to allocate memory");
+        return 0;
+    }
+
+    clear(session->vmr, is_pdirty);
+    cache_new_generation(&session->cache);
+
+    size_t len = 0, changed = 0;
+    for (size_t i = 0; i < ps->count; i++)
+    {
+        const struct param *p = &ps->params[i];
+        if (param_matches(session, p))
+            continue;
+
+        struct command cmd = {.op = OP_SET, .param = p->name, .value = p->value,
+                              .numeric = !p->is_string, .f = p->f};
+        char entry[MAX_LINE];
+        if (!command_format_script(&cmd, entry, MAX_LINE))
+            continue;
+        size_t n = strlen(entry);
+        if (len > 0 && len + n + 2 > MAX_SCRIPT)
+        {
+            set_parameters(session->vmr, script);
+            len = 0;
+        }
+        if (len > 0)
+            script[len++] = ';';
+        memcpy(script + len, entry, n + 1);
+        len += n;
+
+        if (p->is_string)
+            cache_store_string(&session->cache, p->name, p->value);
+        else
+            cache_store_float(&session->cache, p->name, p->f);
+        session->cache.stats.writes++;
+        changed++;
+    }
+
+    if (len > 0 && set_parameters(session->vmr, script) != 0)
+        log_error("Failed applying profile changes");
+    free(script);
+    return changed;
+}
+
+/**
+ * @brief Does the engine already hold the value of a parameter.
+ *
+ * @param session Pointer to the session
+ * @param p The parameter and the value it should hold
+ * @return true The value already matches
+ */
+static bool param_matches(struct vmrcli_session *session, const struct param *p)
+{
+    struct cache_entry *e = cache_lookup(&session->cache, p->name);
+    if (e == NULL || !cache_entry_is_current(&session->cache, e))
+    {
+        struct result res;
+        read_parameter(session, p->name, &res);
+        e = cache_lookup(&session->cache, p->name);
+        if (e == NULL)
+            return false;
+    }
+
+    if (p->is_string)
+        return e->type == CACHE_STRING && strcmp(e->s, p->value) == 0;
+    return e->type == CACHE_FLOAT && fabsf(e->f - p->f) < 0.0001f;
+}
+
+/**
+ * @brief Classify each token and add it to the batch, expanding any index selector.
+ *
+ * @param command Each token from the input line as its own command string
+ * @param udata Pointer to the session
+ */
+static void parse_command(char *command, void *udata)
+{
+    struct vmrcli_session *session = udata;
+    struct command cmd;
+
+    log_debug("Parsing %s", command);
+
+    char *tokens[MAX_EXPANSION] = {command};
+    int n = 1;
+    if (command_has_selector(command))
+    {
+        /* the expanded tokens are held by the batch until it has run */
+        char *buf = malloc(MAX_EXPANSION * (strlen(command) + 3));
+        if (buf == NULL)
+        {
+            log_error("malloc failed to allocate memory");
+            return;
+        }
+        n = command_expand(command, kind_num_strips(session->kind), kind_num_buses(session->kind), buf, tokens);
+        if (n <= 0)
+        {
+            log_error("Invalid or out of range index selector in '%s'", command);
+            free(buf);
+            return;
+        }
+        if (!batch_own(&session->batch, buf))
+        {
+            log_error("malloc failed to allocate memory");
+            return;
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (!command_parse(tokens[i], &cmd))
+        {
+            log_warn("Ignoring command with no parameter name");
+            continue;
+        }
+        if (cmd.op == OP_SET && cmd.value[0] == '@' && !resolve_device(session, &cmd))
+            continue;
+        if (!batch_push(&session->batch, &cmd))
+            log_error("malloc failed to allocate memory");
+    }
+}
+
+/**
+ * @brief Replace an @pattern value of a device parameter, such as bus[0].device.wdm=@realtek*,
+ * with the name of the first matching device. Devices are matched against the
+ * enumerated store, see devices.c, so a set is never sent for a device that is absent.
+ *
+ * @param session Pointer to the session
+ * @param cmd A set command whose value begins with @
+ * @return true The value now holds the name of a device
+ * @return false The parameter is not a device or no device matches
+ */
+static bool resolve_device(struct vmrcli_session *session, struct command *cmd)
+{
+    const char *dot = strrchr(cmd->param, '.');
+    long type = dot != NULL ? device_type_from_string(dot + 1) : 0;
+    if (type == 0 || dot - cmd->param < 7 || strncasecmp(dot - 7, ".device", 7) != 0)
+    {
+        log_error("'%s' is not a device parameter, @ only matches device names", cmd->param);
+        return false;
+    }
+
+    bool output = strncasecmp(cmd->param, "bus", 3) == 0;
+    const struct device *dev = devices_match(&session->devices, session->vmr, output, type, cmd->value + 1);
+    if (dev == NULL)
+    {
+        log_error("No %s %s device matches '%s'", device_type_string(type), output ? "output" : "input", cmd->value + 1);
+        return false;
+    }
+
+    char *name = malloc(strlen(dev->name) + 1);
+    if (name == NULL || !batch_own(&session->batch, name))
+    {
+        log_error("malloc failed to allocate memory");
+        return false;
+    }
+    strcpy(name, dev->name);
+    log_debug("Resolved %s to '%s'", cmd->value, name);
+    cmd->value = name;
+    cmd->script = NULL; /* a compiled script holds the pattern */
+    return true;
+}
+
+/**
+ * @brief Execute the batch phase by phase.
+ * See plan.c for how the batch is split into phases.
+ *
+ * @param session Pointer to the session
+ */
+static void execute_batch(struct vmrcli_session *session)
+{
+    struct command *cmds = session->batch.cmds;
+    size_t remaining = session->batch.count;
+
+    while (remaining > 0)
+    {
+        size_t n = plan_phase_length(cmds, remaining);
+        log_trace("Executing phase of %zu commands", n);
+        execute_phase(session, cmds, n);
+        cmds += n;
+        remaining -= n;
+    }
+}
+
+/**
+ * @brief Execute one phase of a batch.
+ * Every read, including the read half of each toggle and the start value of each ramp,
+ * is made first behind a single dirty synchronisation. Ramps are handed to the scheduler,
+ * the writes follow in input order. Output is printed afterwards in input order.
+ * See command type definitions in:
+ * https://github.com/onyx-and-iris/vmrcli?tab=readme-ov-file#api-commands
+ *
+ * @param session Pointer to the session
+ * @param cmds The commands of the phase, toggles are rewritten in place
+ * @param n Number of commands
+ */
+static void execute_phase(struct vmrcli_session *session, struct command *cmds, size_t n)
+{
+    struct step *steps = calloc(n, sizeof(struct step));
+    if (steps == NULL)
+    {
+        log_error("malloc failed to allocate memory");
+        return;
+    }
+
+    /* reads and relative writes must see the sets held so far, and come after them */
+    for (size_t i = 0; i < n && session->coalescer.count > 0; i++)
+    {
+        if (cmds[i].op != OP_SET)
+            coalesce_flush(&session->coalescer);
+    }
+
+    bool synced = false;
+    for (size_t i = 0; i < n; i++)
+    {
+        struct command *cmd = &cmds[i];
+        if (cmd->op != OP_GET && cmd->op != OP_TOGGLE && cmd->op != OP_RAMP)
+            continue;
+        if (cmd->op == OP_RAMP)
+        {
+            start_ramp(session, cmd, &steps[i], &synced);
+            continue;
+        }
+
+        if (!synced)
+        {
+            clear(session->vmr, is_pdirty);
+            /* clear() consumes the dirty flag, anything may have changed */
+            cache_new_generation(&session->cache);
+            synced = true;
+        }
+        read_parameter(session, cmd->param, &steps[i].res);
+        if (cmd->op == OP_GET)
+            continue;
+
+        if (steps[i].res.type != FLOAT_T || (steps[i].res.val.f != 0 && steps[i].res.val.f != 1))
+        {
+            if (steps[i].res.type == FLOAT_T)
+                log_warn("%s does not appear to be a boolean parameter", cmd->param);
+            steps[i].skipped = true;
+            continue;
+        }
+        steps[i].toggle = true;
+        cmd->op = OP_SET;
+        cmd->f = 1 - steps[i].res.val.f;
+        cmd->value = cmd->f == 1 ? "1" : "0";
+        cmd->numeric = true;
+        cmd->script = NULL;
+    }
+
+    if (!write_phase(session, cmds, steps, n))
+    {
+        for (size_t i = 0; i < n; i++)
+            steps[i].skipped = true;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct command *cmd = &cmds[i];
+        if (cmd->op == OP_GET)
+        {
+            print_result(session, cmd->param, &steps[i].res);
+            continue;
+        }
+        if (steps[i].skipped || !session->options.extra_output)
+            continue;
+
+        if (steps[i].toggle)
+            session_print(session, "Toggling %s", cmd->param);
+        else if (cmd->op == OP_RAMP)
+            session_print(session, "Ramping %s to %s", cmd->param, cmd->value);
+        else if (cmd->op == OP_SET)
+            session_print(session, "Setting %s=%s", cmd->param, cmd->value);
+        else if (cmd->script != NULL)
+            session_print(session, "Setting %s", cmd->script);
+        else
+            session_print(session, "Setting %s%s%s", cmd->param, cmd->op == OP_INC ? "+=" : "-=", cmd->value);
+    }
+    free(steps);
+}
+
+/**
+ * @brief Hand a ramp to the scheduler, starting from the parameter's current value.
+ * A parameter that is already ramping is retargeted from wherever it has got to.
+ *
+ * @param session Pointer to the session
+ * @param cmd A classified ramp command
+ * @param step The state of the command, marked skipped if the ramp was not started
+ * @param synced Whether the phase has synchronised with the engine yet
+ */
+static void start_ramp(struct vmrcli_session *session, const struct command *cmd, struct step *step, bool *synced)
+{
+    float target;
+    long long duration_us;
+    enum ramp_curve curve;
+
+    step->skipped = true;
+    if (!cmd->numeric || !command_parse_ramp(cmd->value, &target, &duration_us, &curve))
+    {
+        log_error("Invalid ramp '%s', expected <target>@<duration>[:lin|exp|log]", cmd->value);
+        return;
+    }
+
+    step->res.type = FLOAT_T;
+    if (!ramp_current(&session->ramps, cmd->param, &step->res.val.f))
+    {
+        if (!*synced)
+        {
+            clear(session->vmr, is_pdirty);
+            cache_new_generation(&session->cache);
+            *synced = true;
+        }
+        read_parameter(session, cmd->param, &step->res);
+        if (step->res.type != FLOAT_T)
+        {
+            if (step->res.val.s[0] != 0)
+                log_error("Cannot ramp %s, it does not hold a number", cmd->param);
+            return;
+        }
+    }
+
+    if (!ramp_start(&session->ramps, cmd->param, step->res.val.f, target, duration_us, curve))
+    {
+        log_error("Failed starting a ramp of %s", cmd->param);
+        return;
+    }
+    step->skipped = false;
+}
+
+/**
+ * @brief Does the step write its parameter directly, ramps are written by the scheduler
+ */
+static bool is_write_step(const struct command *cmd, const struct step *step)
+{
+    return cmd->op != OP_GET && cmd->op != OP_RAMP && !step->skipped && !step->coalesced;
+}
+
+/**
+ * @brief Make the writes of a phase.
+ * Redundant sets are suppressed. A lone write goes through the typed API where possible,
+ * several writes are joined into a single script. Writing a parameter cancels its ramp.
+ * When coalescing, sets are handed to the coalescer and written when its frame ends.
+ *
+ * @param session Pointer to the session
+ * @param cmds The commands of the phase
+ * @param steps The state of each command, writes not made are marked skipped
+ * @param n Number of commands
+ * @return true The writes were made
+ * @return false The writes failed and the error was logged
+ */
+static bool write_phase(struct vmrcli_session *session, struct command *cmds, struct step *steps, size_t n)
+{
+    size_t num_writes = 0, last = 0, script_cap = 1;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct command *cmd = &cmds[i];
+        if (!is_write_step(cmd, &steps[i]))
+            continue;
+        /* the cache does not know a value still held by the coalescer, the last set wins whatever it is */
+        if (cmd->op == OP_SET && !coalesce_is_pending(&session->coalescer, cmd->param) && is_redundant_write(session, cmd))
+        {
+            session->cache.stats.suppressed++;
+            log_debug("Suppressed redundant write %s=%s", cmd->param, cmd->value);
+            steps[i].skipped = true;
+            continue;
+        }
+        if (cmd->op == OP_SET && session->coalescer.frame_us > 0 &&
+            coalesce_set(&session->coalescer, cmd->param, cmd->value, cmd->numeric, cmd->f))
+        {
+            steps[i].coalesced = true;
+            ramp_cancel(&session->ramps, cmd->param);
+            morph_release(&session->morph, cmd->param);
+            continue;
+        }
+        num_writes++;
+        last = i;
+        /* separator, operator and quotes */
+        script_cap += (cmd->script ? strlen(cmd->script) : strlen(cmd->param) + strlen(cmd->value)) + 6;
+    }
+    if (num_writes == 0)
+        return true;
+    session->cache.stats.writes += num_writes;
+    session->cache.applied_hash = 0;
+
+    long rep;
+    char *script = NULL;
+    if (num_writes == 1 && cmds[last].op == OP_SET)
+    {
+        rep = set(session->vmr, &cmds[last]);
+        if (rep != 0)
+            log_error("Failed setting %s (%s)", cmds[last].param, set_error_string(rep));
+    }
+    else
+    {
+        if ((script = malloc(script_cap)) == NULL)
+        {
+            log_error("malloc failed to allocate memory");
+            return false;
+        }
+
+        size_t len = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!is_write_step(&cmds[i], &steps[i]))
+                continue;
+            if (len > 0)
+                script[len++] = ';';
+            command_format_script(&cmds[i], script + len, script_cap - len);
+            len += strlen(script + len);
+        }
+        rep = set_parameters(session->vmr, script);
+        if (rep != 0)
+            log_error("Failed applying '%s' (%ld)", script, rep);
+        free(script);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const struct command *cmd = &cmds[i];
+        if (!is_write_step(cmd, &steps[i]) || cmd->op == OP_QUICK)
+            continue;
+        ramp_cancel(&session->ramps, cmd->param);
+        morph_release(&session->morph, cmd->param);
+        /* the result of a relative or failed write is only known to the engine */
+        if (rep != 0 || cmd->op != OP_SET)
+            cache_invalidate(&session->cache, cmd->param);
+        else if (cmd->numeric)
+            cache_store_float(&session->cache, cmd->param, cmd->f);
+        else
+            cache_store_string(&session->cache, cmd->param, cmd->value);
+    }
+    return rep == 0;
+}
+
+/**
+ * @brief Print the result of a get call.
+ *
+ * @param session Pointer to the session
+ * @param param The parameter that was read
+ * @param res Pointer to the result
+ */
+static void print_result(struct vmrcli_session *session, const char *param, const struct result *res)
+{
+    switch (res->type)
+    {
+    case FLOAT_T:
+        session_print(session, "%s: %.1f", param, res->val.f);
+        break;
+    case STRING_T:
+        if (res->val.s[0] != '\0')
+            session_print(session, "%s: %s", param, res->val.s);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Execute every command held in a compiled image.
+ * The image is mapped rather than read, no tokenising or classification is repeated.
+ *
+ * @param session Pointer to the session
+ * @param image_path Path to an image written by --compile
+ * @return int VMRCLI_OK, VMRCLI_ERR_FILE if the image could not be opened
+ */
+int vmrcli_run_image(struct vmrcli_session *session, const char *image_path)
+{
+    struct image img;
+    struct command cmd;
+
+    if (!image_open(image_path, &img))
+        return VMRCLI_ERR_FILE;
+
+    for (uint32_t i = 0; image_command(&img, i, &cmd); i++)
+    {
+        sched_lock(&session->sched);
+        batch_clear(&session->batch);
+        if (cmd.op != OP_SET || cmd.value[0] != '@' || resolve_device(session, &cmd))
+            execute_phase(session, &cmd, 1);
+        sched_unlock(&session->sched);
+    }
+    image_close(&img);
+    return VMRCLI_OK;
+}
+
+/**
+ * @brief Read a parameter without waiting for the dirty flag and record the value in the cache.
+ * String values are read as UTF-16 and kept, like every other string, as UTF-8.
+ *
+ * @param session Pointer to the session
+ * @param param The parameter to be read
+ * @param res Pointer to a struct holding the result of the API call.
+ * @return true The parameter was read
+ * @return false The parameter is unknown
+ */
+static bool read_parameter(struct vmrcli_session *session, char *param, struct result *res)
+{
+    res->type = FLOAT_T;
+    if (get_parameter_float(session->vmr, param, &res->val.f) == 0)
+    {
+        cache_store_float(&session->cache, param, res->val.f);
+        return true;
+    }
+
+    res->type = STRING_T;
+    if (get_parameter_string(session->vmr, param, res->val.s, sizeof(res->val.s)) != 0)
+    {
+        res->val.s[0] = '\0';
+        cache_invalidate(&session->cache, param);
+        log_error("Unknown parameter '%s'", param);
+        return false;
+    }
+    cache_store_string(&session->cache, param, res->val.s);
+    return true;
+}
+
+/**
+ * @brief Does the cache show that a set would leave the parameter unchanged.
+ * A matching value is only trusted if it has been confirmed since the engine last
+ * reported dirty parameters, otherwise that single parameter is read again.
+ *
+ * @param session Pointer to the session
+ * @param cmd A classified 'set' command
+ * @return true The write can be skipped
+ * @return false The write must go to the engine
+ */
+static bool is_redundant_write(struct vmrcli_session *session, const struct command *cmd)
+{
+    struct cache *cache = &session->cache;
+    struct cache_entry *e = cache_lookup(cache, cmd->param);
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (e == NULL)
+            return false;
+
+        bool matches = (e->type == CACHE_FLOAT && cmd->numeric && e->f == cmd->f) ||
+                       (e->type == CACHE_STRING && strcmp(e->s, cmd->value) == 0);
+        if (!matches)
+            return false;
+
+        if (attempt == 0 && is_pdirty(session->vmr))
+            cache_new_generation(cache);
+        if (cache_entry_is_current(cache, e))
+            return true;
+
+        struct result res;
+        cache->stats.refreshes++;
+        read_parameter(session, cmd->param, &res);
+        e = cache_lookup(cache, cmd->param);
+    }
+    return false;
+}
+
+/**
+ * @brief Set a single parameter through the typed API calls.
+ * Numeric values go to set_parameter_float(), anything else to set_parameter_string(),
+ * so Voicemeeter does not need to parse a script for a single assignment.
+ * A numeric value rejected as a float (a label such as "123") is retried as a string.
+ *
+ * @param vmr Pointer to the iVMR interface
+ * @param cmd A classified 'set' command
+ * @return long See:
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/include/VoicemeeterRemote.h#L309
+ */
+static long set(PT_VMR vmr, const struct command *cmd)
+{
+    long rep;
+
+    if (cmd->numeric)
+    {
+        rep = set_parameter_float(vmr, cmd->param, cmd->f);
+        if (rep != -3)
+            return rep;
+    }
+    return set_parameter_string(vmr, cmd->param, cmd->value);
+}
+
+/**
+ * @brief Describe the return code of a typed set call.
+ *
+ * @param rep The value returned by the API
+ * @return const char* A short description
+ */
+static const char *set_error_string(long rep)
+{
+    switch (rep)
+    {
+    case -1:
+        return "error";
+    case -2:
+        return "no server";
+    case -3:
+        return "unknown parameter";
+    default:
+        return "unexpected error";
+    }
+}
\ No newline at end of file
@@ -0,0 +1,251 @@
+/**
+ * @file utf.c
+ * @author Onyx and Iris (code@onyxandiris.online)
+ * @brief Functions for converting between UTF-16, as used by the W entry points
+ * of the API, and UTF-8, as used everywhere else.
+ *
+ * Labels and device names are nearly always ASCII, so each conversion checks
+ * 16 bytes (or 8 UTF-16 units) at a time with SSE2 and widens or narrows a whole
+ * block at once while the text stays ASCII, falling back to a character at a
+ * time only for the blocks that are not. Builds without SSE2 take the scalar
+ * path throughout. Invalid input, such as an unpaired surrogate or a malformed
+ * UTF-8 sequence, becomes U+FFFD.
+ * @version 0.14.1
+ * @date 2024-07-06
+ *
+ * @copyright Copyright (c) 2024
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
+ */
+
+#include <string.h>
+#include "utf.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define UTF_SSE2
+#endif
+
+#define REPLACEMENT 0xFFFD
+
+/**
+ * @brief Check whether a string is plain ASCII, and so safe for the A entry points
+ *
+ * @param s The string
+ * @param len Length of the string in bytes
+ * @return true Every byte is below 0x80
+ */
+bool utf8_is_ascii(const char *s, size_t len)
+{
+    size_t i = 0;
+#ifdef UTF_SSE2
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16)
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(s + i)));
+    if (_mm_movemask_epi8(acc) != 0)
+        return false;
+#endif
+    unsigned char bits = 0;
+    for (; i < len; i++)
+        bits |= (unsigned char)s[i];
+    return bits < 0x80;
+}
+
+/**
+ * @brief Write one code point as UTF-8
+ *
+ * @return size_t Bytes written, 0 if there was no room
+ */
+static size_t put_utf8(uint32_t cp, char *dst, size_t room)
+{
+    if (cp < 0x80 && room >= 1)
+    {
+        dst[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800 && room >= 2)
+    {
+        dst[0] = (char)(0xC0 | cp >> 6);
+        dst[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp >= 0x800 && cp < 0x10000 && room >= 3)
+    {
+        dst[0] = (char)(0xE0 | cp >> 12);
+        dst[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+        dst[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    if (cp >= 0x10000 && room >= 4)
+    {
+        dst[0] = (char)(0xF0 | cp >> 18);
+        dst[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+        dst[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+        dst[3] = (char)(0x80 | (cp & 0x3F));
+        return 4;
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert a NUL terminated UTF-16 string to UTF-8.
+ * The output is always NUL terminated and is cut short at a character boundary if it does not fit.
+ *
+ * @param src The UTF-16 string
+ * @param cap Size of the source buffer in units, nothing beyond it is read even without a NUL
+ * @param dst Buffer receiving the UTF-8 string
+ * @param dst_sz Size of dst in bytes, at least 1
+ * @return size_t Length of the UTF-8 string, without its NUL
+ */
+size_t utf16_to_utf8(const uint16_t *src, size_t cap, char *dst, size_t dst_sz)
+{
+    size_t i = 0, out = 0;
+
+    while (i < cap)
+    {
+#ifdef UTF_SSE2
+        if (i + 8 <= cap && out + 8 < dst_sz)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i high = _mm_and_si128(v, _mm_set1_epi16((short)0xFF80));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF)
+            {
+                /* 8 ASCII units, possibly including the NUL, narrowed in one store */
+                _mm_storel_epi64((__m128i *)(dst + out), _mm_packus_epi16(v, v));
+                int zeros = _mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128()));
+                if (zeros != 0)
+                {
+                    out += (size_t)__builtin_ctz((unsigned)zeros) / 2;
+                    dst[out] = '\0';
+                    return out;
+                }
+                i += 8;
+                out += 8;
+                continue;
+            }
+        }
+#endif
+        uint32_t cp = src[i++];
+        if (cp == 0)
+            break;
+        if (cp >= 0xD800 && cp < 0xDC00 && i < cap && src[i] >= 0xDC00 && src[i] < 0xE000)
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (src[i++] - 0xDC00);
+        else if (cp >= 0xD800 && cp < 0xE000)
+            cp = REPLACEMENT;
+
+        size_t n = put_utf8(cp, dst + out, dst_sz - 1 - out);
+        if (n == 0)
+            break;
+        out += n;
+    }
+    dst[out] = '\0';
+    return out;
+}
+
+/**
+ * @brief Decode one UTF-8 sequence, rejecting overlong forms, surrogates and values beyond U+10FFFF
+ *
+ * @return uint32_t The code point, REPLACEMENT for an invalid sequence
+ */
+static uint32_t get_utf8(const unsigned char *s, size_t len, size_t *used)
+{
+    static const uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+    unsigned char c = s[0];
+    size_t n = c < 0x80 ? 1 : c >= 0xF5 ? 0 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC2 ? 2 : 0;
+
+    *used = 1;
+    if (n == 0 || n > len)
+        return c < 0x80 ? c : REPLACEMENT;
+    if (n == 1)
+        return c;
+
+    uint32_t cp = c & (0x7F >> n);
+    for (size_t k = 1; k < n; k++)
+    {
+        if ((s[k] & 0xC0) != 0x80)
+            return REPLACEMENT;
+        cp = cp << 6 | (s[k] & 0x3F);
+    }
+    if (cp < min[n] || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+        return REPLACEMENT;
+    *used = n;
+    return cp;
+}
+
+/**
+ * @brief Convert a UTF-8 string to UTF-16.
+ * The output is always NUL terminated and is cut short at a character boundary if it does not fit.
+ *
+ * @param src The UTF-8 string
+ * @param len Length of the string in bytes
+ * @param dst Buffer receiving the UTF-16 string
+ * @param dst_cap Size of dst in units, at least 1
+ * @return size_t Length of the UTF-16 string in units, without its NUL
+ */
+size_t utf8_to_utf16(const char *src, size_t len, uint16_t *dst, size_t dst_cap)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    size_t i = 0, out = 0;
+
+    while (i < len)
+    {
+#ifdef UTF_SSE2
+        if (i + 16 <= len && out + 16 < dst_cap)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            if (_mm_movemask_epi8(v) == 0)
+            {
+                /* 16 ASCII bytes, widened in two stores */
+                __m128i zero = _mm_setzero_si128();
+                _mm_storeu_si128((__m128i *)(dst + out), _mm_unpacklo_epi8(v, zero));
+                _mm_storeu_si128((__m128i *)(dst + out + 8), _mm_unpackhi_epi8(v, zero));
+                i += 16;
+                out += 16;
+                continue;
+            }
+        }
+#endif
+        size_t used;
+        uint32_t cp = get_utf8(s + i, len - i, &used);
+        size_t units = cp >= 0x10000 ? 2 : 1;
+        if (out + units >= dst_cap)
+            break;
+        if (units == 2)
+        {
+            cp -= 0x10000;
+            dst[out++] = (uint16_t)(0xD800 + (cp >> 10));
+            dst[out++] = (uint16_t)(0xDC00 + (cp & 0x3FF));
+        }
+        else
+        {
+            dst[out++] = (uint16_t)cp;
+        }
+        i += used;
+    }
+    dst[out] = 0;
+    return out;
+}
+
+/**
+ * @brief Copy a NUL terminated UTF-8 string, cut short at a character boundary if it does not fit
+ *
+ * @param src The string
+ * @param dst Buffer receiving the copy, always NUL terminated
+ * @param dst_sz Size of dst in bytes, at least 1
+ * @return size_t Length of the copy in bytes
+ */
+size_t utf8_copy(const char *src, char *dst, size_t dst_sz)
+{
+    size_t len = 0;
+    while (len < dst_sz && src[len] != '\0')
+        len++;
+    if (len == dst_sz)
+    {
+        /* back up over the continuation bytes of a character that would be split */
+        len = dst_sz - 1;
+        while (len > 0 && ((unsigned char)src[len] & 0xC0) == 0x80)
+            len--;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return len;
+}
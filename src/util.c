@@ -9,9 +9,11 @@
  * https://github.com/onyx-and-iris/vmrcli/blob/main/LICENSE
  */
 
+#include <windows.h>
 #include <stdio.h>
 #include <string.h>
 #include "util.h"
+#include "scheduler.h"
 #include "log.h"
 
 /**
@@ -74,6 +76,30 @@ char *kind_as_string(char *s, int kind, int n)
     return s;
 }
 
+/**
+ * @brief Gets the number of strips for a kind of Voicemeeter.
+ *
+ * @param kind The kind of Voicemeeter, 32 or 64 bit
+ * @return int Number of strips, 0 for an unknown kind
+ */
+int kind_num_strips(int kind)
+{
+    static const int strips[] = {3, 5, 8};
+    return kind >= 1 && kind <= 6 ? strips[(kind - 1) % 3] : 0;
+}
+
+/**
+ * @brief Gets the number of buses for a kind of Voicemeeter.
+ *
+ * @param kind The kind of Voicemeeter, 32 or 64 bit
+ * @return int Number of buses, 0 for an unknown kind
+ */
+int kind_num_buses(int kind)
+{
+    static const int buses[] = {2, 5, 8};
+    return kind >= 1 && kind <= 6 ? buses[(kind - 1) % 3] : 0;
+}
+
 /**
  * @brief Converts Voicemeeter's version into a string.
  *
@@ -127,65 +153,159 @@ struct quickcommand *command_in_quickcommands(const char *command_key, const str
 }
 
 /**
- * @brief Adds quotes around the value part of a command if it contains spaces or tabs
+ * @brief Parses a decimal float, the whole string must be consumed.
+ * Handles an optional sign, digits with an optional fraction and an optional exponent,
+ * which covers every numeric value Voicemeeter accepts, without locale lookups.
  *
- * @param command The input command string (parameter=value format)
- * @param output Buffer to store the result
- * @param max_len Maximum length of the output buffer
- * @return true if quotes were added or command was copied successfully
- * @return false if the command is too long or invalid
+ * @param s The string to be parsed
+ * @param f Pointer to a float receiving the value
+ * @return true s was a complete decimal number
+ * @return false s was empty or held anything else
  */
-bool add_quotes_if_needed(const char *command, char *output, size_t max_len)
+bool parse_float(const char *s, float *f)
 {
-    const char *equals_pos = strchr(command, '=');
-    
-    // No '=' found, copy command as-is
-    if (equals_pos == NULL) {
-        if (strlen(command) >= max_len)
-            return false;
-        strcpy(output, command);
-        return true;
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+        1e21, 1e22};
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool negative = false;
+
+    if (*s == '+' || *s == '-')
+        negative = *s++ == '-';
+
+    for (; *s >= '0' && *s <= '9'; s++, digits++)
+    {
+        if (mantissa < 1000000000000000000ULL)
+            mantissa = mantissa * 10 + (unsigned)(*s - '0');
+        else
+            exponent++;
     }
+    if (*s == '.')
+    {
+        for (s++; *s >= '0' && *s <= '9'; s++, digits++)
+        {
+            if (mantissa < 1000000000000000000ULL)
+            {
+                mantissa = mantissa * 10 + (unsigned)(*s - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0)
+        return false;
+
+    if (*s == 'e' || *s == 'E')
+    {
+        bool negative_exp = false;
+        int e = 0;
 
-    const char *value = equals_pos + 1;
-    
-    // Value doesn't contain spaces or tabs, copy command as-is  
-    if (strchr(value, ' ') == NULL && strchr(value, '\t') == NULL) {
-        if (strlen(command) >= max_len)
+        s++;
+        if (*s == '+' || *s == '-')
+            negative_exp = *s++ == '-';
+        if (*s < '0' || *s > '9')
             return false;
-        strcpy(output, command);
-        return true;
+        for (; *s >= '0' && *s <= '9'; s++)
+        {
+            if (e < 1000)
+                e = e * 10 + (*s - '0');
+        }
+        exponent += negative_exp ? -e : e;
     }
-
-    // Value needs quotes - calculate required buffer size
-    size_t param_len = equals_pos - command;
-    size_t value_len = strlen(value);
-    size_t quotes_len = 2;
-    size_t required_len = param_len + 1 + quotes_len + value_len + 1; // param + '=' + '"' + value + '"' + '\0'
-    
-    if (required_len > max_len)
+    if (*s != '\0')
         return false;
-    
-    /**
-     * Construct the output string in the format: parameter="value"
-     * - Copy the parameter part (up to the '=')
-     * - Append '=' and opening quote
-     * - Append the value
-     * - Append closing quote and null terminator
-     */
-    char *pos = output;
-    
-    strncpy(pos, command, param_len);
-    pos += param_len;
-    
-    *pos++ = '=';
-    *pos++ = '"';
-    
-    strcpy(pos, value);
-    pos += value_len;
-    
-    *pos++ = '"';
-    *pos = '\0';
-    
+
+    double value = (double)mantissa;
+    while (exponent > 22)
+    {
+        value *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22)
+    {
+        value /= 1e22;
+        exponent += 22;
+    }
+    value = exponent < 0 ? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+
+    *f = (float)(negative ? -value : value);
     return true;
 }
+
+/**
+ * @brief Read the high resolution performance counter
+ *
+ * @return long long Microseconds since an arbitrary fixed point
+ */
+long long now_us(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+           (long long)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+/**
+ * @brief Read the high resolution performance counter, for timing calls that take microseconds
+ *
+ * @return long long Nanoseconds since an arbitrary fixed point
+ */
+long long now_ns(void)
+{
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (long long)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+           (long long)(counter.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+}
+
+/**
+ * @brief Parses a duration such as 250ms, 2s or 1.5s, a number with no unit is taken as milliseconds.
+ * Durations longer than the span of the scheduler's timer wheel are rejected.
+ *
+ * @param s The string to be parsed
+ * @param us Pointer receiving the duration in microseconds
+ * @return true s was a duration
+ * @return false s was malformed, negative or too long
+ */
+bool parse_duration(const char *s, long long *us)
+{
+    static const struct
+    {
+        const char *unit;
+        double scale;
+    } units[] = {{"us", 1}, {"ms", 1e3}, {"s", 1e6}, {"m", 60e6}, {"", 1e3}};
+    char number[32];
+    float f;
+
+    size_t len = strspn(s, "+-0123456789.");
+    if (len == 0 || len >= sizeof(number))
+        return false;
+    memcpy(number, s, len);
+    number[len] = '\0';
+    if (!parse_float(number, &f) || f < 0)
+        return false;
+
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strcmp(s + len, units[i].unit) == 0)
+        {
+            /* checked before the conversion, a value out of range of long long is undefined */
+            double v = f * units[i].scale;
+            if (v > (double)WHEEL_SPAN_US)
+                return false;
+            *us = (long long)(v + 0.5);
+            return true;
+        }
+    }
+    return false;
+}
@@ -14,13 +14,17 @@
 #include <string.h>
 #include <ctype.h>
 #include <getopt.h>
-#include <windows.h>
+#include "vmrcli.h"
+#include "session.h"
 #include "interface.h"
 #include "wrapper.h"
 #include "log.h"
 #include "util.h"
+#include "compile.h"
+#include "reader.h"
+#include "queue.h"
 
-#define USAGE "Usage: .\\vmrcli.exe [-h] [-v] [-i|-I] [-f] [-k] [-l] [-e] [-c] [-m] [-s] <api commands>\n" \
+#define USAGE "Usage: .\\vmrcli.exe [-h] [-v] [-i|-I] [-f] [-k] [-l] [-e] [-c [-L]] [-m] [-s] [-S <script>] [-C <script> -o <image>] [-r <image>] [-D <dll>] [-F <frame>] [-P <name>] <api commands>\n" \
               "Where: \n"                                                                        \
               "\t-h, --help: Print the help message\n"                                          \
               "\t-v, --version: Print the version number\n"                                     \
@@ -31,39 +35,22 @@
               "\t-l, --log-level: Set log level, must be one of TRACE, DEBUG, INFO, WARN, ERROR, or FATAL\n" \
               "\t-e, --extra-output: Enable extra console output (toggle, set messages)\n"      \
               "\t-c, --config: Load a user configuration (give the full file path)\n"          \
+              "\t-L, --partial-load: Apply only the strip and bus parameters of the configuration that differ\n" \
               "\t-m, --macrobuttons: Launch the MacroButtons application\n"                     \
-              "\t-s, --streamerview: Launch the StreamerView application"
-#define OPTSTR ":hvk:msc:iIfl:e"
-#define MAX_LINE 4096 /* Size of the input buffer */
-#define RES_SZ 512    /* Size of the buffer passed to VBVMR_GetParameterStringW */
-#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+              "\t-s, --streamerview: Launch the StreamerView application\n"                    \
+              "\t-S, --script: Run a script file, or '-' for stdin (no line length limit)\n"   \
+              "\t-C, --compile: Compile a script into a binary image (requires -o)\n"          \
+              "\t-o, --output: The path the compiled image is written to\n"                   \
+              "\t-r, --run: Run a compiled image\n"                                           \
+              "\t-D, --dll: The Voicemeeter Remote library to load, overrides VMRCLI_DLL and the registry\n" \
+              "\t-F, --coalesce: Hold sets for a frame (e.g. 5ms), writing only the last value of each parameter\n" \
+              "\t-P, --publish: Publish the engine's state to a named shared memory section (e.g. Local\\vmrcli)\n" \
+              "\t-M, --metrics-listen: Serve Prometheus metrics of the engine's state (e.g. 127.0.0.1:9100)\n" \
+              "\t-O, --osc-listen: Serve OSC over UDP, /strip/0/gain sets or queries strip[0].gain (e.g. 127.0.0.1:9000)"
+#define OPTSTR ":hvk:msc:LiIfl:eS:C:o:r:D:F:P:M:O:"
 #define DELIMITERS " \t;,"
 #define VERSION "0.14.1"
 
-/**
- * @enum The kind of values a get call may return.
- */
-enum restype : int
-{
-    FLOAT_T,
-    STRING_T,
-};
-
-/**
- * @struct A struct used for:
- * - tracking the type of value stored
- * - storing the result of a get call
- */
-struct result
-{
-    enum restype type;
-    union val
-    {
-        float f;
-        wchar_t s[RES_SZ];
-    } val;
-};
-
 /**
  * @struct A struct to hold the program configuration, set by CLI flags
  */
@@ -72,29 +59,28 @@ struct config_t {
     bool sflag;
     bool cflag;
     char *cvalue;
+    bool partial_load;
     bool iflag;
     bool with_prompt;
     bool fflag;
     bool eflag;
+    char *script_path;
+    char *compile_path;
+    char *output_path;
+    char *run_path;
+    char *dll_path;
+    long long coalesce_us;
+    char *publish;
+    char *metrics_listen;
+    char *osc_listen;
     int log_level;
     enum kind kind;
 };
 
-/**
- * @struct A struct to hold the program context, including the config and the iVMR interface pointer
- */
-struct context_t {
-    struct config_t config;
-    PT_VMR vmr;
-};
-
-static void terminate(PT_VMR vmr, char *msg);
 static void usage();
 static enum kind set_kind(char *kval);
-static void interactive(const struct context_t *context, char *delimiters);
-static void parse_input(const struct context_t *context, char *input, char *delimiters);
-static void parse_command(const struct context_t *context, char *command);
-static void get(PT_VMR vmr, char *command, struct result *res);
+static void interactive(struct vmrcli_session *session, bool with_prompt);
+static void run_script(struct vmrcli_session *session, const char *script_path);
 
 /**
  * @brief Parse CLI flags and set the program configuration accordingly.
@@ -114,11 +100,21 @@ int get_options(struct config_t *config, int argc, char *argv[])
         {"macrobuttons", no_argument,   0, 'm'},
         {"streamerview", no_argument,   0, 's'},
         {"config", required_argument,  0, 'c'},
+        {"partial-load", no_argument,   0, 'L'},
         {"interactive", no_argument,    0, 'i'},
         {"no-prompt", no_argument,      0, 'I'},
         {"full-line", no_argument,      0, 'f'},
         {"log-level", required_argument,0, 'l'},
         {"extra-output", no_argument,   0, 'e'},
+        {"script", required_argument,   0, 'S'},
+        {"compile", required_argument,  0, 'C'},
+        {"output", required_argument,   0, 'o'},
+        {"run",    required_argument,   0, 'r'},
+        {"dll",    required_argument,   0, 'D'},
+        {"coalesce", required_argument, 0, 'F'},
+        {"publish", required_argument,  0, 'P'},
+        {"metrics-listen", required_argument, 0, 'M'},
+        {"osc-listen", required_argument, 0, 'O'},
         {NULL,             0,                  NULL,  0 }
     };
 
@@ -160,6 +156,9 @@ int get_options(struct config_t *config, int argc, char *argv[])
             config->cflag = true;
             config->cvalue = optarg;
             break;
+        case 'L':
+            config->partial_load = true;
+            break;
         case 'I':
             config->with_prompt = false;
             [[fallthrough]];
@@ -185,6 +184,37 @@ int get_options(struct config_t *config, int argc, char *argv[])
         case 'e':
             config->eflag = true;
             break;
+        case 'S':
+            config->script_path = optarg;
+            break;
+        case 'C':
+            config->compile_path = optarg;
+            break;
+        case 'o':
+            config->output_path = optarg;
+            break;
+        case 'r':
+            config->run_path = optarg;
+            break;
+        case 'D':
+            config->dll_path = optarg;
+            break;
+        case 'F':
+            if (!parse_duration(optarg, &config->coalesce_us))
+            {
+                log_fatal("Invalid frame '%s', expected a duration such as 5ms", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'P':
+            config->publish = optarg;
+            break;
+        case 'M':
+            config->metrics_listen = optarg;
+            break;
+        case 'O':
+            config->osc_listen = optarg;
+            break;
         case '?':
             log_fatal("unknown option -- '%c'\n"
                       "Try .\\vmrcli.exe -h for more information.",
@@ -206,6 +236,7 @@ int get_options(struct config_t *config, int argc, char *argv[])
 
 /**
  * @brief Entry point of the program.
+ * The engine lives in session.c, this is one front end to it.
  *
  * @param argc Number of command-line arguments
  * @param argv Array of command-line arguments
@@ -213,89 +244,110 @@ int get_options(struct config_t *config, int argc, char *argv[])
  */
 int main(int argc, char *argv[])
 {
-    struct context_t context = {0};
-    int optind = get_options(&context.config, argc, argv);
+    struct config_t config = {0};
+    int optind = get_options(&config, argc, argv);
 
-    log_set_level(context.config.log_level);
+    log_set_level(config.log_level);
 
-    context.vmr = create_interface();
-    if (context.vmr == NULL)
+    if (config.compile_path)
     {
-        exit(EXIT_FAILURE);
+        if (config.output_path == NULL)
+        {
+            log_fatal("missing output path for --compile, give one with -o");
+            exit(EXIT_FAILURE);
+        }
+        /* skip space delimiter */
+        bool ok = compile_script(config.compile_path, config.output_path, config.fflag ? DELIMITERS + 1 : DELIMITERS, config.kind);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
     }
 
-    long rep = login(context.vmr, context.config.kind);
-    if (rep != 0)
+    struct vmrcli_session *session;
+    int rep = vmrcli_open(&session, &(struct vmrcli_options){
+                                        .kind = config.kind,
+                                        .extra_output = config.eflag,
+                                        .full_line = config.fflag,
+                                        .dll_path = config.dll_path,
+                                        .coalesce_us = config.coalesce_us,
+                                        .publish = config.publish,
+                                        .metrics_listen = config.metrics_listen,
+                                        .osc_listen = config.osc_listen,
+                                    });
+    if (rep == VMRCLI_ERR_TIMEOUT)
+    {
+        log_fatal("Timeout logging into the API.");
+        exit(EXIT_FAILURE);
+    }
+    else if (rep != VMRCLI_OK)
     {
-        if (rep == -2)
-            terminate(context.vmr, "Timeout logging into the API.");
-        else
-            terminate(context.vmr, "Error logging into the Voicemeeter API");
+        if (rep != VMRCLI_ERR_INTERFACE)
+            log_fatal("Error logging into the Voicemeeter API");
+        exit(EXIT_FAILURE);
     }
 
-    if (context.config.mflag)
+    if (config.mflag)
     {
-        run_voicemeeter(context.vmr, MACROBUTTONS);
+        run_voicemeeter(session->vmr, MACROBUTTONS);
         log_info("MacroButtons app launched");
     }
 
-    if (context.config.sflag)
+    if (config.sflag)
     {
-        run_voicemeeter(context.vmr, STREAMERVIEW);
+        run_voicemeeter(session->vmr, STREAMERVIEW);
         log_info("StreamerView app launched");
     }
 
-    if (context.config.cflag)
+    if (config.cflag)
     {
-        set_parameter_string(context.vmr, "command.load", context.config.cvalue);
-        log_info("Profile %s loaded", context.config.cvalue);
-        Sleep(300);
-        clear(context.vmr, is_pdirty);
+        vmrcli_load_profile(session, config.cvalue, !config.partial_load);
     }
 
-    char *delimiter_ptr = DELIMITERS;
-    if (context.config.fflag)
+    if ((config.publish || config.metrics_listen || config.osc_listen) && !config.iflag && !config.script_path && !config.run_path &&
+        optind == argc)
     {
-        delimiter_ptr++; /* skip space delimiter */
+        /* server mode, keep publishing and serving while commands are read without a prompt */
+        if (config.publish)
+            printf("Publishing to '%s'. ", config.publish);
+        if (config.metrics_listen)
+            printf("Serving metrics on '%s'. ", config.metrics_listen);
+        if (config.osc_listen)
+            printf("Serving OSC on '%s'. ", config.osc_listen);
+        puts("Enter 'Q' to exit.");
+        interactive(session, false);
     }
-
-    if (context.config.iflag)
+    else if (config.iflag)
     {
         puts("Interactive mode enabled. Enter 'Q' to exit.");
-        interactive(&context, delimiter_ptr);
+        interactive(session, config.with_prompt);
+    }
+    else if (config.script_path)
+    {
+        run_script(session, config.script_path);
+    }
+    else if (config.run_path)
+    {
+        vmrcli_run_image(session, config.run_path);
     }
     else
     {
         for (int i = optind; i < argc; ++i)
         {
-            parse_input(&context, argv[i], delimiter_ptr);
+            session_feed(session, argv[i]);
         }
     }
+    vmrcli_end_input(session);
 
-    rep = logout(context.vmr);
-    if (rep != 0)
+    if (!config.iflag)
+        vmrcli_flush(session);
+    if (vmrcli_close(session) != VMRCLI_OK)
     {
-        terminate(context.vmr, "Error logging out of the Voicemeeter API");
+        log_fatal("Error logging out of the Voicemeeter API");
+        exit(EXIT_FAILURE);
     }
 
     log_info("Successfully logged out of the Voicemeeter API");
-    free(context.vmr);
     return EXIT_SUCCESS;
 }
 
-/**
- * @brief Write fatal error log, free dyn allocated memory then exit
- *
- * @param vmr Pointer to the iVMR interface
- * @param msg Fatal error message
- */
-static void terminate(PT_VMR vmr, char *msg)
-{
-    log_fatal(msg);
-    free(vmr);
-    exit(EXIT_FAILURE);
-}
-
 /**
  * @brief Prints the help message and exits with success status
  */
@@ -325,231 +377,124 @@ static enum kind set_kind(char *kval)
 }
 
 /**
- * @brief Continuously read lines from stdin.
- * Break if 'Q' is entered on the interactive prompt.
- * Each line is passed to parse_input()
- *
- * @param vmr Pointer to the iVMR interface
- * @param with_prompt If true, prints the interactive prompt '>>'
- * @param delimiters A string of delimiter characters to split each input line
+ * @struct The thread reading input lines into the queue
  */
-static void interactive(const struct context_t *context, char *delimiters)
+struct input_reader
 {
-    char input[MAX_LINE];
+    struct reader r;
+    struct line_queue *q;
+};
+
+/**
+ * @brief Read lines from stdin into the queue until 'Q' or the end of input, then close it
+ */
+static DWORD WINAPI read_input(LPVOID param)
+{
+    struct input_reader *in = param;
+    char *input;
     size_t len;
 
-    if (context->config.with_prompt)
-        printf(">> ");
-    while (fgets(input, MAX_LINE, stdin) != NULL)
+    while ((input = reader_next_line(&in->r, &len)) != NULL)
     {
-        input[(len = strcspn(input, "\n"))] = 0;
         if (len == 1 && toupper(input[0]) == 'Q')
             break;
-
-        parse_input(context, input, delimiters);
-
-        if (context->config.with_prompt)
-            printf(">> ");
-    }
-}
-
-/* Helper functions for parse_input */
-static inline bool is_quote_char(char c) {
-    return (c == '"' || c == '\'');
-}
-
-static inline bool is_delimiter_char(char c, const char *delimiters) {
-    return strchr(delimiters, c) != NULL;
-}
-
-static char* skip_consecutive_delimiters(char *p, const char *delimiters) {
-    while (*p != '\0' && is_delimiter_char(*p, delimiters)) {
-        p++;
-    }
-    return p;
-}
-
-static bool add_char_to_token(char *token, size_t *token_len, char c, size_t max_len) {
-    if (*token_len < max_len - 1) {
-        token[(*token_len)++] = c;
-        return true;
+        if (!queue_push(in->q, input))
+            break;
     }
-    return false; // Buffer would overflow
+    queue_close(in->q);
+    return 0;
 }
 
 /**
- * @brief Parse each input line into separate commands and execute them.
- * Commands are split based on the delimiters argument, but quoted strings are preserved as single commands.
- * See the test cases for examples of how input lines are parsed:
- * https://github.com/onyx-and-iris/vmrcli?tab=readme-ov-file#api-commands
- * @param vmr Pointer to the iVMR interface
- * @param input Each input line, from stdin or CLI args
- * @param delimiters A string of delimiter characters to split each input line
+ * @brief Log how long the lines of each priority waited
  */
-static void parse_input(const struct context_t *context, char *input, char *delimiters)
+static void log_queue_stats(const struct queue_stats *stats)
 {
-    if (is_comment(input))
-        return;
+    static const char *names[PRIORITIES] = {
+        [PRIORITY_URGENT] = "urgent", [PRIORITY_NORMAL] = "normal", [PRIORITY_BULK] = "bulk"};
 
-    char *current = input;
-    char token[MAX_LINE];
-    size_t token_length = 0;
-    bool inside_quotes = false;
-    char quote_char = '\0';
-
-    while (*current != '\0')
+    log_info("Queued %lld lines, at most %zu waiting, %lld moved up to keep writes in order",
+             stats->queued, stats->max_depth, stats->promoted);
+    for (int p = 0; p < PRIORITIES; p++)
     {
-        if (!inside_quotes && is_quote_char(*current))
-        {
-            inside_quotes = true;
-            quote_char = *current;
-            current++;
-            log_trace("Entering quotes with char '%c'", quote_char);
-            continue;
-        }
-        else if (inside_quotes && *current == quote_char)
-        {
-            inside_quotes = false;
-            quote_char = '\0';
-            current++;
-            log_trace("Exiting quotes");
-            continue;
-        }
-        else if (!inside_quotes && is_delimiter_char(*current, delimiters))
-        {
-            if (token_length > 0)
-            {
-                token[token_length] = '\0';
-                parse_command(context, token);
-                token_length = 0;
-            }
-            
-            current = skip_consecutive_delimiters(current, delimiters);
+        if (stats->run[p] == 0)
             continue;
-        }
-        else
-        {
-            if (!add_char_to_token(token, &token_length, *current, MAX_LINE))
-            {
-                log_error("Input token exceeds maximum length of %d characters", MAX_LINE - 1);
-                return;
-            }
-            log_trace("Added char '%c' to token, current token: '%.*s'", *current, (int)token_length, token);
-        }
-        current++;
-    }
-
-    if (token_length > 0)
-    {
-        token[token_length] = '\0';
-        parse_command(context, token);
+        log_info("Ran %lld %s lines, mean wait %.3f ms, worst %.3f ms", stats->run[p], names[p],
+                 stats->total_wait_us[p] / 1000.0 / stats->run[p], stats->max_wait_us[p] / 1000.0);
     }
 }
 
 /**
- * @brief Execute each command according to type.
- * See command type definitions in:
- * https://github.com/onyx-and-iris/vmrcli?tab=readme-ov-file#api-commands
+ * @brief Continuously read lines from stdin.
+ * Break if 'Q' is entered on the interactive prompt.
+ * Lines are read on a thread of their own into a priority queue, so a mute or
+ * quick command runs ahead of a backlog of label, device and EQ writes.
+ * Each line is fed to the session, the prompt becomes '..' while a block is open
  *
- * @param vmr Pointer to the iVMR interface
- * @param command Each token from the input line as its own command string
+ * @param session Pointer to the session
+ * @param with_prompt If true, prints the interactive prompt '>>'
  */
-static void parse_command(const struct context_t *context, char *command)
+static void interactive(struct vmrcli_session *session, bool with_prompt)
 {
-    log_debug("Parsing %s", command);
-
-    static const struct quickcommand quickcommands[] = {
-        {.name = "lock", .fullcommand = "command.lock=1"},
-        {.name = "unlock", .fullcommand = "command.lock=0"},
-        {.name = "show", .fullcommand = "command.show=1"},
-        {.name = "hide", .fullcommand = "command.show=0"},
-        {.name = "restart", .fullcommand = "command.restart=1"}};
+    struct line_queue q;
+    struct input_reader in = {.q = &q};
+    struct queued_line *l;
 
-    struct quickcommand *qc_ptr = command_in_quickcommands(command, quickcommands, (int)COUNT_OF(quickcommands));
-    if (qc_ptr != NULL)
-    {
-        set_parameters(context->vmr, qc_ptr->fullcommand);
-        if (context->config.eflag) {
-            printf("Setting %s\n", qc_ptr->fullcommand);
-        }
+    if (!reader_open_stdin(&in.r))
         return;
-    }
 
-    if (command[0] == '!') /* toggle */
+    queue_init(&q, session->delimiters, kind_num_strips(session->kind), kind_num_buses(session->kind));
+    HANDLE thread = CreateThread(NULL, 0, read_input, &in, 0, NULL);
+    if (thread == NULL)
     {
-        command++;
-        struct result res = {.type = FLOAT_T};
-
-        get(context->vmr, command, &res);
-        if (res.type == FLOAT_T)
-        {
-            if (res.val.f == 1 || res.val.f == 0)
-            {
-                set_parameter_float(context->vmr, command, 1 - res.val.f);
-                if (context->config.eflag) {
-                    printf("Toggling %s\n", command);
-                }
-            }
-            else
-                log_warn("%s does not appear to be a boolean parameter", command);
-        }
+        log_error("Unable to start reading input");
+        queue_free(&q);
+        reader_close(&in.r);
         return;
     }
 
-    if (strchr(command, '=') != NULL) /* set */
+    if (with_prompt)
     {
-        char quoted_command[MAX_LINE];
-        
-        if (add_quotes_if_needed(command, quoted_command, MAX_LINE))
-        {
-            set_parameters(context->vmr, quoted_command);
-            if (context->config.eflag) {
-                printf("Setting %s\n", command);
-            }
-        }
-        else
-        {
-            log_error("Command too long after adding quotes");
-        }
+        printf(">> ");
+        fflush(stdout);
     }
-    else /* get */
+    while ((l = queue_pop(&q)) != NULL)
     {
-        struct result res = {.type = FLOAT_T};
+        session_feed(session, l->line);
+        queue_done(l);
 
-        get(context->vmr, command, &res);
-        switch (res.type)
+        if (with_prompt && queue_depth(&q) == 0)
         {
-        case FLOAT_T:
-            printf("%s: %.1f\n", command, res.val.f);
-            break;
-        case STRING_T:
-            if (res.val.s[0] != '\0')
-                printf("%s: %ls\n", command, res.val.s);
-            break;
-        default:
-            break;
+            printf(vmrcli_pending(session) ? ".. " : ">> ");
+            fflush(stdout);
         }
     }
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+
+    log_queue_stats(&q.stats);
+    queue_free(&q);
+    reader_close(&in.r);
 }
 
 /**
- * @brief Get the value of a float or string parameter.
- * Stores its type and value into a result struct
+ * @brief Execute a script file line by line.
+ * Files are mapped and each line is tokenised where it lies, pipes are streamed.
  *
- * @param vmr Pointer to the iVMR interface
- * @param command A parsed 'get' command as a string
- * @param res Pointer to a struct holding the result of the API call.
+ * @param session Pointer to the session
+ * @param script_path Path to the script, or "-" for stdin
  */
-static void get(PT_VMR vmr, char *command, struct result *res)
+static void run_script(struct vmrcli_session *session, const char *script_path)
 {
-    clear(vmr, is_pdirty);
-    if (get_parameter_float(vmr, command, &res->val.f) != 0)
+    struct reader r;
+    char *input;
+
+    if (!reader_open(&r, script_path))
+        return;
+
+    while ((input = reader_next_line(&r, NULL)) != NULL)
     {
-        res->type = STRING_T;
-        if (get_parameter_string(vmr, command, res->val.s) != 0)
-        {
-            res->val.s[0] = 0;
-            log_error("Unknown parameter '%s'", command);
-        }
+        session_feed(session, input);
     }
-}
\ No newline at end of file
+    reader_close(&r);
+}
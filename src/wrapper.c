@@ -10,13 +10,40 @@
  */
 
 #include <windows.h>
+#include <stdlib.h>
+#include <string.h>
 #include "wrapper.h"
 #include "log.h"
 #include "util.h"
+#include "utf.h"
 
 #define KIND_STR_LEN 64
 #define VERSION_STR_LEN 32
 #define LOGIN_TIMEOUT 2
+#define LOAD_TIMEOUT_MS 5000
+#define SETTLE_POLLS 50 /* Polls spent consuming earlier changes before a load */
+
+/* Read back after a profile load, the load is complete once they hold still */
+static char *load_sentinels[] = {"Strip[0].Gain", "Strip[0].Mute", "Bus[0].Gain", "Bus[0].Mute"};
+
+struct api_stats api_stats;
+const char *api_call_names[API_CALLS] = {"get", "set", "script", "dirty", "level"};
+
+/**
+ * @brief Count an engine call that started at start_ns
+ *
+ * @return long The call's reply, passed through
+ */
+static long timed(enum api_call call, long long start_ns, long rep)
+{
+    long long elapsed = now_ns() - start_ns;
+
+    api_stats.calls[call]++;
+    api_stats.total_ns[call] += elapsed;
+    if (elapsed > api_stats.max_ns[call])
+        api_stats.max_ns[call] = elapsed;
+    return rep;
+}
 
 /**
  * @brief Logs into the API.
@@ -131,7 +158,8 @@ long version(PT_VMR vmr, long *version)
 bool is_pdirty(PT_VMR vmr)
 {
     log_trace("VBVMR_IsParametersDirty()");
-    return vmr->VBVMR_IsParametersDirty() == 1;
+    long long start = now_ns();
+    return timed(API_DIRTY, start, vmr->VBVMR_IsParametersDirty()) == 1;
 }
 
 /**
@@ -146,22 +174,31 @@ bool is_pdirty(PT_VMR vmr)
 long get_parameter_float(PT_VMR vmr, char *param, float *f)
 {
     log_trace("VBVMR_GetParameterFloat(%s, <float> *f)", param);
-    return vmr->VBVMR_GetParameterFloat(param, f);
+    long long start = now_ns();
+    return timed(API_GET, start, vmr->VBVMR_GetParameterFloat(param, f));
 }
 
 /**
- * @brief Get the parameter string object
+ * @brief Get the parameter string object.
+ * The value is read as UTF-16 and returned as UTF-8.
  *
  * @param vmr Pointer to the iVMR interface
  * @param param The parameter to be queried
- * @param s Pointer to a character buffer receiving the string value
+ * @param s Pointer to a character buffer receiving the string value, PARAM_STRING_UTF8_SZ holds any value
+ * @param n Size of the buffer
  * @return long See:
  * https://github.com/onyx-and-iris/vmrcli/blob/main/include/VoicemeeterRemote.h#L173
  */
-long get_parameter_string(PT_VMR vmr, char *param, wchar_t *s)
+long get_parameter_string(PT_VMR vmr, char *param, char *s, size_t n)
 {
-    log_trace("VBVMR_GetParameterStringW(%s, <wchar_t> *s)", param);
-    return vmr->VBVMR_GetParameterStringW(param, s);
+    unsigned short wide[PARAM_STRING_SZ];
+
+    log_trace("VBVMR_GetParameterStringW(%s, <unsigned short> *s)", param);
+    long long start = now_ns();
+    long rep = timed(API_GET, start, vmr->VBVMR_GetParameterStringW(param, wide));
+    if (rep == 0)
+        utf16_to_utf8(wide, PARAM_STRING_SZ, s, n);
+    return rep;
 }
 
 /**
@@ -176,26 +213,40 @@ long get_parameter_string(PT_VMR vmr, char *param, wchar_t *s)
 long set_parameter_float(PT_VMR vmr, char *param, float val)
 {
     log_trace("VBVMR_SetParameterFloat(%s, %.1f)", param, val);
-    return vmr->VBVMR_SetParameterFloat(param, val);
+    long long start = now_ns();
+    return timed(API_SET, start, vmr->VBVMR_SetParameterFloat(param, val));
 }
 
 /**
- * @brief Set the parameter string object
+ * @brief Set the parameter string object.
+ * ASCII values are passed as they are, anything else is converted to UTF-16.
  *
  * @param vmr Pointer to the iVMR interface
  * @param param The parameter to be updated
- * @param s Pointer to a char[] object containing the new value
+ * @param s Pointer to a char[] object containing the new value, in UTF-8
  * @return long See:
  * https://github.com/onyx-and-iris/vmrcli/blob/main/include/VoicemeeterRemote.h#L327
  */
 long set_parameter_string(PT_VMR vmr, char *param, char *s)
 {
-    log_trace("VBVMR_SetParameterStringA(%s, %s)", param, s);
-    return vmr->VBVMR_SetParameterStringA(param, s);
+    size_t len = strlen(s);
+    if (utf8_is_ascii(s, len))
+    {
+        log_trace("VBVMR_SetParameterStringA(%s, %s)", param, s);
+        long long start = now_ns();
+        return timed(API_SET, start, vmr->VBVMR_SetParameterStringA(param, s));
+    }
+
+    unsigned short wide[PARAM_STRING_SZ];
+    utf8_to_utf16(s, len, wide, PARAM_STRING_SZ);
+    log_trace("VBVMR_SetParameterStringW(%s, %s)", param, s);
+    long long start = now_ns();
+    return timed(API_SET, start, vmr->VBVMR_SetParameterStringW(param, wide));
 }
 
 /**
- * @brief Run a script possibly containing multiple instructions
+ * @brief Run a script possibly containing multiple instructions.
+ * Scripts that are not plain ASCII are converted to UTF-16.
  *
  * @param vmr Pointer to the iVMR interface
  * @param command Pointer to a char[] object containing the script
@@ -204,8 +255,98 @@ long set_parameter_string(PT_VMR vmr, char *param, char *s)
  */
 long set_parameters(PT_VMR vmr, char *command)
 {
-    log_trace("VBVMR_SetParameters(%s)", command);
-    return vmr->VBVMR_SetParameters(command);
+    size_t len = strlen(command);
+    if (utf8_is_ascii(command, len))
+    {
+        log_trace("VBVMR_SetParameters(%s)", command);
+        long long start = now_ns();
+        return timed(API_SCRIPT, start, vmr->VBVMR_SetParameters(command));
+    }
+
+    /* a UTF-8 script never has fewer bytes than UTF-16 units */
+    unsigned short *wide = malloc((len + 1) * sizeof(unsigned short));
+    if (wide == NULL)
+    {
+        log_error("malloc failed to allocate memory");
+        return -1;
+    }
+    utf8_to_utf16(command, len, wide, len + 1);
+    log_trace("VBVMR_SetParametersW(%s)", command);
+    long long start = now_ns();
+    long rep = timed(API_SCRIPT, start, vmr->VBVMR_SetParametersW(wide));
+    free(wide);
+    return rep;
+}
+
+/**
+ * @brief Get the current level of an audio channel
+ *
+ * @param vmr Pointer to the iVMR interface
+ * @param type 0 pre fader input, 1 post fader input, 2 post mute input, 3 output
+ * @param channel Zero based channel index, see the channel assignment tables
+ * @param f Pointer to a float object receiving the level, a linear amplitude
+ * @return long See:
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/include/VoicemeeterRemote.h#L245
+ */
+long get_level(PT_VMR vmr, long type, long channel, float *f)
+{
+    log_trace("VBVMR_GetLevel(%ld, %ld, <float> *f)", type, channel);
+    long long start = now_ns();
+    return timed(API_LEVEL, start, vmr->VBVMR_GetLevel(type, channel, f));
+}
+
+/**
+ * @brief Get the number of audio devices available on the system
+ *
+ * @param vmr Pointer to the iVMR interface
+ * @param output Count output devices rather than input devices
+ * @return long Number of devices found
+ */
+long get_device_count(PT_VMR vmr, bool output)
+{
+    if (output)
+    {
+        log_trace("VBVMR_Output_GetDeviceNumber()");
+        return vmr->VBVMR_Output_GetDeviceNumber();
+    }
+    log_trace("VBVMR_Input_GetDeviceNumber()");
+    return vmr->VBVMR_Input_GetDeviceNumber();
+}
+
+/**
+ * @brief Get the descriptor of an audio device.
+ * Names are read as UTF-16 and returned as UTF-8, like string parameters.
+ *
+ * @param vmr Pointer to the iVMR interface
+ * @param output Describe an output device rather than an input device
+ * @param index Index of the device, from 0 to get_device_count() - 1
+ * @param type Receives the device type (VBVMR_DEVTYPE_MME, _WDM, _KS or _ASIO)
+ * @param name Buffer of DEVICE_DESC_UTF8_SZ bytes receiving the device name
+ * @param hwid Buffer of DEVICE_DESC_UTF8_SZ bytes receiving the hardware id
+ * @return long See:
+ * https://github.com/onyx-and-iris/vmrcli/blob/main/include/VoicemeeterRemote.h#L385
+ */
+long get_device_desc(PT_VMR vmr, bool output, long index, long *type, char *name, char *hwid)
+{
+    unsigned short wide_name[DEVICE_DESC_SZ] = {0}, wide_hwid[DEVICE_DESC_SZ] = {0};
+    long rep;
+
+    if (output)
+    {
+        log_trace("VBVMR_Output_GetDeviceDescW(%ld, <long> *t, <unsigned short> *name, <unsigned short> *hwid)", index);
+        rep = vmr->VBVMR_Output_GetDeviceDescW(index, type, wide_name, wide_hwid);
+    }
+    else
+    {
+        log_trace("VBVMR_Input_GetDeviceDescW(%ld, <long> *t, <unsigned short> *name, <unsigned short> *hwid)", index);
+        rep = vmr->VBVMR_Input_GetDeviceDescW(index, type, wide_name, wide_hwid);
+    }
+    if (rep == 0)
+    {
+        utf16_to_utf8(wide_name, DEVICE_DESC_SZ, name, DEVICE_DESC_UTF8_SZ);
+        utf16_to_utf8(wide_hwid, DEVICE_DESC_SZ, hwid, DEVICE_DESC_UTF8_SZ);
+    }
+    return rep;
 }
 
 /**
@@ -266,3 +407,74 @@ void clear(PT_VMR vmr, bool (*f)(PT_VMR))
     while (f(vmr))
         Sleep(1);
 }
+
+/**
+ * @brief Read every sentinel parameter.
+ *
+ * @return true Every sentinel was read and matches the previous reading
+ */
+static bool sentinels_settled(PT_VMR vmr, float *last, bool *have_last)
+{
+    bool settled = *have_last;
+    for (size_t i = 0; i < sizeof(load_sentinels) / sizeof(load_sentinels[0]); i++)
+    {
+        float f;
+        if (get_parameter_float(vmr, load_sentinels[i], &f) != 0)
+            return *have_last = false;
+        settled = settled && f == last[i];
+        last[i] = f;
+    }
+    *have_last = true;
+    return settled;
+}
+
+/**
+ * @brief Loads a profile and waits for the engine to confirm it has been applied.
+ * The load is confirmed once the parameters have become dirty and the sentinel
+ * parameters then read back the same values on two consecutive clean polls.
+ *
+ * @param vmr Pointer to the iVMR interface
+ * @param path Full path to the profile
+ * @param elapsed_us Receives the time taken to confirm the load, or the time waited
+ * @return long
+ *  0: OK, the load was confirmed.
+ * -1: The load command was rejected.
+ * -2: The load was not confirmed before the deadline.
+ */
+long load_profile(PT_VMR vmr, char *path, long long *elapsed_us)
+{
+    float last[sizeof(load_sentinels) / sizeof(load_sentinels[0])];
+    bool have_last = false;
+    bool transitioned = false;
+
+    long long start = now_us();
+    long long deadline = start + LOAD_TIMEOUT_MS * 1000LL;
+
+    /* consume any earlier change so the transition can only come from the load,
+       a ramp or another client may keep the engine dirty so this is bounded too */
+    for (int polls = 0; polls < SETTLE_POLLS && is_pdirty(vmr); polls++)
+        Sleep(1);
+    if (set_parameter_string(vmr, "command.load", path) != 0)
+    {
+        *elapsed_us = now_us() - start;
+        return -1;
+    }
+
+    while (now_us() < deadline)
+    {
+        if (is_pdirty(vmr))
+        {
+            transitioned = true;
+            have_last = false;
+        }
+        else if (transitioned && sentinels_settled(vmr, last, &have_last))
+        {
+            *elapsed_us = now_us() - start;
+            return 0;
+        }
+        Sleep(1);
+    }
+
+    *elapsed_us = now_us() - start;
+    return -2;
+}